@@ -0,0 +1,420 @@
+/*! @file
+    @brief Repeatable benchmark suite over the bundled spectra.
+
+    Runs each scenario in-process against a search library (normally
+    libMockSearchSDK.so, so results don't depend on KnowItAll's database):
+
+    - init_cold     first load and SearchSDK_Init of the library
+    - init_warm     SearchSDK_Exit / SearchSDK_Init cycles once loaded
+    - parse_good    Measurement loads of every CSV in data/good
+    - parse_broke   Measurement loads of the known-bad CSVs in data/broke
+    - search        SearchSession::search only, on pre-parsed spectra
+    - measurement   processMeasurement (search, logging and formatting)
+    - directory_jN  processDirectory end-to-end with --jobs N
+    - pack          packing data/good into a corpus file (see Corpus)
+    - corpus_jN     processCorpus end-to-end over that file with --jobs N
+    - stream_text   processStream fed text requests through an in-process pipe
+
+    Log output goes to the null device, but is still formatted, as it is part
+    of what's being measured.  Each scenario prints one JSON object per line
+    on stdout, for tracking over time:
+
+    \code
+    {"scenario":"search","items":1365,"elapsed_sec":0.0123,"items_per_sec":110975.6,
+     "p50_ms":0.008,"p95_ms":0.012,"p99_ms":0.016,"max_ms":0.09}
+    \endcode
+
+    Set MOCK_SEARCHSDK_LATENCY_MS=0 to measure KIAConsole's own overhead.
+
+    Usage: KIABench path/to/libMockSearchSDK.so [data directory] [repeats] [jobs]
+*/
+
+#include "pch.h"
+
+#include "Corpus.h"
+#include "DirectoryWalker.h"
+#include "Measurement.h"
+#include "Options.h"
+#include "Processing.h"
+#include "SearchLibrary.h"
+#include "SearchSession.h"
+#include "Stats.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define pipe(fds) _pipe(fds, 64 * 1024, _O_BINARY)
+#define read _read
+#define write _write
+#define close _close
+#else
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::ifstream;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+typedef steady_clock::time_point TimePoint;
+
+//! one line of output
+struct Result
+{
+    string scenario;
+    long items = 0;
+    double elapsedSec = 0;
+    double megabytes = 0;           //!< input processed, if meaningful
+    LatencyHistogram latency;       //!< per item, if measured
+
+    void record(TimePoint start)
+    {
+        latency.record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock::now() - start).count());
+    }
+
+    void print() const
+    {
+        printf("{\"scenario\":\"%s\",\"items\":%ld,\"elapsed_sec\":%.6lf,\"items_per_sec\":%.1lf",
+            scenario.c_str(), items, elapsedSec, elapsedSec > 0 ? items / elapsedSec : 0.0);
+        if (megabytes > 0)
+            printf(",\"mb_per_sec\":%.2lf", elapsedSec > 0 ? megabytes / elapsedSec : 0.0);
+        if (latency.count)
+            printf(",\"p50_ms\":%.6lf,\"p95_ms\":%.6lf,\"p99_ms\":%.6lf,\"max_ms\":%.6lf",
+                1e-6 * latency.percentile(0.50), 1e-6 * latency.percentile(0.95),
+                1e-6 * latency.percentile(0.99), 1e-6 * latency.maxNS);
+        printf("}\n");
+        fflush(stdout);
+    }
+};
+
+//! istream buffer reading from a pipe file descriptor
+class PipeBuf : public std::streambuf
+{
+    public:
+        explicit PipeBuf(int fd) : fd(fd) {}
+
+    protected:
+        int_type underflow() override
+        {
+            int n = (int) read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                return traits_type::eof();
+            setg(buf, buf, buf + n);
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        int fd;
+        char buf[64 * 1024];
+};
+
+static double elapsedSince(TimePoint start)
+{
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static vector<wstring> findFiles(const wstring& directory)
+{
+    return DirectoryWalker(directory, L"*.csv").list(true);
+}
+
+static double fileMB(const vector<wstring>& files)
+{
+    double total = 0;
+    for (auto& pathname : files)
+    {
+        ifstream f(Util::toString(pathname), std::ios::binary | std::ios::ate);
+        if (f)
+            total += (double) f.tellg() / (1024.0 * 1024.0);
+    }
+    return total;
+}
+
+static Result benchParse(const char* scenario, const vector<wstring>& files, int repeats)
+{
+    Result r;
+    r.scenario = scenario;
+    r.megabytes = fileMB(files) * repeats;
+
+    auto start = steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+    {
+        for (auto& pathname : files)
+        {
+            auto itemStart = steady_clock::now();
+            Measurement m(pathname);
+            r.record(itemStart);
+            r.items++;
+        }
+    }
+    r.elapsedSec = elapsedSince(start);
+    return r;
+}
+
+static Result benchSearch(const SearchLibrary& library, const vector<Measurement>& spectra, int repeats, bool report)
+{
+    Result r;
+    r.scenario = report ? "measurement" : "search";
+
+    SearchSession session(library);
+    auto start = steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+    {
+        for (auto& m : spectra)
+        {
+            auto itemStart = steady_clock::now();
+            if (report)
+                processMeasurement(m, session);
+            else
+                session.search(m);
+            r.record(itemStart);
+            r.items++;
+        }
+    }
+    r.elapsedSec = elapsedSince(start);
+    session.close();
+    return r;
+}
+
+static Result benchDirectory(const SearchLibrary& library, const string& directory, size_t fileCount, int jobs)
+{
+    Result r;
+    r.scenario = Util::sstring("directory_j%d", jobs);
+
+    string jobsArg = std::to_string(jobs);
+    const char* argv[] = { "KIABench", "--directory", directory.c_str(), "--jobs", jobsArg.c_str() };
+    Options opts(5, const_cast<char**>(argv));
+
+    auto start = steady_clock::now();
+    processDirectory(library, opts);
+    r.elapsedSec = elapsedSince(start);
+    r.items = (long) fileCount;
+    return r;
+}
+
+static Result benchPack(const string& directory, const string& corpus, const vector<wstring>& files)
+{
+    Result r;
+    r.scenario = "pack";
+
+    size_t bytes = 0;
+    string contents;
+    for (auto& pathname : files)
+        if (Util::readFile(pathname, contents))
+            bytes += contents.size();
+
+    auto start = steady_clock::now();
+    Corpus::pack(Util::toWstring(directory.c_str()), Util::toWstring(corpus.c_str()));
+    r.elapsedSec = elapsedSince(start);
+    r.items = (long) files.size();
+    r.megabytes = bytes / 1e6;
+    return r;
+}
+
+static Result benchCorpus(const SearchLibrary& library, const string& corpus, size_t spectrumCount, int jobs)
+{
+    Result r;
+    r.scenario = Util::sstring("corpus_j%d", jobs);
+
+    string jobsArg = std::to_string(jobs);
+    const char* argv[] = { "KIABench", "--corpus", corpus.c_str(), "--jobs", jobsArg.c_str() };
+    Options opts(5, const_cast<char**>(argv));
+
+    auto start = steady_clock::now();
+    processCorpus(library, opts);
+    r.elapsedSec = elapsedSince(start);
+    r.items = (long) spectrumCount;
+    return r;
+}
+
+//! format spectra as text requests, as ENLIGHTEN's KIAWrapper would send them
+static string textRequests(const vector<Measurement>& spectra, int repeats)
+{
+    string text;
+    char line[64];
+    for (int i = 0; i < repeats; i++)
+    {
+        for (auto& m : spectra)
+        {
+            snprintf(line, sizeof(line), "PIXELS, %d\n", (int) m.x.size());
+            text += line;
+            for (size_t j = 0; j < m.x.size(); j++)
+            {
+                snprintf(line, sizeof(line), "%.6lf, %.6lf\n", m.x[j], m.y[j]);
+                text += line;
+            }
+        }
+    }
+    text += "QUIT\n";
+    return text;
+}
+
+static Result benchStream(const SearchLibrary& library, const vector<Measurement>& spectra, int repeats)
+{
+    Result r;
+    r.scenario = "stream_text";
+
+    string text = textRequests(spectra, repeats);
+    r.megabytes = text.size() / (1024.0 * 1024.0);
+    r.items = (long) (spectra.size() * repeats);
+
+    int fds[2];
+    if (pipe(fds))
+    {
+        fprintf(stderr, "ERROR: unable to create pipe\n");
+        return r;
+    }
+
+    const char* argv[] = { "KIABench", "--streaming" };
+    Options opts(2, const_cast<char**>(argv));
+
+    PipeBuf buf(fds[0]);
+    std::streambuf* original = std::cin.rdbuf(&buf);
+
+    auto start = steady_clock::now();
+    std::thread writer([&]()
+    {
+        const char* p = text.data();
+        size_t remaining = text.size();
+        while (remaining > 0)
+        {
+            int n = (int) write(fds[1], p, (unsigned) (remaining < 65536 ? remaining : 65536));
+            if (n <= 0)
+                break;
+            p += n;
+            remaining -= n;
+        }
+        close(fds[1]);
+    });
+
+    processStream(library, opts);
+    r.elapsedSec = elapsedSince(start);
+
+    writer.join();
+    std::cin.rdbuf(original);
+    close(fds[0]);
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: KIABench path/to/libMockSearchSDK.so [data directory] [repeats] [jobs]\n");
+        return -1;
+    }
+
+    wstring library = Util::toWstring(argv[1]);
+    string data = argc > 2 ? argv[2] : "data";
+    int repeats = argc > 3 ? atoi(argv[3]) : 3;
+    int jobs = argc > 4 ? atoi(argv[4]) : 4;
+    if (repeats < 1 || jobs < 1)
+    {
+        printf("ERROR: repeats and jobs must be positive\n");
+        return -1;
+    }
+
+    string good = data + "/good";
+    vector<wstring> goodFiles = findFiles(Util::toWstring(good.c_str()));
+    vector<wstring> brokeFiles = findFiles(Util::toWstring((data + "/broke").c_str()));
+    if (goodFiles.empty())
+    {
+        printf("ERROR: no CSV files found in %s\n", good.c_str());
+        return -1;
+    }
+
+    // keep the cost of formatting log lines, but not of displaying them
+#ifdef _WIN32
+    FILE* devnull = fopen("NUL", "w");
+#else
+    FILE* devnull = fopen("/dev/null", "w");
+#endif
+    if (devnull)
+        Util::setLogFile(devnull);
+
+    // library init, first cold then warm
+    SearchLibrary lib;
+    {
+        Result r;
+        r.scenario = "init_cold";
+        auto start = steady_clock::now();
+        if (!lib.load(library))
+        {
+            printf("ERROR: unable to load %s\n", argv[1]);
+            return -1;
+        }
+        lib.initFn();
+        r.record(start);
+        r.elapsedSec = elapsedSince(start);
+        r.items = 1;
+        r.print();
+    }
+    {
+        Result r;
+        r.scenario = "init_warm";
+        auto start = steady_clock::now();
+        for (int i = 0; i < repeats; i++)
+        {
+            lib.exitFn();
+            auto itemStart = steady_clock::now();
+            lib.initFn();
+            r.record(itemStart);
+            r.items++;
+        }
+        r.elapsedSec = elapsedSince(start);
+        r.print();
+    }
+
+    benchParse("parse_good", goodFiles, repeats).print();
+    if (!brokeFiles.empty())
+        benchParse("parse_broke", brokeFiles, repeats).print();
+
+    vector<Measurement> spectra;
+    spectra.reserve(goodFiles.size());
+    for (auto& pathname : goodFiles)
+    {
+        Measurement m(pathname);
+        if (m.isValid())
+            spectra.push_back(std::move(m));
+    }
+
+    benchSearch(lib, spectra, repeats, false).print();
+    benchSearch(lib, spectra, repeats, true).print();
+
+    benchDirectory(lib, good, goodFiles.size(), 1).print();
+    if (jobs > 1)
+        benchDirectory(lib, good, goodFiles.size(), jobs).print();
+
+    // the same files again, packed beforehand
+#ifdef _WIN32
+    string corpus = string(getenv("TEMP") ? getenv("TEMP") : ".") + "\\KIABench.kias";
+#else
+    string corpus = "/tmp/KIABench-" + std::to_string(getpid()) + ".kias";
+#endif
+    benchPack(good, corpus, goodFiles).print();
+    benchCorpus(lib, corpus, spectra.size(), 1).print();
+    if (jobs > 1)
+        benchCorpus(lib, corpus, spectra.size(), jobs).print();
+    remove(corpus.c_str());
+
+    benchStream(lib, spectra, 1).print();
+
+    lib.exitFn();
+    Util::setLogFile(stdout);
+    if (devnull)
+        fclose(devnull);
+    return 0;
+}
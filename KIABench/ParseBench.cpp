@@ -0,0 +1,172 @@
+/*! @file
+    @brief Micro-benchmark of CSV spectrum parsing throughput.
+
+    Loads every CSV under a directory (default data/good) repeatedly, through
+    both the original getline / Util::split / stod loader (reproduced below as
+    legacyLoad) and the current Measurement parser, and reports MB/s for each.
+
+    Usage: ParseBench [directory] [iterations]
+*/
+
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+#include "Measurement.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::ifstream;
+using std::istream;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! Measurement::load as of KIAConsole 0.5.1 (plus an EOF check, as the
+//! original would spin forever on a truncated file)
+static bool legacyLoad(istream& is, vector<double>& x, vector<double>& y)
+{
+    int pixels = 1024;
+    [[maybe_unused]] int max_results = 20;
+    [[maybe_unused]] double min_confidence = 0.60;
+
+    char buf[256];
+    int linecount = -1;
+    bool using_markers = false;
+
+    while (is)
+    {
+        is.getline(buf, sizeof(buf));
+        string line(buf);
+        Util::trim(line);
+
+        linecount++;
+
+        if (line.size() == 0 || line[0] == '#' || line[0] == '/')
+            continue;
+
+        if (linecount == 0 && Util::startswith(line, "REQUEST_START"))
+        {
+            using_markers = true;
+            continue;
+        }
+        else if (using_markers && Util::startswith(line, "REQUEST_END"))
+            break;
+        else if (Util::startswith(line, "QUIT"))
+            return false;
+
+        vector<string> tokens = Util::split(line, ",");
+        if (tokens.size() < 2)
+            return false;
+
+        string field = Util::toLower(tokens[0]);
+        if (field == "pixels" || field == "pixel count")
+        {
+            pixels = atoi(tokens[1].c_str());
+            continue;
+        }
+        else if (field == "max_results")
+        {
+            max_results = atoi(tokens[1].c_str());
+            continue;
+        }
+        else if (field == "min_confidence")
+        {
+            min_confidence = stod(tokens[1]);
+            continue;
+        }
+
+        if (!(('0' <= line[0] && line[0] <= '9') || line[0] == '-'))
+            continue;
+
+        x.push_back(stod(tokens[0]));
+        y.push_back(stod(tokens[1]));
+
+        if (!using_markers && (int) x.size() == pixels)
+        {
+            Util::log(L"Read expected %d pixels", pixels);
+            break;
+        }
+    }
+
+    Util::log(L"Finished loading measurement");
+    if (pixels == (int) x.size())
+    {
+        Util::log(L"Measurement valid (found expected %d pixels)", pixels);
+        return true;
+    }
+    Util::log(L"Measurement invalid; read %d of %d pixels", (int) x.size(), pixels);
+    return false;
+}
+
+static long fileSize(const wstring& pathname)
+{
+    ifstream f(Util::toString(pathname), std::ios::binary | std::ios::ate);
+    return f ? (long) f.tellg() : 0;
+}
+
+int main(int argc, char** argv)
+{
+    wstring directory = Util::toWstring(argc > 1 ? argv[1] : "data/good");
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+    vector<wstring> files = DirectoryWalker(directory, L"*.csv").list(true);
+    if (files.empty())
+    {
+        printf("ERROR: no CSV files found in %ls\n", directory.c_str());
+        return -1;
+    }
+
+    double totalMB = 0;
+    for (auto& pathname : files)
+        totalMB += fileSize(pathname) / (1024.0 * 1024.0);
+    totalMB *= iterations;
+
+    // both loaders log as they go; keep that cost, but off the console
+    wstring sink;
+    Util::beginCapture(&sink);
+
+    long legacyPixels = 0;
+    auto start = steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        for (auto& pathname : files)
+        {
+            ifstream infile(Util::toString(pathname));
+            vector<double> x, y;
+            legacyLoad(infile, x, y);
+            legacyPixels += (long) x.size();
+            sink.clear();
+        }
+    }
+    double legacySec = duration<double>(steady_clock::now() - start).count();
+
+    long currentPixels = 0;
+    start = steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        for (auto& pathname : files)
+        {
+            Measurement m(pathname);
+            currentPixels += (long) m.x.size();
+            sink.clear();
+        }
+    }
+    double currentSec = duration<double>(steady_clock::now() - start).count();
+
+    Util::endCapture();
+
+    printf("files: %u x %d iterations (%.1lf MB)\n", (unsigned) files.size(), iterations, totalMB);
+    printf("legacy:  %8.2lf MB/s  %9.1lf files/sec  (%ld pixels)\n", totalMB / legacySec,  files.size() * iterations / legacySec,  legacyPixels);
+    printf("current: %8.2lf MB/s  %9.1lf files/sec  (%ld pixels)\n", totalMB / currentSec, files.size() * iterations / currentSec, currentPixels);
+    printf("speedup: %.2lfx\n", legacySec / currentSec);
+
+    return legacyPixels == currentPixels ? 0 : 1;
+}
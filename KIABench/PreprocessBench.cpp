@@ -0,0 +1,182 @@
+/*! @file
+    @brief Per-stage timing of spectral preprocessing, scalar vs AVX2.
+
+    Builds synthetic Raman spectra (Lorentzian bands on a broad fluorescence
+    background, with shot noise and cosmic-ray spikes) of 1024 and 2048
+    pixels (the specialized kernels) and 1000 (the generic ones), and times
+    each Preprocessor stage alone, and the whole chain, with the scalar and
+    AVX2 kernels.  Also checks that both give identical results, and reports
+    how well the chain recovered the clean spectrum.  Then times the whole
+    chain over every CSV under a directory (default data/good).
+
+    Usage: PreprocessBench [directory] [repeats]
+*/
+
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+#include "Measurement.h"
+#include "Preprocessor.h"
+#include "Simd.h"
+#include "Stats.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+struct Synthetic
+{
+    vector<double> x, y;
+    vector<double> clean;   //!< bands alone (no background, noise or spikes)
+};
+
+//! deterministic pseudo-random spectrum of n pixels from 200 to 2000 cm-1
+static Synthetic synthesize(int n, unsigned seed)
+{
+    Synthetic s;
+    srand(seed);
+    auto uniform = []() { return rand() / (double) RAND_MAX; };
+
+    const double bands[][3] = { { 520, 900, 6 }, { 1001, 2500, 4 }, { 1200, 700, 10 }, { 1450, 1200, 8 }, { 1602, 1800, 5 } };
+    for (int i = 0; i < n; i++)
+    {
+        double x = 200 + 1800.0 * i / (n - 1);
+        double clean = 0;
+        for (auto& b : bands)
+            clean += b[1] / (1 + std::pow((x - b[0]) / b[2], 2));
+        double background = 8000 * std::exp(-std::pow((x - 1300) / 900, 2));
+        double noise = 30 * (uniform() - 0.5);
+
+        s.x.push_back(x);
+        s.clean.push_back(clean);
+        s.y.push_back(clean + background + noise);
+    }
+    for (int k = 0; k < 4; k++)
+        s.y[(int) (uniform() * (n - 4)) + 2] += 20000;
+    return s;
+}
+
+//! mean microseconds per spectrum to run settings over spectra
+static double time(const Preprocessor::Settings& settings, const vector<Synthetic>& spectra, int repeats, vector<double>* result = nullptr)
+{
+    Preprocessor pre(settings);
+    Stats stats;
+    SpectrumView out;
+
+    auto start = steady_clock::now();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (const Synthetic& s : spectra)
+        {
+            SpectrumView in;
+            in.x = s.x.data();
+            in.y = s.y.data();
+            in.pixels = (int) s.x.size();
+            pre.process(in, out, stats);
+            if (result && r == 0)
+                result->insert(result->end(), out.y, out.y + out.pixels);
+        }
+    }
+    return duration<double, std::micro>(steady_clock::now() - start).count() / (repeats * spectra.size());
+}
+
+int main(int argc, char** argv)
+{
+    wstring directory = Util::toWstring(argc > 1 ? argv[1] : "data/good");
+    int repeats = std::max(argc > 2 ? atoi(argv[2]) : 20, 1);
+
+    printf("AVX2: %s\n", Simd::haveAvx2() ? "yes" : "no (scalar kernels only)");
+
+    Preprocessor::Settings despike, smooth, baseline, normalize, chain;
+    despike.despike = chain.despike = true;
+    smooth.smooth = chain.smooth = 9;
+    baseline.baseline = chain.baseline = 1e5;
+    normalize.normalize = chain.normalize = true;
+
+    struct Stage { const char* name; Preprocessor::Settings settings; };
+    const Stage stages[] = { { "despike", despike }, { "smooth", smooth }, { "baseline", baseline },
+                             { "normalize", normalize }, { "chain", chain } };
+
+    int status = 0;
+    printf("%-10s %6s %12s %12s %9s\n", "stage", "pixels", "scalar us", "avx2 us", "speedup");
+    for (int pixels : { 1024, 2048, 1000 })
+    {
+        vector<Synthetic> spectra;
+        for (unsigned seed = 1; seed <= 16; seed++)
+            spectra.push_back(synthesize(pixels, seed));
+
+        for (const Stage& stage : stages)
+        {
+            Preprocessor::Settings scalar = stage.settings;
+            scalar.simd = false;
+
+            vector<double> scalarResult, avx2Result;
+            double scalarUS = time(scalar, spectra, repeats, &scalarResult);
+            double avx2US = time(stage.settings, spectra, repeats, &avx2Result);
+            if (scalarResult != avx2Result)
+            {
+                printf("ERROR: %s: scalar and AVX2 results differ at %d pixels\n", stage.name, pixels);
+                status = 1;
+            }
+            printf("%-10s %6d %12.2lf %12.2lf %8.2lfx\n", stage.name, pixels, scalarUS, avx2US, scalarUS / avx2US);
+        }
+
+        // how close the chain came to the clean bands (both scaled to unit maximum)
+        vector<double> result;
+        time(chain, spectra, 1, &result);
+        double error = 0;
+        size_t offset = 0;
+        for (const Synthetic& s : spectra)
+        {
+            double peak = *std::max_element(s.clean.begin(), s.clean.end());
+            for (size_t i = 0; i < s.clean.size(); i++)
+                error += std::pow(result[offset + i] - s.clean[i] / peak, 2);
+            offset += s.clean.size();
+        }
+        printf("%-10s %6d  rms error vs clean bands %.4lf (of unit peak)\n", "recovery", pixels, std::sqrt(error / offset));
+    }
+
+    // whole chain on real spectra
+    wstring sink;
+    Util::beginCapture(&sink);
+    vector<Measurement> measured;
+    for (auto& pathname : DirectoryWalker(directory, L"*.csv").list(true))
+    {
+        Measurement m(pathname);
+        if (m.isValid())
+            measured.push_back(std::move(m));
+    }
+    Util::endCapture();
+
+    if (!measured.empty())
+    {
+        Preprocessor pre(chain);
+        Stats stats;
+        SpectrumView out;
+        vector<double> latencies;
+        for (int r = 0; r < repeats; r++)
+        {
+            for (const Measurement& m : measured)
+            {
+                auto start = steady_clock::now();
+                pre.process(m.view(), out, stats);
+                latencies.push_back(duration<double, std::micro>(steady_clock::now() - start).count());
+            }
+        }
+        std::sort(latencies.begin(), latencies.end());
+        printf("chain over %u spectra in %ls: p50 %.1lf us, p99 %.1lf us, max %.1lf us\n", (unsigned) measured.size(),
+            directory.c_str(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+    }
+    return status;
+}
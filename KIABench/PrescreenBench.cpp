@@ -0,0 +1,220 @@
+/*! @file
+    @brief Hit rate, accuracy and latency of the local pre-screen (--references).
+
+    Splits the CSVs under a directory (default data/good) by replicate:
+    even-numbered files ("Acetone-02.csv") are copied to a scratch directory
+    and loaded as LocalMatcher references, and odd-numbered ones are the
+    queries.  Each query is scored locally, and searched through SearchSDK,
+    once; then for a range of --local-confidence thresholds (at the default
+    --local-margin), reports how many queries the pre-screen would answer,
+    how often its top compound was the query's own (from its file name), and
+    how often it agreed with SearchSDK's top match, with the mean cost per
+    spectrum with and without pre-screening.
+
+    Against MockSearchSDK, searches take MOCK_SEARCHSDK_LATENCY_MS=5 (unless
+    already set), and matches follow the strongest peak
+    (MOCK_SEARCHSDK_MATCH_PEAK=1), so agreement with the mock measures
+    nothing chemical; accuracy against the labels is the meaningful figure.
+    Against KnowItAll, both are.
+
+    Usage: PrescreenBench path/to/SearchSDK [directory] [margin]
+*/
+
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+#include "LocalMatcher.h"
+#include "Measurement.h"
+#include "SearchLibrary.h"
+#include "SearchSession.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwctype>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! "data/good/Acetone-03.csv" -> ("Acetone", 3); replicate is 0 if unnumbered
+static wstring compoundOf(const wstring& pathname, int& replicate)
+{
+    size_t slash = pathname.find_last_of(L"/\\");
+    wstring name = pathname.substr(slash == wstring::npos ? 0 : slash + 1);
+    name.erase(std::min(name.rfind(L'.'), name.size()));
+
+    size_t dash = name.rfind(L'-');
+    replicate = 0;
+    if (dash != wstring::npos && dash + 1 < name.size() && iswdigit(name[dash + 1]))
+    {
+        replicate = (int) wcstol(name.c_str() + dash + 1, nullptr, 10);
+        name.erase(dash);
+    }
+    return name;
+}
+
+struct Query
+{
+    Measurement m;
+    wstring compound;
+    LocalMatcher::Hit hits[2];
+    int hitCount = 0;
+    double localUS = 0;
+    double searchMS = 0;
+    wstring searched;       //!< SearchSDK's top match
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: PrescreenBench path/to/SearchSDK [directory] [margin]\n");
+        return -1;
+    }
+
+#ifndef _WIN32
+    setenv("MOCK_SEARCHSDK_LATENCY_MS", "5", 0);
+    setenv("MOCK_SEARCHSDK_MATCH_PEAK", "1", 0);
+#endif
+
+    wstring directory = Util::toWstring(argc > 2 ? argv[2] : "data/good");
+    double margin = argc > 3 ? atof(argv[3]) : 0.05;
+
+    // keep the cost of formatting log lines, but not of displaying them
+#ifdef _WIN32
+    FILE* devnull = fopen("NUL", "w");
+    string scratch = string(getenv("TEMP") ? getenv("TEMP") : ".") + "\\PrescreenBench";
+    _mkdir(scratch.c_str());
+#else
+    FILE* devnull = fopen("/dev/null", "w");
+    string scratch = "/tmp/PrescreenBench-" + std::to_string(getpid());
+    mkdir(scratch.c_str(), 0755);
+#endif
+
+    // split replicates into references and queries
+    vector<Query> queries;
+    vector<string> copied;
+    for (auto& pathname : DirectoryWalker(directory, L"*.csv").list(true))
+    {
+        int replicate;
+        wstring compound = compoundOf(pathname, replicate);
+        if (replicate % 2 == 0)
+        {
+            string contents;
+            if (!Util::readFile(pathname, contents))
+                continue;
+            size_t slash = pathname.find_last_of(L"/\\");
+            copied.push_back(scratch + "/" + Util::toString(pathname.substr(slash + 1)));
+            std::ofstream(copied.back(), std::ios::binary) << contents;
+            continue;
+        }
+
+        Util::setLogFile(devnull);
+        Query q { Measurement(pathname), compound };
+        Util::setLogFile(stdout);
+        if (q.m.isValid())
+            queries.push_back(std::move(q));
+    }
+
+    bool loaded = LocalMatcher::load(Util::toWstring(scratch.c_str()));
+    for (const string& pathname : copied)
+        remove(pathname.c_str());
+#ifdef _WIN32
+    _rmdir(scratch.c_str());
+#else
+    rmdir(scratch.c_str());
+#endif
+    if (!loaded || queries.empty())
+    {
+        printf("ERROR: need both even- and odd-numbered replicates in %ls\n", directory.c_str());
+        return -1;
+    }
+
+    SearchLibrary library;
+    if (!library.load(Util::toWstring(argv[1])))
+    {
+        printf("ERROR: unable to load %s\n", argv[1]);
+        return -1;
+    }
+    library.initFn();
+
+    // score and search every query once; thresholds are then applied offline
+    Util::setLogFile(devnull);
+    SearchSession session(library);
+    vector<double> localLatencies;
+    for (Query& q : queries)
+    {
+        auto start = steady_clock::now();
+        q.hitCount = LocalMatcher::match(q.m.view(), q.hits, 2);
+        q.localUS = duration<double, std::micro>(steady_clock::now() - start).count();
+        localLatencies.push_back(q.localUS);
+
+        start = steady_clock::now();
+        session.search(q.m);
+        q.searchMS = duration<double, std::milli>(steady_clock::now() - start).count();
+        if (session.matchCount() > 0)
+            q.searched = session.matches()[0].m_matchName;
+    }
+    session.close();
+    library.exitFn();
+    Util::setLogFile(stdout);
+
+    double searchMS = 0;
+    for (const Query& q : queries)
+        searchMS += q.searchMS;
+    searchMS /= queries.size();
+    std::sort(localLatencies.begin(), localLatencies.end());
+
+    printf("%d references of %d compounds, %u queries\n", LocalMatcher::referenceCount(),
+        LocalMatcher::compoundCount(), (unsigned) queries.size());
+    printf("local match: p50 %.1lf us, p99 %.1lf us, max %.1lf us; search: mean %.3lf ms\n",
+        localLatencies[localLatencies.size() / 2], localLatencies[localLatencies.size() * 99 / 100],
+        localLatencies.back(), searchMS);
+    printf("margin %.2lf\n", margin);
+    printf("%10s %9s %9s %9s %12s %12s\n", "confidence", "hit rate", "correct", "agree", "ms/spectrum", "baseline ms");
+
+    for (double confidence : { 0.5, 0.7, 0.8, 0.9, 0.95, 0.98, 0.99 })
+    {
+        int hits = 0, correct = 0, agreed = 0;
+        double totalMS = 0;
+        for (const Query& q : queries)
+        {
+            totalMS += q.localUS / 1000;
+            bool hit = q.hitCount > 0 && q.hits[0].score >= confidence
+                && (q.hitCount < 2 || q.hits[0].score - q.hits[1].score >= margin);
+            if (!hit)
+            {
+                totalMS += q.searchMS;
+                continue;
+            }
+            hits++;
+            if (q.compound == LocalMatcher::name(q.hits[0].compound))
+                correct++;
+            if (LocalMatcher::sameName(q.searched.c_str(), LocalMatcher::name(q.hits[0].compound)))
+                agreed++;
+        }
+
+        printf("%10.2lf %8.1lf%% %8.1lf%% %8.1lf%% %12.3lf %12.3lf\n", confidence,
+            100.0 * hits / queries.size(), hits ? 100.0 * correct / hits : 0.0, hits ? 100.0 * agreed / hits : 0.0,
+            totalMS / queries.size(), searchMS);
+    }
+
+    if (devnull)
+        fclose(devnull);
+    return 0;
+}
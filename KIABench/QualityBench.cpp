@@ -0,0 +1,178 @@
+/*! @file
+    @brief Cost and verdicts of the quality gate (--quality-gate), scalar vs AVX2.
+
+    Checks every CSV under the given directories (default data/good and
+    data/broke), plus synthetic spectra of 1024 pixels that should each fail
+    one way (a dark frame, a saturated one, a flat line, one with a NaN, and
+    one with its wavenumbers shuffled) and a clean one that should pass.
+    Times the scalar and AVX2 passes over the lot, checks both give
+    identical reports, and tallies the reasons spectra were rejected, listing
+    the rejected files.
+
+    Usage: QualityBench [directory...]
+*/
+
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+#include "Measurement.h"
+#include "QualityGate.h"
+#include "Simd.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+struct Spectrum
+{
+    wstring name;
+    vector<double> x, y;
+
+    SpectrumView view() const
+    {
+        SpectrumView v;
+        v.x = x.data();
+        v.y = y.data();
+        v.pixels = (int) x.size();
+        return v;
+    }
+};
+
+//! deterministic pseudo-random spectrum: a few bands on a fluorescence
+//! background, with shot noise, scaled to peak at height counts
+static Spectrum synthesize(const wchar_t* name, double height, unsigned seed)
+{
+    Spectrum s { name };
+    srand(seed);
+    const int n = 1024;
+    const double bands[][3] = { { 520, 0.4, 6 }, { 1001, 1.0, 4 }, { 1450, 0.5, 8 } };
+    for (int i = 0; i < n; i++)
+    {
+        double x = 200 + 1800.0 * i / (n - 1);
+        double y = 0.3 * std::exp(-std::pow((x - 1300) / 900, 2));
+        for (auto& b : bands)
+            y += b[1] / (1 + std::pow((x - b[0]) / b[2], 2));
+        s.x.push_back(x);
+        s.y.push_back(1000 + height * y + 0.01 * height * (rand() / (double) RAND_MAX - 0.5));
+    }
+    return s;
+}
+
+static vector<Spectrum> synthetics()
+{
+    vector<Spectrum> spectra;
+    spectra.push_back(synthesize(L"synthetic clean", 20000, 1));
+    spectra.push_back(synthesize(L"synthetic dark", 100, 2));
+
+    Spectrum saturated = synthesize(L"synthetic saturated", 200000, 3);
+    for (double& y : saturated.y)
+        y = std::min(y, 65535.0);
+    spectra.push_back(saturated);
+
+    Spectrum flat = synthesize(L"synthetic flat", 0, 4);
+    spectra.push_back(flat);
+
+    Spectrum nan = synthesize(L"synthetic NaN", 20000, 5);
+    nan.y[500] = std::numeric_limits<double>::quiet_NaN();
+    spectra.push_back(nan);
+
+    Spectrum shuffled = synthesize(L"synthetic shuffled axis", 20000, 6);
+    for (size_t i = 0; i + 1 < shuffled.x.size(); i += 37)
+        std::swap(shuffled.x[i], shuffled.x[i + 1]);
+    spectra.push_back(shuffled);
+    return spectra;
+}
+
+//! mean microseconds per spectrum to check all spectra
+static double time(const QualityGate& gate, const vector<Spectrum>& spectra, int repeats, vector<QualityGate::Report>& reports)
+{
+    reports.resize(spectra.size());
+    auto start = steady_clock::now();
+    for (int r = 0; r < repeats; r++)
+        for (size_t i = 0; i < spectra.size(); i++)
+            gate.check(spectra[i].view(), reports[i]);
+    return duration<double, std::micro>(steady_clock::now() - start).count() / (repeats * spectra.size());
+}
+
+//! bitwise, so NaN matches NaN
+static bool same(const QualityGate::Report& a, const QualityGate::Report& b)
+{
+    return a.reason == b.reason && a.nonFinite == b.nonFinite && a.axisReversals == b.axisReversals
+        && !memcmp(&a.range, &b.range, sizeof(double)) && !memcmp(&a.saturated, &b.saturated, sizeof(double))
+        && !memcmp(&a.snr, &b.snr, sizeof(double));
+}
+
+int main(int argc, char** argv)
+{
+    vector<wstring> directories;
+    for (int i = 1; i < argc; i++)
+        directories.push_back(Util::toWstring(argv[i]));
+    if (directories.empty())
+        directories = { L"data/good", L"data/broke" };
+
+    printf("AVX2: %s\n", Simd::haveAvx2() ? "yes" : "no (scalar pass only)");
+
+    vector<Spectrum> spectra = synthetics();
+    wstring sink;
+    Util::beginCapture(&sink);
+    for (const wstring& directory : directories)
+    {
+        for (auto& pathname : DirectoryWalker(directory, L"*.csv").list(true))
+        {
+            Measurement m(pathname);
+            if (!m.isValid())
+                continue;
+            SpectrumView v = m.view();
+            spectra.push_back(Spectrum { pathname, vector<double>(v.x, v.x + v.pixels), vector<double>(v.y, v.y + v.pixels) });
+        }
+    }
+    Util::endCapture();
+
+    QualityGate::Settings settings;
+    settings.enabled = true;
+    QualityGate::Settings scalarSettings = settings;
+    scalarSettings.simd = false;
+    QualityGate avx2(settings), scalar(scalarSettings);
+
+    const int repeats = 200;
+    vector<QualityGate::Report> scalarReports, avx2Reports;
+    double scalarUS = time(scalar, spectra, repeats, scalarReports);
+    double avx2US = time(avx2, spectra, repeats, avx2Reports);
+    printf("%u spectra: scalar %.2lf us, avx2 %.2lf us per spectrum (%.2lfx)\n",
+        (unsigned) spectra.size(), scalarUS, avx2US, scalarUS / avx2US);
+
+    int status = 0;
+    long rejected[QualityGate::REASON_COUNT] = {};
+    for (size_t i = 0; i < spectra.size(); i++)
+    {
+        const QualityGate::Report& q = avx2Reports[i];
+        if (!same(q, scalarReports[i]))
+        {
+            printf("ERROR: %ls: scalar and AVX2 reports differ\n", spectra[i].name.c_str());
+            status = 1;
+        }
+        rejected[q.reason]++;
+        if (q.reason != QualityGate::PASS || spectra[i].name.compare(0, 9, L"synthetic") == 0)
+            printf("  %-40ls %-14ls range %10.1lf  snr %8.1lf  saturated %.4lf  non-finite %d  reversals %d\n",
+                spectra[i].name.c_str(), QualityGate::name(q.reason), q.range, q.snr, q.saturated, q.nonFinite, q.axisReversals);
+    }
+
+    printf("reasons:");
+    for (int i = 0; i < QualityGate::REASON_COUNT; i++)
+        printf(" %ls %ld", QualityGate::name((QualityGate::Reason) i), rejected[i]);
+    printf("\n");
+    return status;
+}
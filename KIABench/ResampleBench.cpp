@@ -0,0 +1,233 @@
+/*! @file
+    @brief Search latency and top-match agreement of resampled spectra.
+
+    Searches every CSV under a directory (default data/good) as measured,
+    through RunSearchUnevenlySpaced, then resampled onto uniform grids of
+    several spacings (see Resampler), through RunSearchEvenlySpaced.  For
+    each grid, reports the points searched, the time to resample, search
+    latency (mean and p95), and how often the top match agreed with the
+    unresampled search, to help pick an operating point for --resample.
+    Resampling is timed with the scalar and AVX2 kernels, which must give
+    identical spectra.
+
+    Against MockSearchSDK, latency grows with the points searched, and
+    matches follow the strongest peak (MOCK_SEARCHSDK_PIXEL_US=2 and
+    MOCK_SEARCHSDK_MATCH_PEAK=1, unless already set), so the trade-off
+    has the right shape, if not real numbers.
+
+    Usage: ResampleBench path/to/SearchSDK [directory] [repeats]
+*/
+
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+#include "Measurement.h"
+#include "Resampler.h"
+#include "SearchLibrary.h"
+#include "SearchSession.h"
+#include "Simd.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+struct Run
+{
+    string name;
+    Resampler::Settings settings;
+};
+
+//! seconds to resample every spectrum repeats times
+static double time(const Resampler::Settings& settings, const vector<Measurement>& spectra, int repeats, long& points)
+{
+    Resampler resampler(settings);
+    SpectrumView out;
+    points = 0;
+    auto start = steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        for (const Measurement& m : spectra)
+            if (resampler.resample(m.view(), out))
+                points += out.pixels;
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+//! true if the scalar and AVX2 kernels resample every spectrum bitwise identically
+static bool same(Resampler::Settings settings, const vector<Measurement>& spectra)
+{
+    settings.simd = true;
+    Resampler avx2(settings);
+    settings.simd = false;
+    Resampler scalar(settings);
+    for (const Measurement& m : spectra)
+    {
+        SpectrumView a, b;
+        bool okA = avx2.resample(m.view(), a);
+        bool okB = scalar.resample(m.view(), b);
+        if (okA != okB || (okA && (a.pixels != b.pixels
+                || memcmp(a.x, b.x, a.pixels * sizeof(double)) || memcmp(a.y, b.y, a.pixels * sizeof(double)))))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: ResampleBench path/to/SearchSDK [directory] [repeats]\n");
+        return -1;
+    }
+
+#ifndef _WIN32
+    setenv("MOCK_SEARCHSDK_PIXEL_US", "2", 0);
+    setenv("MOCK_SEARCHSDK_MATCH_PEAK", "1", 0);
+#endif
+
+    wstring directory = Util::toWstring(argc > 2 ? argv[2] : "data/good");
+    int repeats = std::max(argc > 3 ? atoi(argv[3]) : 3, 1);
+
+    // keep the cost of formatting log lines, but not of displaying them
+#ifdef _WIN32
+    FILE* devnull = fopen("NUL", "w");
+#else
+    FILE* devnull = fopen("/dev/null", "w");
+#endif
+    if (devnull)
+        Util::setLogFile(devnull);
+
+    vector<Measurement> spectra;
+    for (auto& pathname : DirectoryWalker(directory, L"*.csv").list(true))
+    {
+        Measurement m(pathname);
+        if (m.isValid())
+            spectra.push_back(std::move(m));
+    }
+    if (spectra.empty())
+    {
+        printf("ERROR: no CSV files found in %ls\n", directory.c_str());
+        return -1;
+    }
+
+    SearchLibrary library;
+    if (!library.load(Util::toWstring(argv[1])))
+    {
+        printf("ERROR: unable to load %s\n", argv[1]);
+        return -1;
+    }
+    library.initFn();
+
+    vector<Run> runs;
+    runs.push_back({ "as measured", Resampler::Settings() });
+    for (double spacing : { 1.0, 2.0, 4.0, 8.0 })
+    {
+        for (Resampler::Method method : { Resampler::LINEAR, Resampler::CUBIC })
+        {
+            Run run;
+            run.settings.spacing = spacing;
+            run.settings.method = method;
+            run.name = Util::sstring("%s %g cm-1", method == Resampler::CUBIC ? "cubic" : "linear", spacing);
+            runs.push_back(run);
+        }
+    }
+    {
+        Run run;
+        run.settings.spacing = 4;
+        run.settings.bin = 2;
+        run.name = "bin 2, linear 4 cm-1";
+        runs.push_back(run);
+    }
+    {
+        Run run;
+        run.settings.spacing = 2;
+        run.settings.roiFirst = 400;
+        run.settings.roiLast = 1800;
+        run.name = "400-1800, linear 2";
+        runs.push_back(run);
+    }
+
+    printf("%u spectra x %d repeats; AVX2: %s\n", (unsigned) spectra.size(), repeats, Simd::haveAvx2() ? "yes" : "no (scalar only)");
+    printf("%-22s %7s %10s %10s %10s %10s %9s\n", "grid", "points", "scalar us", "avx2 us", "mean ms", "p95 ms", "agree");
+
+    int status = 0;
+    vector<wstring> baseline;
+    for (const Run& run : runs)
+    {
+        SearchSession session(library);
+        session.resample(run.settings);
+
+        // time resampling alone, on Resamplers of our own
+        double scalarSec = 0;
+        double avx2Sec = 0;
+        long points = 0;
+        if (run.settings.enabled())
+        {
+            Resampler::Settings settings = run.settings;
+            settings.simd = false;
+            scalarSec = time(settings, spectra, repeats, points);
+            settings.simd = true;
+            avx2Sec = time(settings, spectra, repeats, points);
+            if (!same(run.settings, spectra))
+            {
+                printf("ERROR: %s: scalar and AVX2 kernels resample differently\n", run.name.c_str());
+                status = 1;
+            }
+        }
+        else
+        {
+            for (const Measurement& m : spectra)
+                points += m.pixels;
+            points *= repeats;
+        }
+
+        vector<double> latencies;
+        vector<wstring> tops;
+        for (int i = 0; i < repeats; i++)
+        {
+            for (const Measurement& m : spectra)
+            {
+                auto start = steady_clock::now();
+                session.search(m);
+                latencies.push_back(duration<double, std::milli>(steady_clock::now() - start).count());
+                if (i == 0)
+                    tops.push_back(session.matchCount() > 0 ? session.matches()[0].m_matchName : L"");
+            }
+        }
+        session.close();
+
+        if (baseline.empty())
+            baseline = tops;
+        size_t agreed = 0;
+        for (size_t i = 0; i < tops.size(); i++)
+            if (!tops[i].empty() && tops[i] == baseline[i])
+                agreed++;
+
+        double mean = 0;
+        for (double ms : latencies)
+            mean += ms;
+        mean /= latencies.size();
+        std::sort(latencies.begin(), latencies.end());
+        double p95 = latencies[std::min(latencies.size() - 1, (size_t)(0.95 * latencies.size()))];
+
+        const double searches = (double) spectra.size() * repeats;
+        printf("%-22s %7.0lf %10.2lf %10.2lf %10.3lf %10.3lf %8.1lf%%\n", run.name.c_str(), points / searches,
+            scalarSec * 1e6 / searches, avx2Sec * 1e6 / searches, mean, p95, 100.0 * agreed / tops.size());
+    }
+
+    library.exitFn();
+    Util::setLogFile(stdout);
+    if (devnull)
+        fclose(devnull);
+    return status;
+}
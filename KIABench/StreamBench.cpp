@@ -0,0 +1,303 @@
+/*! @file
+    @brief Requests/sec of --streaming over the text and binary protocols,
+           and of --shm.
+
+    Launches KIAConsole as a child process (POSIX only) against the given
+    search library, then sends the same spectrum repeatedly, one request at a
+    time as ENLIGHTEN does, timing the round trips for each protocol.  The
+    client-side formatting / parsing is included, as ENLIGHTEN pays it too
+    (for --shm, copying the spectrum into its ring slot).
+    The text protocol is then timed again with window numbered requests kept
+    in flight (--max-in-flight).
+
+    Usage: StreamBench path/to/KIAConsole path/to/libMockSearchSDK.so [requests] [spectrum.csv] [window]
+
+    (set MOCK_SEARCHSDK_LATENCY_MS to see what pipelining buys over slow searches)
+*/
+
+#include "pch.h"
+
+#include "BinaryProtocol.h"
+#include "Measurement.h"
+#include "SharedRing.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+using std::wstring;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! a running KIAConsole with pipes to its stdin and stdout
+struct Child
+{
+    pid_t pid = -1;
+    FILE* in = nullptr;     //!< child's stdin
+    FILE* out = nullptr;    //!< child's stdout
+
+    bool start(const char* exe, const char* library, bool binary, int maxInFlight = 0, const char* shm = nullptr)
+    {
+        int toChild[2], fromChild[2];
+        if (pipe(toChild) || pipe(fromChild))
+            return false;
+
+        pid = fork();
+        if (pid == 0)
+        {
+            dup2(toChild[0], 0);
+            dup2(fromChild[1], 1);
+            close(toChild[1]);
+            close(fromChild[0]);
+            string window = std::to_string(maxInFlight);
+            if (shm)
+                execl(exe, exe, "--library", library, "--shm", shm, (char*) nullptr);
+            else if (binary)
+                execl(exe, exe, "--library", library, "--binary", (char*) nullptr);
+            else if (maxInFlight)
+                execl(exe, exe, "--library", library, "--streaming", "--max-in-flight", window.c_str(), (char*) nullptr);
+            else
+                execl(exe, exe, "--library", library, "--streaming", (char*) nullptr);
+            _exit(127);
+        }
+
+        close(toChild[0]);
+        close(fromChild[1]);
+        in = fdopen(toChild[1], "w");
+        out = fdopen(fromChild[0], "r");
+        return pid > 0 && in && out;
+    }
+
+    void stop()
+    {
+        fclose(in);
+        fclose(out);
+        waitpid(pid, nullptr, 0);
+    }
+};
+
+//! format and send one text request (numbered, if id >= 0)
+static void sendText(Child& child, const Measurement& m, int id)
+{
+    static string request;
+    request.clear();
+    request += id < 0 ? string("REQUEST_START\n") : Util::sstring("REQUEST_START, %d\n", id);
+    request += Util::sstring("PIXELS, %d\nMAX_RESULTS, %d\nMIN_CONFIDENCE, %lf\n", m.pixels, m.max_results, m.min_confidence);
+    for (int i = 0; i < m.pixels; i++)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6lf, %.6lf\n", m.x[i], m.y[i]);
+        request += buf;
+    }
+    request += "REQUEST_END\n";
+    fwrite(request.data(), 1, request.size(), child.in);
+    fflush(child.in);
+}
+
+static double runText(const char* exe, const char* library, const Measurement& m, int requests)
+{
+    Child child;
+    if (!child.start(exe, library, false))
+        return 0;
+
+    char line[4096];
+    int matches = 0;
+
+    auto start = steady_clock::now();
+    for (int r = 0; r < requests; r++)
+    {
+        sendText(child, m, -1);
+
+        // parse responses as KIAWrapper does, until the request completes
+        while (fgets(line, sizeof(line), child.out))
+        {
+            if (strstr(line, "Match "))
+                matches++;
+            if (strstr(line, "Processing complete"))
+                break;
+        }
+    }
+    double sec = duration<double>(steady_clock::now() - start).count();
+
+    fputs("QUIT\n", child.in);
+    child.stop();
+    printf("text:   %d requests in %.3lf sec = %9.1lf requests/sec (%d matches)\n", requests, sec, requests / sec, matches);
+    return requests / sec;
+}
+
+//! text protocol, keeping window numbered requests in flight
+static double runTextPipelined(const char* exe, const char* library, const Measurement& m, int requests, int window)
+{
+    Child child;
+    if (!child.start(exe, library, false, window))
+        return 0;
+
+    char line[4096];
+    int matches = 0;
+    int sent = 0;
+    int done = 0;
+
+    auto start = steady_clock::now();
+    for (; sent < window && sent < requests; sent++)
+        sendText(child, m, sent);
+
+    // send another request as each one completes
+    while (done < requests && fgets(line, sizeof(line), child.out))
+    {
+        if (strstr(line, "Match "))
+            matches++;
+        if (strstr(line, "RESULT_END"))
+        {
+            done++;
+            if (sent < requests)
+                sendText(child, m, sent++);
+        }
+    }
+    double sec = duration<double>(steady_clock::now() - start).count();
+
+    fputs("QUIT\n", child.in);
+    child.stop();
+    printf("text x%d: %d requests in %.3lf sec = %9.1lf requests/sec (%d matches)\n", window, requests, sec, requests / sec, matches);
+    return requests / sec;
+}
+
+static double runBinary(const char* exe, const char* library, const Measurement& m, int requests)
+{
+    Child child;
+    if (!child.start(exe, library, true))
+        return 0;
+
+    vector<char> payload;
+    vector<char> response;
+    int matches = 0;
+
+    auto start = steady_clock::now();
+    for (int r = 0; r < requests; r++)
+    {
+        BinaryRequestHeader header = {};
+        header.magic = BinaryProtocol::REQUEST_MAGIC;
+        header.length = (uint32_t) (2 * m.pixels * sizeof(double));
+        header.requestId = (uint32_t) r;
+        header.pixels = (uint32_t) m.pixels;
+        header.maxResults = m.max_results;
+        header.minConfidence = m.min_confidence;
+
+        fwrite(&header, sizeof(header), 1, child.in);
+        fwrite(&m.x[0], sizeof(double), m.pixels, child.in);
+        fwrite(&m.y[0], sizeof(double), m.pixels, child.in);
+        fflush(child.in);
+
+        BinaryResultHeader result;
+        if (fread(&result, sizeof(result), 1, child.out) != 1 || result.requestId != (uint32_t) r)
+        {
+            printf("ERROR: bad binary response to request %d\n", r);
+            break;
+        }
+        response.resize(result.length);
+        if (result.length && fread(&response[0], 1, result.length, child.out) != result.length)
+            break;
+        matches += result.matchCount;
+    }
+    double sec = duration<double>(steady_clock::now() - start).count();
+
+    BinaryRequestHeader quit = {};
+    quit.magic = BinaryProtocol::REQUEST_MAGIC;
+    fwrite(&quit, sizeof(quit), 1, child.in);
+    child.stop();
+    printf("binary: %d requests in %.3lf sec = %9.1lf requests/sec (%d matches)\n", requests, sec, requests / sec, matches);
+    return requests / sec;
+}
+
+//! spectra and results through a SharedRing; only notification bytes cross the pipes
+static double runShm(const char* exe, const char* library, const Measurement& m, int requests)
+{
+    string name = Util::sstring("/StreamBench-%d", (int) getpid());
+    SharedRing ring;
+    if (!ring.create(Util::toWstring(name.c_str()), 4, (uint32_t) m.pixels))
+        return 0;
+
+    Child child;
+    if (!child.start(exe, library, true, 0, name.c_str()))
+        return 0;
+
+    int matches = 0;
+
+    auto start = steady_clock::now();
+    for (int r = 0; r < requests; r++)
+    {
+        SharedRequestSlot* slot = ring.beginRequest();
+        slot->requestId = (uint32_t) r;
+        slot->pixels = (uint32_t) m.pixels;
+        slot->maxResults = m.max_results;
+        slot->timeoutMS = 0;
+        slot->minConfidence = m.min_confidence;
+        memcpy(ring.x(slot), &m.x[0], m.pixels * sizeof(double));
+        memcpy(ring.y(slot), &m.y[0], m.pixels * sizeof(double));
+        ring.publishRequest();
+        fputc(SharedRing::NOTIFY_REQUEST, child.in);
+        fflush(child.in);
+
+        const BinaryResultHeader* result = nullptr;
+        if (fgetc(child.out) != SharedRing::NOTIFY_RESULT || !(result = ring.nextResult()) || result->requestId != (uint32_t) r)
+        {
+            printf("ERROR: bad shm response to request %d\n", r);
+            break;
+        }
+        matches += result->matchCount;
+        ring.releaseResult();
+    }
+    double sec = duration<double>(steady_clock::now() - start).count();
+
+    fputc(SharedRing::NOTIFY_QUIT, child.in);
+    child.stop();
+    printf("shm:    %d requests in %.3lf sec = %9.1lf requests/sec (%d matches)\n", requests, sec, requests / sec, matches);
+    return requests / sec;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: StreamBench path/to/KIAConsole path/to/libMockSearchSDK.so [requests] [spectrum.csv] [window]\n");
+        return -1;
+    }
+
+    const char* exe = argv[1];
+    const char* library = argv[2];
+    int requests = argc > 3 ? atoi(argv[3]) : 1000;
+    const char* csv = argc > 4 ? argv[4] : "data/good/Acetone-01.csv";
+    int window = argc > 5 ? atoi(argv[5]) : 4;
+
+    // keep KIAConsole's per-request logging off our console
+    wstring sink;
+    Util::beginCapture(&sink);
+    Measurement m(Util::toWstring(csv));
+    Util::endCapture();
+    if (!m.isValid())
+    {
+        printf("ERROR: could not load %s\n", csv);
+        return -1;
+    }
+
+    printf("%d requests of %d pixels\n", requests, m.pixels);
+    double text = runText(exe, library, m, requests);
+    double binary = runBinary(exe, library, m, requests);
+    double shm = runShm(exe, library, m, requests);
+    double pipelined = window > 0 ? runTextPipelined(exe, library, m, requests, window) : 0;
+    if (text > 0)
+        printf("binary/text: %.2lfx\n", binary / text);
+    if (binary > 0 && shm > 0)
+        printf("shm/binary: %.2lfx\n", shm / binary);
+    if (text > 0 && pipelined > 0)
+        printf("pipelined/text: %.2lfx\n", pipelined / text);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*! @file
+    @brief Micro-benchmark of directory traversal.
+
+    Finds every CSV under a directory tree, through both the original
+    single-threaded FileFinder (reproduced below as legacyFind) and the
+    DirectoryWalker, streaming and sorted, on 1 to 8 threads, and reports
+    the time until the first file was available and the total time for each.
+
+    Without a directory, builds a synthetic tree (fanout^depth directories,
+    each holding files-per-dir empty CSV files and a few others) under /tmp,
+    and removes it afterwards.  Either way the tree is walked once before
+    timing, so all runs see a warm cache.
+
+    Usage: WalkBench [directory] [iterations]
+           WalkBench --synthetic [fanout] [depth] [files-per-dir] [iterations]
+*/
+
+#include "pch.h"
+
+#include "BoundedQueue.h"
+#include "DirectoryWalker.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <stack>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! FileFinder (POSIX version) as of KIAConsole 0.5.1: collects every match,
+//! stat'ing each entry, then sorts the list
+static std::list<wstring> legacyFind(wstring path, const wstring& mask)
+{
+    std::list<wstring> files;
+#ifndef _WIN32
+    const string pattern = Util::toString(mask);
+    std::stack<wstring> directories;
+    directories.push(path);
+
+    while (!directories.empty())
+    {
+        path = directories.top();
+        directories.pop();
+
+        DIR* dir = opendir(Util::toString(path).c_str());
+        if (!dir)
+            break;
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 ||
+                strcmp(entry->d_name, "..") == 0)
+                continue;
+
+            wstring child = path + L"/" + Util::toWstring(entry->d_name);
+
+            struct stat st;
+            if (stat(Util::toString(child).c_str(), &st) != 0)
+                continue;
+
+            if (S_ISDIR(st.st_mode))
+                directories.push(child);
+            else if (fnmatch(pattern.c_str(), entry->d_name, FNM_CASEFOLD) == 0)
+                files.push_back(child);
+        }
+        closedir(dir);
+    }
+#endif
+    files.sort();
+    return files;
+}
+
+//! fanout subdirectories per level, filesPerDir CSVs (and a couple of others) in each
+static size_t buildTree(const string& path, int fanout, int depth, int filesPerDir)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    mkdir(path.c_str(), 0755);
+    size_t count = 0;
+    for (int i = 0; i < filesPerDir; i++)
+    {
+        std::ofstream(path + "/spectrum-" + std::to_string(i) + ".csv");
+        count++;
+    }
+    std::ofstream(path + "/notes.txt");
+    std::ofstream(path + "/settings.json");
+    if (depth > 0)
+        for (int i = 0; i < fanout; i++)
+            count += buildTree(path + "/d" + std::to_string(i), fanout, depth - 1, filesPerDir);
+    return count;
+#endif
+}
+
+struct Timing
+{
+    double firstSec = 0;
+    double totalSec = 0;
+    size_t files = 0;
+};
+
+static void print(const char* name, const vector<Timing>& runs)
+{
+    // best of n, for each measure independently
+    Timing best = runs[0];
+    for (const Timing& t : runs)
+    {
+        best.firstSec = std::min(best.firstSec, t.firstSec);
+        best.totalSec = std::min(best.totalSec, t.totalSec);
+    }
+    printf("%-20s first %9.2lf ms  total %9.2lf ms  %9.0lf files/sec  (%u files)\n",
+        name, best.firstSec * 1000, best.totalSec * 1000, best.files / best.totalSec, (unsigned) best.files);
+}
+
+int main(int argc, char** argv)
+{
+    bool synthetic = argc < 2 || strcmp(argv[1], "--synthetic") == 0;
+    int fanout = 6, depth = 3, filesPerDir = 150, iterations = 5;
+    string root;
+    if (synthetic)
+    {
+        if (argc > 2) fanout = atoi(argv[2]);
+        if (argc > 3) depth = atoi(argv[3]);
+        if (argc > 4) filesPerDir = atoi(argv[4]);
+        if (argc > 5) iterations = atoi(argv[5]);
+        root = "/tmp/walkbench-" + std::to_string((long) getpid());
+
+        auto start = steady_clock::now();
+        size_t made = buildTree(root, fanout, depth, filesPerDir);
+        printf("built %s: %u CSV files in %.1lf sec\n", root.c_str(), (unsigned) made,
+            duration<double>(steady_clock::now() - start).count());
+    }
+    else
+    {
+        root = argv[1];
+        if (argc > 2) iterations = atoi(argv[2]);
+    }
+    iterations = std::max(iterations, 1);
+
+    const wstring directory = Util::toWstring(root.c_str());
+    const size_t expected = DirectoryWalker(directory, L"*.csv").list(false).size();
+    if (expected == 0)
+    {
+        printf("ERROR: no CSV files found in %ls\n", directory.c_str());
+        return -1;
+    }
+
+    int status = 0;
+    auto check = [&](const Timing& t)
+    {
+        if (t.files != expected)
+            status = 1;
+    };
+
+    // legacy: nothing can be searched until the whole list is sorted
+    vector<Timing> runs;
+    for (int i = 0; i < iterations; i++)
+    {
+        auto start = steady_clock::now();
+        Timing t;
+        t.files = legacyFind(directory, L"*.csv").size();
+        t.firstSec = t.totalSec = duration<double>(steady_clock::now() - start).count();
+        check(t);
+        runs.push_back(t);
+    }
+    print("legacy", runs);
+
+    for (int threads : { 1, 2, 4, 8 })
+    {
+        runs.clear();
+        for (int i = 0; i < iterations; i++)
+        {
+            auto start = steady_clock::now();
+            Timing t;
+            t.files = DirectoryWalker(directory, L"*.csv", threads).list(true).size();
+            t.firstSec = t.totalSec = duration<double>(steady_clock::now() - start).count();
+            check(t);
+            runs.push_back(t);
+        }
+        string name = "sorted/" + std::to_string(threads);
+        print(name.c_str(), runs);
+    }
+
+    for (int threads : { 1, 2, 4, 8 })
+    {
+        runs.clear();
+        for (int i = 0; i < iterations; i++)
+        {
+            // as processDirectory consumes it
+            BoundedQueue<wstring> paths(4096);
+            DirectoryWalker walker(directory, L"*.csv", threads);
+            auto start = steady_clock::now();
+            walker.start(paths);
+
+            Timing t;
+            wstring pathname;
+            while (paths.pop(pathname))
+                if (t.files++ == 0)
+                    t.firstSec = duration<double>(steady_clock::now() - start).count();
+            t.totalSec = duration<double>(steady_clock::now() - start).count();
+            walker.join();
+            check(t);
+            runs.push_back(t);
+        }
+        string name = "streaming/" + std::to_string(threads);
+        print(name.c_str(), runs);
+    }
+
+    if (synthetic)
+    {
+        string command = "rm -rf " + root;
+        if (system(command.c_str()) != 0)
+            printf("ERROR: unable to remove %s\n", root.c_str());
+    }
+
+    if (status)
+        printf("ERROR: some runs found other than %u files\n", (unsigned) expected);
+    return status;
+}
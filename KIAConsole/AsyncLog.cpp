@@ -0,0 +1,168 @@
+#include "pch.h"
+
+#include "AsyncLog.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+using std::string;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+
+AsyncLog::AsyncLog(FILE* f, int flushMS, size_t flushBytes)
+    : f(f),
+      flushMS(flushMS),
+      flushBytes(flushBytes),
+      slots(new Slot[SLOT_COUNT]),
+      enqueuePos(0),
+      dequeuePos(0),
+      flushTarget(0)
+{
+    for (size_t i = 0; i < SLOT_COUNT; i++)
+        slots[i].sequence.store(i, memory_order_relaxed);
+
+    thread = std::thread(&AsyncLog::run, this);
+}
+
+AsyncLog::~AsyncLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void AsyncLog::write(const char* line, size_t len)
+{
+    if (len > SLOT_BYTES)
+    {
+        // rare oversized line: write it directly, after everything queued before it
+        flush();
+        std::lock_guard<std::mutex> lock(fileMut);
+        fwrite(line, 1, len, f);
+        fflush(f);
+        return;
+    }
+
+    // claim a slot
+    Slot* slot;
+    size_t pos = enqueuePos.load(memory_order_relaxed);
+    while (true)
+    {
+        slot = &slots[pos & (SLOT_COUNT - 1)];
+        size_t seq = slot->sequence.load(memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+        if (dif == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+        {
+            // ring is full; hurry the writer along and wait our turn
+            wake.notify_one();
+            std::this_thread::yield();
+            pos = enqueuePos.load(memory_order_relaxed);
+        }
+        else
+            pos = enqueuePos.load(memory_order_relaxed);
+    }
+
+    // fill and publish it
+    memcpy(slot->text, line, len);
+    slot->len = len;
+    slot->sequence.store(pos + 1, memory_order_release);
+
+    // size trigger: don't wait for the timer once the ring is half full
+    if (pos + 1 - dequeuePos.load(memory_order_relaxed) == SLOT_COUNT / 2)
+        wake.notify_one();
+}
+
+void AsyncLog::flush()
+{
+    size_t target = enqueuePos.load(memory_order_acquire);
+
+    size_t prev = flushTarget.load();
+    while (prev < target && !flushTarget.compare_exchange_weak(prev, target))
+        ;
+
+    std::unique_lock<std::mutex> lock(mut);
+    wake.notify_one();
+    written.wait(lock, [&]() { return writtenPos >= target; });
+}
+
+//! move every published line into buffer (writer thread only)
+//! @returns number of lines drained
+size_t AsyncLog::drain(string& buffer)
+{
+    size_t count = 0;
+    size_t pos = dequeuePos.load(memory_order_relaxed);
+    while (true)
+    {
+        Slot& slot = slots[pos & (SLOT_COUNT - 1)];
+        if (slot.sequence.load(memory_order_acquire) != pos + 1)
+            break;
+
+        buffer.append(slot.text, slot.len);
+        slot.sequence.store(pos + SLOT_COUNT, memory_order_release);
+        dequeuePos.store(++pos, memory_order_relaxed);
+        count++;
+
+        if (buffer.size() >= flushBytes)
+            writeBuffer(buffer);
+    }
+    return count;
+}
+
+void AsyncLog::writeBuffer(string& buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(fileMut);
+        fwrite(buffer.data(), 1, buffer.size(), f);
+        fflush(f);
+    }
+    buffer.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        writtenPos = dequeuePos.load(memory_order_relaxed);
+    }
+    written.notify_all();
+}
+
+void AsyncLog::run()
+{
+    string buffer;
+    buffer.reserve(flushBytes + SLOT_BYTES);
+
+    while (true)
+    {
+        drain(buffer);
+        if (!buffer.empty())
+            writeBuffer(buffer);
+
+        std::unique_lock<std::mutex> lock(mut);
+        bool idle = dequeuePos.load() == enqueuePos.load();
+        if (stopping && idle)
+            break;
+
+        // a flush (or shutdown) is waiting on lines still being copied in
+        if ((stopping || flushTarget.load() > writtenPos) && !idle)
+        {
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+
+        wake.wait_for(lock, std::chrono::milliseconds(flushMS), [&]()
+        {
+            return stopping
+                || flushTarget.load() > writtenPos
+                || enqueuePos.load() - dequeuePos.load() >= SLOT_COUNT / 2;
+        });
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef KIACONSOLE_ASYNC_LOG_H
+#define KIACONSOLE_ASYNC_LOG_H
+
+#include "pch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*! @brief Background writer for Util::log.
+
+    Callers copy each formatted line into a slot of a bounded lock-free ring
+    (Vyukov's multi-producer queue), and return without a syscall.  A
+    background thread drains the ring and writes batches to the output file,
+    whenever flushMS has passed, the ring is half full, or a caller asks for
+    a synchronous flush (e.g. at the end of a streamed request, so ENLIGHTEN
+    sees "Processing complete" without delay).
+
+    If the ring is full, callers wait for the writer rather than drop lines,
+    as KIAWrapper depends on every one of them.
+*/
+class AsyncLog
+{
+    public:
+        AsyncLog(FILE* f, int flushMS = 50, size_t flushBytes = 64 * 1024);
+        ~AsyncLog();                            //!< writes everything still queued
+
+        void write(const char* line, size_t len);   //!< queue one complete line
+        void flush();                               //!< block until all lines queued so far are written
+
+    private:
+        static const size_t SLOT_COUNT = 1024;  //!< must be a power of 2
+        static const size_t SLOT_BYTES = 2048 - sizeof(std::atomic<size_t>) - sizeof(size_t);
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            size_t len;
+            char text[SLOT_BYTES];
+        };
+
+        FILE* f;
+        int flushMS;
+        size_t flushBytes;
+        std::unique_ptr<Slot[]> slots;
+
+        alignas(64) std::atomic<size_t> enqueuePos;
+        alignas(64) std::atomic<size_t> dequeuePos;
+        std::atomic<size_t> flushTarget;        //!< highest position a flush() is waiting on
+        size_t writtenPos = 0;                  //!< guarded by mut
+
+        bool stopping = false;                  //!< guarded by mut
+        std::mutex mut;
+        std::mutex fileMut;                     //!< serializes writes to f
+        std::condition_variable wake;
+        std::condition_variable written;
+        std::thread thread;
+
+        void run();
+        size_t drain(std::string& buffer);
+        void writeBuffer(std::string& buffer);
+};
+
+#endif
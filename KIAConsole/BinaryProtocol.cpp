@@ -0,0 +1,124 @@
+#include "pch.h"
+
+#include "BinaryProtocol.h"
+
+#include "Util.h"
+
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using std::string;
+
+//! sanity limit, so a corrupt header can't make us allocate gigabytes
+static const uint32_t MAX_PIXELS = 1 << 20;
+
+void BinaryProtocol::setBinaryMode(FILE* f)
+{
+#ifdef _WIN32
+    _setmode(_fileno(f), _O_BINARY);
+#endif
+}
+
+BinaryProtocol::ReadStatus BinaryProtocol::readRequest(FILE* in, Measurement& m, uint32_t& requestId)
+{
+    BinaryRequestHeader header;
+    size_t n = fread(&header, 1, sizeof(header), in);
+    if (n == 0)
+        return READ_EOF;
+    if (n != sizeof(header))
+    {
+        Util::log(L"ERROR: truncated binary request header");
+        return READ_ERROR;
+    }
+
+    if (header.magic != REQUEST_MAGIC)
+    {
+        Util::log(L"ERROR: invalid binary request magic 0x%08x", header.magic);
+        return READ_ERROR;
+    }
+
+    requestId = header.requestId;
+    if (header.pixels == 0)
+        return READ_QUIT;
+
+    if (header.pixels > MAX_PIXELS || header.length != 2 * header.pixels * sizeof(double))
+    {
+        Util::log(L"ERROR: invalid binary request (%u pixels, %u bytes)", header.pixels, header.length);
+        return READ_ERROR;
+    }
+
+    // read arrays straight into the (reused) measurement vectors
+    m.resize((int) header.pixels);
+    m.max_results = header.maxResults;
+    m.min_confidence = header.minConfidence;
+    m.timeout_ms = header.timeoutMS ? (int) header.timeoutMS : -1;
+
+    if (fread(&m.x[0], sizeof(double), header.pixels, in) != header.pixels ||
+        fread(&m.y[0], sizeof(double), header.pixels, in) != header.pixels)
+    {
+        Util::log(L"ERROR: truncated binary request %u", requestId);
+        return READ_ERROR;
+    }
+    return READ_REQUEST;
+}
+
+void BinaryProtocol::formatResult(string& frame, uint32_t requestId, int32_t status, double elapsedSec,
+                                  const SearchSDK_Match* matches, int matchCount, double minConfidence,
+                                  uint32_t flags, size_t maxBytes)
+{
+    frame.assign(sizeof(BinaryResultHeader), '\0');
+
+    uint32_t count = 0;
+    for (int i = 0; i < matchCount; i++)
+    {
+        const SearchSDK_Match& match = matches[i];
+        if (match.m_matchPercentage < minConfidence)
+            continue;
+
+        size_t pos = frame.size();
+        frame.append(sizeof(BinaryMatch), '\0');
+        Util::appendUtf8(frame, match.m_matchName);
+
+        BinaryMatch record;
+        record.percentage = match.m_matchPercentage;
+        record.flags = match.m_bLocked ? MATCH_LOCKED : 0;
+        record.nameBytes = (uint32_t) (frame.size() - pos - sizeof(BinaryMatch));
+        if (frame.size() > maxBytes)
+        {
+            // matches are best first, so drop this one and the rest
+            frame.resize(pos);
+            flags |= RESULT_TRUNCATED;
+            break;
+        }
+        memcpy(&frame[pos], &record, sizeof(record));
+        count++;
+    }
+
+    BinaryResultHeader header;
+    header.magic = RESULT_MAGIC;
+    header.length = (uint32_t) (frame.size() - sizeof(header));
+    header.requestId = requestId;
+    header.status = status;
+    header.matchCount = count;
+    header.flags = flags;
+    header.elapsedSec = elapsedSec;
+    memcpy(&frame[0], &header, sizeof(header));
+}
+
+bool BinaryProtocol::writeResult(FILE* out, uint32_t requestId, int32_t status, double elapsedSec,
+                                 const SearchSDK_Match* matches, int matchCount, double minConfidence,
+                                 uint32_t flags)
+{
+    // assemble the whole frame in a reused buffer, so it goes out in one write
+    static thread_local string frame;
+    formatResult(frame, requestId, status, elapsedSec, matches, matchCount, minConfidence, flags);
+
+    bool ok = fwrite(frame.data(), 1, frame.size(), out) == frame.size();
+    fflush(out);
+    return ok;
+}
@@ -0,0 +1,103 @@
+#ifndef KIACONSOLE_BINARY_PROTOCOL_H
+#define KIACONSOLE_BINARY_PROTOCOL_H
+
+#include "pch.h"
+
+#include "SearchSDK.h"
+#include "Measurement.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/*! @brief Length-prefixed binary framing for --streaming --binary.
+
+    The text protocol ("PIXELS, n" then one ASCII "x, y" pair per pixel) costs
+    real CPU on both ends at high acquisition rates, so this opt-in protocol
+    carries spectra as raw float64 arrays instead.  All fields are
+    little-endian (native on every platform ENLIGHTEN supports).
+
+    Request:  BinaryRequestHeader, then pixels doubles of x, then pixels
+              doubles of y.  A request with zero pixels means QUIT.
+
+    Result:   BinaryResultHeader, then matchCount records, each a BinaryMatch
+              followed by nameBytes of UTF-8 (not zero-terminated).  Only
+              matches meeting the request's min_confidence are included.
+
+    The length field of each header counts the bytes following the header,
+    so a reader can skip frames it doesn't understand.
+*/
+
+#pragma pack(push, 1)
+struct BinaryRequestHeader
+{
+    uint32_t magic;             //!< BinaryProtocol::REQUEST_MAGIC ("KIAQ")
+    uint32_t length;            //!< bytes following this header (16 * pixels)
+    uint32_t requestId;         //!< echoed in the result
+    uint32_t pixels;            //!< 0 = QUIT
+    int32_t  maxResults;        //!< 1 to BinaryProtocol::MAX_RESULTS
+    uint32_t timeoutMS;         //!< search deadline (0 = KIAConsole's --timeout-ms)
+    double   minConfidence;
+};
+
+struct BinaryResultHeader
+{
+    uint32_t magic;             //!< BinaryProtocol::RESULT_MAGIC ("KIAR")
+    uint32_t length;            //!< bytes following this header
+    uint32_t requestId;
+    int32_t  status;            //!< BinaryProtocol::STATUS_*
+    uint32_t matchCount;
+    uint32_t flags;             //!< BinaryProtocol::RESULT_*
+    double   elapsedSec;
+};
+
+struct BinaryMatch
+{
+    double   percentage;        //!< 0 to 1
+    uint32_t flags;             //!< BinaryProtocol::MATCH_LOCKED
+    uint32_t nameBytes;
+};
+#pragma pack(pop)
+
+class BinaryProtocol
+{
+    public:
+        static const uint32_t REQUEST_MAGIC = 0x5141494b;   //!< "KIAQ"
+        static const uint32_t RESULT_MAGIC  = 0x5241494b;   //!< "KIAR"
+
+        static const int32_t STATUS_OK      = 0;
+        static const int32_t STATUS_INVALID = 1;            //!< malformed request
+        static const int32_t STATUS_FAILED  = 2;            //!< no search handle available
+        static const int32_t STATUS_TIMEOUT = 3;            //!< search canceled at its deadline (no matches)
+        static const int32_t STATUS_REJECTED = 4;           //!< failed the quality gate, so not searched (no matches)
+
+        static const int32_t MAX_RESULTS    = 1000;         //!< most matches a request may ask for (else STATUS_INVALID)
+
+        static const uint32_t MATCH_LOCKED  = 0x01;         //!< from an unlicensed database
+
+        static const uint32_t RESULT_REUSED = 0x01;         //!< matches of a recent near-identical spectrum (--coalesce)
+        static const uint32_t RESULT_TRUNCATED = 0x02;      //!< lowest matches dropped to fit a SharedRing slot
+        static const uint32_t RESULT_LOCAL  = 0x04;         //!< scores against local reference spectra, not searched (--references)
+        static const int RESULT_REASON_SHIFT = 8;           //!< bits 8-15: QualityGate::Reason of a STATUS_REJECTED result
+
+        enum ReadStatus { READ_REQUEST, READ_QUIT, READ_EOF, READ_ERROR };
+
+        //! put a stdio stream in binary mode (no-op outside Windows)
+        static void setBinaryMode(FILE* f);
+
+        //! read the next request into m (reusing its storage)
+        static ReadStatus readRequest(FILE* in, Measurement& m, uint32_t& requestId);
+
+        //! assemble one result frame in frame (reusing its storage), including
+        //! only as many matches as fit in maxBytes
+        static void formatResult(std::string& frame, uint32_t requestId, int32_t status, double elapsedSec,
+                                 const SearchSDK_Match* matches, int matchCount, double minConfidence,
+                                 uint32_t flags = 0, size_t maxBytes = SIZE_MAX);
+
+        //! write and flush one result frame
+        static bool writeResult(FILE* out, uint32_t requestId, int32_t status, double elapsedSec,
+                                const SearchSDK_Match* matches, int matchCount, double minConfidence,
+                                uint32_t flags = 0);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef KIACONSOLE_BOUNDED_QUEUE_H
+#define KIACONSOLE_BOUNDED_QUEUE_H
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*! @brief Blocking FIFO of at most capacity items, for pipeline stages.
+
+    push() blocks while the queue is full, giving backpressure to faster
+    producers; pop() blocks while it is empty.  After close(), pushes fail and
+    pops drain whatever remains, then fail.
+*/
+template <typename T>
+class BoundedQueue
+{
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity(capacity ? capacity : 1) {}
+
+        //! @returns false if the queue was closed
+        bool push(T&& item)
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            notFull.wait(lock, [&]() { return closed || items.size() < capacity; });
+            if (closed)
+                return false;
+            items.push_back(std::move(item));
+            lock.unlock();
+            notEmpty.notify_one();
+            return true;
+        }
+
+        //! @returns false if the queue is closed and empty
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            notEmpty.wait(lock, [&]() { return closed || !items.empty(); });
+            if (items.empty())
+                return false;
+            item = std::move(items.front());
+            items.pop_front();
+            lock.unlock();
+            notFull.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                closed = true;
+            }
+            notFull.notify_all();
+            notEmpty.notify_all();
+        }
+
+    private:
+        std::deque<T> items;
+        size_t capacity;
+        bool closed = false;
+        std::mutex mut;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "pch.h"
+
+#include "Coalescer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::vector;
+using std::wstring;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+Coalescer::Coalescer(double threshold, int window)
+    : threshold(threshold),
+      window(window > 0 ? (size_t) window : 1)
+{
+    entries.reserve(this->window);
+}
+
+//! bin means of y, centered and normalized to unit length
+void Coalescer::computeSignature(const double* p, size_t n, float* out)
+{
+    for (int b = 0; b < SIGNATURE_BINS; b++)
+    {
+        size_t begin = n * b / SIGNATURE_BINS;
+        size_t end = n * (b + 1) / SIGNATURE_BINS;
+        double sum = 0;
+        for (size_t i = begin; i < end; i++)
+            sum += p[i];
+        out[b] = end > begin ? (float) (sum / (end - begin)) : 0.0f;
+    }
+
+    float mean = 0;
+    for (int b = 0; b < SIGNATURE_BINS; b++)
+        mean += out[b];
+    mean /= SIGNATURE_BINS;
+
+    float norm = 0;
+    for (int b = 0; b < SIGNATURE_BINS; b++)
+    {
+        out[b] -= mean;
+        norm += out[b] * out[b];
+    }
+
+    float scale = norm > 0 ? 1.0f / std::sqrt(norm) : 0.0f;
+    for (int b = 0; b < SIGNATURE_BINS; b++)
+        out[b] *= scale;
+}
+
+//! same pixel count, same x-axis span (to within a hundredth of a pixel), same max_results
+bool Coalescer::comparable(const Entry& e, const SpectrumView& m)
+{
+    if (e.pixels != (size_t) m.pixels || e.maxResults != m.max_results || m.pixels < 1)
+        return false;
+
+    const double xFirst = m.x[0];
+    const double xLast = m.x[m.pixels - 1];
+    double tolerance = 0.01 * std::fabs(xLast - xFirst) / m.pixels;
+    return std::fabs(e.xFirst - xFirst) <= tolerance
+        && std::fabs(e.xLast - xLast) <= tolerance;
+}
+
+const SearchSDK_Match* Coalescer::find(const SpectrumView& m, int& count, double& similarity, double& ageSec)
+{
+    computeSignature(m.y, (size_t) m.pixels, signature);
+
+    similarity = -2;
+    const Entry* best = nullptr;
+    for (const Entry& e : entries)
+    {
+        if (!comparable(e, m))
+            continue;
+
+        float dot = 0;
+        for (int b = 0; b < SIGNATURE_BINS; b++)
+            dot += signature[b] * e.signature[b];
+
+        if (dot > similarity)
+        {
+            similarity = dot;
+            best = &e;
+        }
+    }
+
+    if (!best || similarity < threshold)
+        return nullptr;
+
+    count = (int) best->matches.size();
+    ageSec = duration<double>(steady_clock::now() - best->when).count();
+    return best->matches.data();
+}
+
+void Coalescer::add(const SpectrumView& m, const SearchSDK_Match* matches, int count)
+{
+    // fill the ring, then overwrite the oldest entry
+    if (entries.size() < window)
+        entries.emplace_back();
+    Entry& e = entries[next];
+    next = (next + 1) % window;
+
+    std::copy(signature, signature + SIGNATURE_BINS, e.signature);
+    e.pixels = (size_t) m.pixels;
+    e.xFirst = m.pixels > 0 ? m.x[0] : 0;
+    e.xLast = m.pixels > 0 ? m.x[m.pixels - 1] : 0;
+    e.maxResults = m.max_results;
+    e.when = steady_clock::now();
+
+    // copy names first, as matches will point into them
+    e.names.resize(count);
+    e.matches.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        e.names[i] = matches[i].m_matchName ? matches[i].m_matchName : L"";
+        e.matches[i] = matches[i];
+        e.matches[i].m_matchName = &e.names[i][0];
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef KIACONSOLE_COALESCER_H
+#define KIACONSOLE_COALESCER_H
+
+#include "pch.h"
+
+#include "SearchSDK.h"
+#include "Measurement.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*! @brief Reuses results of recent near-identical spectra (--coalesce).
+
+    In live mode ENLIGHTEN sends nearly the same spectrum over and over while
+    a sample sits under the laser.  Each spectrum is reduced to a signature
+    of SIGNATURE_BINS bin means, centered and scaled to unit length, so the
+    dot product of two signatures is their Pearson correlation at that
+    resolution.  If a new spectrum correlates with one of the last window
+    spectra searched (with the same pixel count, x-axis span and max_results)
+    at threshold or better, that spectrum's matches are reused.
+
+    Matches are copied, so they outlive the search handle that produced them.
+*/
+class Coalescer
+{
+    public:
+        static const int SIGNATURE_BINS = 64;
+
+        Coalescer(double threshold, int window);
+
+        //! @param similarity  set to the best correlation found (-2 if none comparable)
+        //! @returns the reused matches, or nullptr if no recent spectrum is close enough
+        const SearchSDK_Match* find(const SpectrumView& m, int& count, double& similarity, double& ageSec);
+
+        //! remember the result of a spectrum just searched (after a find() miss)
+        void add(const SpectrumView& m, const SearchSDK_Match* matches, int count);
+
+    private:
+        struct Entry
+        {
+            float signature[SIGNATURE_BINS];
+            size_t pixels = 0;
+            double xFirst = 0;
+            double xLast = 0;
+            int maxResults = 0;
+            std::chrono::steady_clock::time_point when;
+            std::vector<std::wstring> names;
+            std::vector<SearchSDK_Match> matches;
+        };
+
+        double threshold;
+        size_t window;
+        std::vector<Entry> entries;         //!< ring of the last window results
+        size_t next = 0;
+        float signature[SIGNATURE_BINS];    //!< of the spectrum last passed to find()
+
+        static void computeSignature(const double* y, size_t n, float* out);
+        static bool comparable(const Entry& e, const SpectrumView& m);
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "pch.h"
+
+#include "Corpus.h"
+
+#include "DirectoryWalker.h"
+#include "ExportFile.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! sanity limit, so a corrupt entry can't describe an absurd spectrum
+static const uint32_t MAX_PIXELS = 1 << 20;
+
+static uint64_t roundUp(uint64_t n)
+{
+    return (n + 63) & ~(uint64_t) 63;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Packing
+////////////////////////////////////////////////////////////////////////////////
+
+//! sequential writer tracking the file offset, and whether every write succeeded
+class CorpusWriter
+{
+    public:
+        FILE* f = nullptr;
+        uint64_t offset = 0;
+        bool ok = true;
+
+        void write(const void* p, size_t bytes)
+        {
+            if (ok && bytes && fwrite(p, 1, bytes, f) != bytes)
+                ok = false;
+            offset += bytes;
+        }
+
+        //! zero-fill to the next 64-byte boundary
+        void align()
+        {
+            static const char zeros[64] = {};
+            write(zeros, (size_t) (roundUp(offset) - offset));
+        }
+};
+
+bool Corpus::pack(const wstring& directory, const wstring& pathname)
+{
+    auto start = steady_clock::now();
+    vector<wstring> files = DirectoryWalker(directory, L"*.csv").list(true);
+    Util::log(L"Packing %u files from %ls into %ls", (unsigned) files.size(), directory.c_str(), pathname.c_str());
+
+#ifdef _WIN32
+    FILE* f = _wfopen(pathname.c_str(), L"wb");
+#else
+    FILE* f = fopen(Util::toString(pathname).c_str(), "wb");
+#endif
+    if (!f)
+    {
+        Util::log(L"ERROR: unable to create %ls", pathname.c_str());
+        return false;
+    }
+
+    // the header is written last, so an interrupted pack leaves no valid corpus
+    CorpusWriter out;
+    out.f = f;
+    CorpusHeader header = {};
+    out.write(&header, sizeof(header));
+    out.align();
+
+    vector<CorpusEntry> entries;
+    string strings(1, '\0');        // offset 0 is the empty string
+    string contents;
+    unsigned skipped = 0;
+    for (const wstring& file : files)
+    {
+        // keep the parser's running commentary out of the way
+        wstring parseLog;
+        vector<std::unique_ptr<Measurement>> loaded;
+        Util::beginCapture(&parseLog);
+        try
+        {
+            if (!Util::readFile(file, contents))
+                throw std::runtime_error("unable to read file");
+            if (ExportFile::isExport(contents))
+                loaded = std::move(ExportFile(file, contents).measurements);
+            else
+                loaded.emplace_back(new Measurement(file, contents));
+        }
+        catch (std::exception&)
+        {
+            loaded.clear();
+        }
+        Util::endCapture();
+
+        uint32_t pathOffset = (uint32_t) strings.size();
+        Util::appendUtf8(strings, file.c_str());
+        strings += '\0';
+
+        bool any = false;
+        for (auto& m : loaded)
+        {
+            SpectrumView v = m->view();
+            if (!m->isValid() || v.pixels < 2 || (uint32_t) v.pixels > MAX_PIXELS)
+                continue;
+
+            CorpusEntry entry = {};
+            entry.data = out.offset;
+            entry.pixels = (uint32_t) v.pixels;
+            entry.maxResults = m->max_results;
+            entry.timeoutMS = m->timeout_ms;
+            entry.minConfidence = m->min_confidence;
+            entry.pathname = pathOffset;
+            if (!m->label.empty())
+            {
+                entry.label = (uint32_t) strings.size();
+                Util::appendUtf8(strings, m->label.c_str());
+                strings += '\0';
+            }
+            entries.push_back(entry);
+            any = true;
+
+            out.write(v.x, sizeof(double) * v.pixels);
+            out.align();
+            out.write(v.y, sizeof(double) * v.pixels);
+            out.align();
+        }
+
+        if (!any)
+        {
+            Util::log(L"Skipping %ls (no valid spectra)", file.c_str());
+            skipped++;
+        }
+    }
+
+    header.entries = out.offset;
+    out.write(entries.data(), sizeof(CorpusEntry) * entries.size());
+    header.strings = out.offset;
+    header.stringBytes = strings.size();
+    out.write(strings.data(), strings.size());
+
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.count = (uint32_t) entries.size();
+    header.fileBytes = out.offset;
+
+    bool ok = out.ok && strings.size() < UINT32_MAX && fseek(f, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+    {
+        Util::log(L"ERROR: unable to write %ls", pathname.c_str());
+#ifdef _WIN32
+        _wremove(pathname.c_str());
+#else
+        remove(Util::toString(pathname).c_str());
+#endif
+        return false;
+    }
+
+    Util::log(L"Packed %u spectra from %u files (%u skipped) into %ls (%.1lf MB) in %.2lf sec",
+        header.count, (unsigned) files.size() - skipped, skipped, pathname.c_str(),
+        header.fileBytes / 1048576.0, duration<double>(steady_clock::now() - start).count());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+Corpus::~Corpus()
+{
+    close();
+}
+
+bool Corpus::open(const wstring& pathname)
+{
+    if (!map(pathname))
+        return false;
+
+    if (size < sizeof(CorpusHeader) || header->magic != MAGIC || header->version != VERSION)
+    {
+        Util::log(L"ERROR: %ls is not a version %u corpus (see KIAConsole pack)", pathname.c_str(), VERSION);
+        close();
+        return false;
+    }
+
+    const char* base = reinterpret_cast<const char*>(header);
+    bool whole = header->fileBytes == size
+        && header->entries % 8 == 0
+        && header->entries <= size
+        && header->count <= (size - header->entries) / sizeof(CorpusEntry)
+        && header->strings <= size
+        && header->stringBytes > 0
+        && header->stringBytes <= size - header->strings
+        && base[header->strings + header->stringBytes - 1] == '\0';
+
+    // every entry's arrays and strings must lie within the file
+    for (uint32_t i = 0; whole && i < header->count; i++)
+    {
+        const CorpusEntry& e = reinterpret_cast<const CorpusEntry*>(base + header->entries)[i];
+        whole = e.pixels >= 2 && e.pixels <= MAX_PIXELS
+            && e.data % 64 == 0
+            && e.data <= size
+            && roundUp(sizeof(double) * e.pixels) + sizeof(double) * e.pixels <= size - e.data
+            && e.pathname < header->stringBytes
+            && e.label < header->stringBytes;
+    }
+    if (!whole)
+    {
+        Util::log(L"ERROR: %ls is truncated or corrupt", pathname.c_str());
+        close();
+        return false;
+    }
+
+    entries = reinterpret_cast<const CorpusEntry*>(base + header->entries);
+    strings = base + header->strings;
+    return true;
+}
+
+SpectrumView Corpus::view(uint32_t i) const
+{
+    const CorpusEntry& e = entries[i];
+    const char* x = reinterpret_cast<const char*>(header) + e.data;
+
+    SpectrumView v;
+    v.x = reinterpret_cast<const double*>(x);
+    v.y = reinterpret_cast<const double*>(x + roundUp(sizeof(double) * e.pixels));
+    v.pixels = (int) e.pixels;
+    v.max_results = e.maxResults;
+    v.timeout_ms = e.timeoutMS;
+    return v;
+}
+
+#ifdef _WIN32
+
+bool Corpus::map(const wstring& pathname)
+{
+    HANDLE f = CreateFileW(pathname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER bytes;
+    if (f == INVALID_HANDLE_VALUE || !GetFileSizeEx(f, &bytes) || bytes.QuadPart == 0)
+    {
+        Util::log(L"ERROR: unable to open %ls (error %u)", pathname.c_str(), GetLastError());
+        if (f != INVALID_HANDLE_VALUE)
+            CloseHandle(f);
+        return false;
+    }
+
+    HANDLE h = CreateFileMappingW(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* p = h ? MapViewOfFile(h, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!p)
+    {
+        Util::log(L"ERROR: unable to map %ls (error %u)", pathname.c_str(), GetLastError());
+        if (h)
+            CloseHandle(h);
+        CloseHandle(f);
+        return false;
+    }
+
+    file = f;
+    mapping = h;
+    header = static_cast<const CorpusHeader*>(p);
+    size = (size_t) bytes.QuadPart;
+    return true;
+}
+
+void Corpus::close()
+{
+    if (header)
+        UnmapViewOfFile(header);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+    header = nullptr;
+    entries = nullptr;
+    strings = nullptr;
+    mapping = file = nullptr;
+}
+
+#else
+
+bool Corpus::map(const wstring& pathname)
+{
+    int fd = ::open(Util::toString(pathname).c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        Util::log(L"ERROR: unable to open %ls: %ls", pathname.c_str(), Util::toWstring(strerror(errno)).c_str());
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    size_t bytes = (size_t) st.st_size;
+    void* p = bytes ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        Util::log(L"ERROR: unable to map %ls: %ls", pathname.c_str(), Util::toWstring(strerror(errno)).c_str());
+        return false;
+    }
+
+    // spectra are read in order, once each
+    madvise(p, bytes, MADV_SEQUENTIAL);
+
+    header = static_cast<const CorpusHeader*>(p);
+    size = bytes;
+    return true;
+}
+
+void Corpus::close()
+{
+    if (header)
+        munmap(const_cast<CorpusHeader*>(header), size);
+    header = nullptr;
+    entries = nullptr;
+    strings = nullptr;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef KIACONSOLE_CORPUS_H
+#define KIACONSOLE_CORPUS_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+
+#include <cstdint>
+#include <string>
+
+/*! @brief A directory of spectra packed into one memory-mapped file
+           ("KIAConsole pack", --corpus).
+
+    Re-running a batch (e.g. while tuning thresholds) otherwise spends most
+    of its non-search time opening and parsing the same CSV files.  "pack"
+    parses every CSV (and export file) under a directory once, in pathname
+    order, and writes every valid spectrum to a corpus file:
+
+    - a CorpusHeader;
+    - for each spectrum, x then y as float64 arrays, each starting on a
+      64-byte boundary, so they can be searched straight from the mapping;
+    - a CorpusEntry per spectrum (pixels, where its arrays start, its
+      request parameters, and its pathname and label); and
+    - a string table of NUL-terminated UTF-8 pathnames and labels.
+
+    All integers are little-endian, as written.  open() maps the file
+    read-only and checks every entry lies within it once, so iterating the
+    spectra afterwards neither parses nor allocates anything.  Safe to read
+    from any number of threads.
+*/
+
+struct CorpusHeader
+{
+    uint32_t magic;                 //!< Corpus::MAGIC ("KIAS")
+    uint32_t version;
+    uint32_t count;                 //!< spectra
+    uint32_t reserved;
+    uint64_t entries;               //!< file offset of count CorpusEntry records
+    uint64_t strings;               //!< file offset of the string table
+    uint64_t stringBytes;
+    uint64_t fileBytes;             //!< total, to detect truncation
+};
+
+struct CorpusEntry
+{
+    uint64_t data;                  //!< file offset of x (y follows at the next 64-byte boundary)
+    uint32_t pixels;
+    int32_t  maxResults;
+    int32_t  timeoutMS;             //!< as Measurement::timeout_ms
+    uint32_t pathname;              //!< string table offsets
+    uint32_t label;
+    uint32_t reserved;
+    double   minConfidence;
+};
+
+class Corpus
+{
+    public:
+        static const uint32_t MAGIC   = 0x5341494b;     //!< "KIAS"
+        static const uint32_t VERSION = 1;
+
+        //! parse every CSV under directory into a new corpus file
+        //! @returns false if nothing could be written
+        static bool pack(const std::wstring& directory, const std::wstring& pathname);
+
+        Corpus() {}
+        ~Corpus();
+
+        //! map a corpus file, checking it is whole
+        bool open(const std::wstring& pathname);
+        void close();
+
+        uint32_t count() const { return header ? header->count : 0; }
+        const CorpusEntry& entry(uint32_t i) const { return entries[i]; }
+
+        //! spectrum i, searchable in place
+        SpectrumView view(uint32_t i) const;
+        const char* pathname(uint32_t i) const { return strings + entries[i].pathname; }   //!< UTF-8
+        const char* label(uint32_t i) const { return strings + entries[i].label; }         //!< UTF-8
+
+    private:
+        const CorpusHeader* header = nullptr;
+        const CorpusEntry* entries = nullptr;
+        const char* strings = nullptr;
+        size_t size = 0;
+#ifdef _WIN32
+        void* file = nullptr;
+        void* mapping = nullptr;
+#endif
+
+        bool map(const std::wstring& pathname);
+};
+
+#endif
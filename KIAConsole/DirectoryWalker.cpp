@@ -0,0 +1,254 @@
+#include "pch.h"
+
+#include "DirectoryWalker.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+#ifdef _WIN32
+static const wchar_t* SEPARATOR = L"\\";
+#else
+static const wchar_t* SEPARATOR = L"/";
+#endif
+
+DirectoryWalker::DirectoryWalker(const wstring& directory, const wstring& mask, int threads)
+    : root(directory),
+      mask(mask),
+      threadCount(threads > 0 ? threads : 1),
+      found(0)
+{
+}
+
+DirectoryWalker::~DirectoryWalker()
+{
+    join();
+}
+
+bool DirectoryWalker::matches(const wchar_t* name, const wchar_t* mask)
+{
+    // greedy, backtracking to the last '*' on a mismatch
+    const wchar_t* star = nullptr;
+    const wchar_t* resume = nullptr;
+    while (*name)
+    {
+        if (*mask == L'*')
+        {
+            star = mask++;
+            resume = name;
+        }
+        else if (*mask == L'?' || (*mask && towlower(*mask) == towlower(*name)))
+        {
+            mask++;
+            name++;
+        }
+        else if (star)
+        {
+            mask = star + 1;
+            name = ++resume;
+        }
+        else
+            return false;
+    }
+    while (*mask == L'*')
+        mask++;
+    return !*mask;
+}
+
+void DirectoryWalker::start(BoundedQueue<wstring>& out)
+{
+    emit = [&out](wstring&& pathname) { return out.push(std::move(pathname)); };
+    finish = [&out]() { out.close(); };
+    begin();
+}
+
+size_t DirectoryWalker::join()
+{
+    for (auto& t : threads)
+        t.join();
+    threads.clear();
+    return found;
+}
+
+vector<wstring> DirectoryWalker::list(bool sorted)
+{
+    vector<wstring> files;
+    std::mutex filesMut;
+    emit = [&](wstring&& pathname)
+    {
+        std::lock_guard<std::mutex> lock(filesMut);
+        files.push_back(std::move(pathname));
+        return true;
+    };
+    finish = nullptr;
+    begin();
+    join();
+
+    if (sorted)
+        std::sort(files.begin(), files.end());
+    return files;
+}
+
+void DirectoryWalker::begin()
+{
+    join();
+    pending.assign(1, root);
+    busy = 0;
+    stopped = false;
+    found = 0;
+    firstSec = -1;
+    elapsedSec = 0;
+    running = threadCount;
+    startTime = steady_clock::now();
+
+    for (int i = 0; i < threadCount; i++)
+        threads.emplace_back(&DirectoryWalker::run, this);
+}
+
+void DirectoryWalker::run()
+{
+    vector<wstring> subdirs;
+    std::unique_lock<std::mutex> lock(mut);
+    while (true)
+    {
+        // done once nothing is pending and nobody is listing (so can't add more)
+        changed.wait(lock, [&]() { return stopped || !pending.empty() || busy == 0; });
+        if (stopped || pending.empty())
+            break;
+
+        wstring path = std::move(pending.back());
+        pending.pop_back();
+        busy++;
+        lock.unlock();
+
+        subdirs.clear();
+        bool ok = listDirectory(path, subdirs);
+
+        lock.lock();
+        busy--;
+        if (!ok)
+            stopped = true;
+        for (wstring& dir : subdirs)
+            pending.push_back(std::move(dir));
+        changed.notify_all();
+    }
+
+    if (--running == 0)
+    {
+        elapsedSec = duration<double>(steady_clock::now() - startTime).count();
+        lock.unlock();
+        if (finish)
+            finish();
+    }
+}
+
+#ifdef _WIN32
+
+bool DirectoryWalker::listDirectory(const wstring& path, vector<wstring>& subdirs)
+{
+    // list everything (subdirectories don't match the mask), in large batches
+    WIN32_FIND_DATAW ffd;
+    HANDLE hFind = FindFirstFileExW((path + L"\\*").c_str(), FindExInfoBasic, &ffd,
+        FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return true;
+
+    do
+    {
+        if (wcscmp(ffd.cFileName, L".") == 0 || wcscmp(ffd.cFileName, L"..") == 0)
+            continue;
+
+        if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if (!(ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                subdirs.push_back(path + SEPARATOR + ffd.cFileName);
+        }
+        else if (matches(ffd.cFileName, mask.c_str()))
+        {
+            if (found++ == 0)
+                firstSec = duration<double>(steady_clock::now() - startTime).count();
+            if (!emit(path + SEPARATOR + ffd.cFileName))
+            {
+                FindClose(hFind);
+                return false;
+            }
+        }
+    } while (FindNextFileW(hFind, &ffd) != 0);
+
+    FindClose(hFind);
+    return true;
+}
+
+#else
+
+bool DirectoryWalker::listDirectory(const wstring& path, vector<wstring>& subdirs)
+{
+    const string narrow = Util::toString(path);
+    DIR* dir = opendir(narrow.c_str());
+    if (!dir)
+        return true;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        // names are UTF-8; one that isn't couldn't be opened again from its
+        // wide form, so is skipped
+        wstring name;
+        if (!Util::appendWide(name, entry->d_name, strlen(entry->d_name)) || name.empty())
+        {
+            Util::log(L"WARNING: skipping %ls%ls%ls (name is not valid UTF-8)", path.c_str(), SEPARATOR, name.c_str());
+            continue;
+        }
+
+        // d_type saves a stat per entry, where the filesystem provides it
+        const string child = narrow + "/" + entry->d_name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (lstat(child.c_str(), &st) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+        }
+
+        if (type == DT_DIR)
+            subdirs.push_back(path + SEPARATOR + name);
+        else if (matches(name.c_str(), mask.c_str()))
+        {
+            // follow links to files, but not to directories
+            struct stat st;
+            if (type == DT_LNK && (stat(child.c_str(), &st) != 0 || S_ISDIR(st.st_mode)))
+                continue;
+
+            if (found++ == 0)
+                firstSec = duration<double>(steady_clock::now() - startTime).count();
+            if (!emit(path + SEPARATOR + name))
+            {
+                closedir(dir);
+                return false;
+            }
+        }
+    }
+    closedir(dir);
+    return true;
+}
+
+#endif
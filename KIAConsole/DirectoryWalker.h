@@ -0,0 +1,86 @@
+#ifndef KIACONSOLE_DIRECTORY_WALKER_H
+#define KIACONSOLE_DIRECTORY_WALKER_H
+
+#include "pch.h"
+
+#include "BoundedQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*! @brief Finds the files matching a glob pattern under a directory tree,
+           on several threads at once.
+
+    Archives can hold hundreds of thousands of spectra, and collecting the
+    whole tree before searching anything delays the first result by the
+    entire traversal.  A walker shares a stack of directories still to be
+    listed between its threads; each lists one directory at a time, pushing
+    the subdirectories it finds back onto the stack, and either streams each
+    matching file to a queue as soon as it's found (start), or gathers them
+    into a vector, optionally sorted (list).
+
+    Unreadable or empty directories are skipped, as are symbolic links (and
+    Windows reparse points) to directories, which could otherwise form loops.
+    Masks support '*' and '?', case-insensitively.
+
+    Portable: FindFirstFileEx on Windows, opendir elsewhere.
+*/
+class DirectoryWalker
+{
+    public:
+        //! @param directory  path to traverse
+        //! @param mask       glob pattern, e.g. "*.csv"
+        //! @param threads    directories to list in parallel
+        DirectoryWalker(const std::wstring& directory, const std::wstring& mask, int threads = 4);
+        ~DirectoryWalker();
+
+        //! walk in the background, pushing each match to out as it's found,
+        //! and closing out when done (stops early if out is closed)
+        void start(BoundedQueue<std::wstring>& out);
+
+        //! wait for a walk begun with start()
+        //! @returns the number of files found
+        size_t join();
+
+        //! walk to completion, returning every match (in pathname order, if sorted)
+        std::vector<std::wstring> list(bool sorted);
+
+        double firstSec = -1;           //!< from start of walk until the first match (-1 if none)
+        double elapsedSec = 0;          //!< whole walk
+
+        //! true if name matches mask ('*' and '?' wildcards, case-insensitive)
+        static bool matches(const wchar_t* name, const wchar_t* mask);
+
+    private:
+        std::wstring root;
+        std::wstring mask;
+        int threadCount;
+
+        std::mutex mut;
+        std::condition_variable changed;
+        std::vector<std::wstring> pending;  //!< directories yet to be listed
+        int busy = 0;                       //!< threads listing a directory
+        bool stopped = false;               //!< the consumer went away
+        int running = 0;                    //!< threads not yet finished
+        std::atomic<size_t> found;
+        std::chrono::steady_clock::time_point startTime;
+        std::vector<std::thread> threads;
+
+        std::function<bool(std::wstring&&)> emit;   //!< takes each match (false = stop)
+        std::function<void()> finish;               //!< called once the walk is over
+
+        void begin();
+        void run();
+
+        //! list one directory, returning its subdirectories through subdirs
+        //! @returns false if emit refused a file (stop walking)
+        bool listDirectory(const std::wstring& path, std::vector<std::wstring>& subdirs);
+};
+
+#endif
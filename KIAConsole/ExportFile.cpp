@@ -0,0 +1,340 @@
+#include "pch.h"
+
+#include "ExportFile.h"
+
+#include "Util.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using std::string;
+using std::wstring;
+using std::vector;
+using std::runtime_error;
+
+namespace
+{
+    //! one comma-delimited field, trimmed, pointing into the file image
+    struct Cell
+    {
+        const char* begin;
+        const char* end;
+
+        bool empty() const { return begin == end; }
+    };
+
+    typedef vector<Cell> Row;
+
+    enum Axis { AXIS_NONE, AXIS_PIXEL, AXIS_WAVELENGTH, AXIS_WAVENUMBER };
+
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    //! case-insensitive comparison against a lower-case literal
+    bool iequals(const Cell& cell, const char* lower)
+    {
+        const char* p = cell.begin;
+        for (; p < cell.end && *lower; p++, lower++)
+            if (tolower((unsigned char) *p) != *lower)
+                return false;
+        return p == cell.end && !*lower;
+    }
+
+    void splitRow(const char* begin, const char* end, Row& row)
+    {
+        row.clear();
+        while (true)
+        {
+            const char* comma = static_cast<const char*>(memchr(begin, ',', end - begin));
+            const char* fieldEnd = comma ? comma : end;
+
+            Cell cell = { begin, fieldEnd };
+            while (cell.begin < cell.end && isSpace(*cell.begin))
+                cell.begin++;
+            while (cell.end > cell.begin && isSpace(cell.end[-1]))
+                cell.end--;
+            row.push_back(cell);
+
+            if (!comma)
+                break;
+            begin = comma + 1;
+        }
+    }
+
+    bool isBlank(const Row& row)
+    {
+        for (const Cell& cell : row)
+            if (!cell.empty())
+                return false;
+        return true;
+    }
+
+    Axis axisOf(const Cell& cell)
+    {
+        if (iequals(cell, "pixel"))
+            return AXIS_PIXEL;
+        if (iequals(cell, "wavelength"))
+            return AXIS_WAVELENGTH;
+        if (iequals(cell, "wavenumber"))
+            return AXIS_WAVENUMBER;
+        return AXIS_NONE;
+    }
+
+    //! @returns false if the cell is empty or not a number
+    bool parseDouble(const Cell& cell, double& value)
+    {
+        const char* p = cell.begin;
+        if (p < cell.end && *p == '+')
+            p++;
+        return p < cell.end && std::from_chars(p, cell.end, value).ec == std::errc();
+    }
+
+    /*! The rows preceding the first pixel row, and how its columns divide
+        into x-axis and spectra.
+    */
+    struct Layout
+    {
+        vector<Row> metadata;           //!< rows before the header row
+        Row header;
+        const Row* labels = nullptr;    //!< label row, if any (else labels are in header)
+        vector<Axis> axes;              //!< leading x-axis columns of header
+        vector<size_t> spectra;         //!< columns holding spectra
+        const char* data = nullptr;     //!< start of the line after the header row
+
+        //! metadata for the spectrum in column j (else the single value in column 1)
+        const Cell* lookup(const char* key, size_t j) const
+        {
+            for (const Row& row : metadata)
+            {
+                if (!iequals(row[0], key))
+                    continue;
+                if (j < row.size() && !row[j].empty())
+                    return &row[j];
+                if (row.size() > 1 && !row[1].empty())
+                    return &row[1];
+                return nullptr;
+            }
+            return nullptr;
+        }
+
+        bool lookup(const char* key, size_t j, double& value) const
+        {
+            const Cell* cell = lookup(key, j);
+            return cell && parseDouble(*cell, value);
+        }
+
+        size_t axisColumn(Axis axis) const
+        {
+            for (size_t i = 0; i < axes.size(); i++)
+                if (axes[i] == axis)
+                    return i;
+            return (size_t) -1;
+        }
+    };
+
+    //! scan up to the column header row
+    //! @returns false if there is none
+    bool readLayout(const string& contents, Layout& layout)
+    {
+        const char* p = contents.data();
+        const char* end = p + contents.size();
+
+        Row row;
+        while (p < end)
+        {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!eol)
+                eol = end;
+            splitRow(p, eol, row);
+            p = eol < end ? eol + 1 : end;
+
+            if (row.size() < 2 || axisOf(row[0]) == AXIS_NONE)
+            {
+                layout.metadata.push_back(row);
+                continue;
+            }
+
+            layout.header = row;
+            layout.data = p;
+
+            size_t i = 0;
+            for (; i < row.size() && axisOf(row[i]) != AXIS_NONE; i++)
+                layout.axes.push_back(axisOf(row[i]));
+            for (; i < row.size(); i++)
+                if (!row[i].empty() && !iequals(row[i], "dark") && !iequals(row[i], "reference"))
+                    layout.spectra.push_back(i);
+
+            // a label row directly precedes the header, blank under every x-axis
+            // column but the first (where it has the serial number)
+            if (!layout.metadata.empty() && !isBlank(layout.metadata.back()))
+            {
+                const Row& last = layout.metadata.back();
+                bool labels = last.size() > layout.axes.size();
+                for (size_t j = 1; labels && j < layout.axes.size(); j++)
+                    labels = last[j].empty();
+                if (labels)
+                    layout.labels = &last;
+            }
+            return true;
+        }
+        return false;
+    }
+}
+
+//! true if layout is an ordinary ENLIGHTEN save of one spectrum
+//! ("Pixel,Wavelength,Wavenumber,Processed,Raw,Dark,Reference"): no label
+//! row, and its columns the processed and/or raw versions of that spectrum,
+//! which Measurement picks out of the wavenumber and processed columns
+static bool isSingleSave(const Layout& layout)
+{
+    if (layout.labels || layout.axisColumn(AXIS_WAVENUMBER) == (size_t) -1)
+        return false;
+
+    bool processed = false, raw = false;
+    for (size_t j : layout.spectra)
+    {
+        const Cell& cell = layout.header[j];
+        if (!processed && iequals(cell, "processed"))
+            processed = true;
+        else if (!raw && iequals(cell, "raw"))
+            raw = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+bool ExportFile::isExport(const string& contents)
+{
+    // a column-ordered ENLIGHTEN file has a single x column and a single spectrum,
+    // or is a save of one spectrum's processed and raw versions
+    Layout layout;
+    return readLayout(contents, layout) && (layout.axes.size() > 1 || layout.spectra.size() > 1)
+        && !isSingleSave(layout);
+}
+
+ExportFile::ExportFile(const wstring& pathname, const string& contents)
+{
+    Layout layout;
+    if (!readLayout(contents, layout))
+        throw runtime_error("no pixel, wavelength or wavenumber header row");
+
+    // transpose the pixel rows into one column per spectrum
+    const size_t axisCount = layout.axes.size();
+    const size_t spectrumCount = layout.spectra.size();
+    vector<vector<double>> axes(axisCount);
+    vector<vector<double>> ys(spectrumCount);
+    vector<bool> missing(spectrumCount, false);
+
+    double pixelCount = 0;
+    if (layout.lookup("pixel count", layout.spectra.empty() ? 1 : layout.spectra[0], pixelCount) && pixelCount > 0)
+    {
+        for (auto& v : axes)
+            v.reserve((size_t) pixelCount);
+        for (auto& v : ys)
+            v.reserve((size_t) pixelCount);
+    }
+
+    const char* p = layout.data;
+    const char* end = contents.data() + contents.size();
+    Row row;
+    while (p < end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+        splitRow(p, eol, row);
+        p = eol < end ? eol + 1 : end;
+
+        // pixel rows start with a number; skip anything else (e.g. trailing blanks)
+        double value;
+        if (row.size() < axisCount || !parseDouble(row[0], value))
+            continue;
+
+        for (size_t i = 0; i < axisCount; i++)
+        {
+            if (!parseDouble(row[i], value))
+                throw runtime_error(Util::sstring("invalid x-axis value: %s", string(row[i].begin, row[i].end).c_str()));
+            axes[i].push_back(value);
+        }
+
+        for (size_t k = 0; k < spectrumCount; k++)
+        {
+            size_t j = layout.spectra[k];
+            if (j < row.size() && parseDouble(row[j], value))
+                ys[k].push_back(value);
+            else
+            {
+                missing[k] = true;
+                ys[k].push_back(0);
+            }
+        }
+    }
+
+    const size_t pixels = axes[0].size();
+    const size_t wavenumberColumn = layout.axisColumn(AXIS_WAVENUMBER);
+    const size_t wavelengthColumn = layout.axisColumn(AXIS_WAVELENGTH);
+    const size_t pixelColumn = layout.axisColumn(AXIS_PIXEL);
+
+    for (size_t k = 0; k < spectrumCount; k++)
+    {
+        const size_t j = layout.spectra[k];
+
+        const Cell& labelCell = layout.labels && j < layout.labels->size() ? (*layout.labels)[j] : layout.header[j];
+        wstring label;
+        Util::appendWide(label, labelCell.begin, labelCell.end - labelCell.begin);
+
+        if (missing[k] || pixels < 2)
+        {
+            Util::log(L"Skipping column %u (%ls): missing values", (unsigned) j, label.c_str());
+            continue;
+        }
+
+        std::unique_ptr<Measurement> m(new Measurement((int) pixels));
+        m->pathname = pathname;
+        m->label = label;
+        m->y.swap(ys[k]);
+
+        if (wavenumberColumn != (size_t) -1)
+            m->x = axes[wavenumberColumn];
+        else
+        {
+            // Raman shift from wavelength, measured or calibrated
+            double laser = 0;
+            if (!layout.lookup("laser wavelength", j, laser) || laser <= 0)
+            {
+                Util::log(L"Skipping column %u (%ls): no wavenumbers, and no laser wavelength to compute them",
+                    (unsigned) j, label.c_str());
+                continue;
+            }
+
+            if (wavelengthColumn != (size_t) -1)
+                m->x = axes[wavelengthColumn];
+            else
+            {
+                double coeffs[4] = { 0, 0, 0, 0 };
+                static const char* names[4] = { "ccd c0", "ccd c1", "ccd c2", "ccd c3" };
+                for (int c = 0; c < 4; c++)
+                    layout.lookup(names[c], j, coeffs[c]);
+
+                const vector<double>& pixel = axes[pixelColumn];
+                for (size_t i = 0; i < pixels; i++)
+                {
+                    double px = pixel[i];
+                    m->x[i] = coeffs[0] + px * (coeffs[1] + px * (coeffs[2] + px * coeffs[3]));
+                }
+            }
+
+            for (double& x : m->x)
+                x = 1e7 / laser - 1e7 / x;
+        }
+
+        measurements.push_back(std::move(m));
+    }
+
+    Util::log(L"Read %u spectra of %u pixels from export file", (unsigned) measurements.size(), (unsigned) pixels);
+}
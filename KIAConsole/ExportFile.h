@@ -0,0 +1,46 @@
+#ifndef KIACONSOLE_EXPORT_FILE_H
+#define KIACONSOLE_EXPORT_FILE_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/*! @brief Reads the spectra out of an ENLIGHTEN multi-spectrum export file
+           (e.g. data/raw/Session-* Sample Library.csv).
+
+    Export files are row-ordered: a block of metadata rows (one value per
+    spectrum, or a single value for all), an optional label row, then a
+    column header row ("pixel,wavenumber,processed,..."), then one row per
+    pixel with one column per spectrum.  Older exports carry the labels in
+    the header row itself ("Wavelength,<label>,<label>,...").
+
+    The file is tokenized in place in a single pass, transposing each column
+    into its own Measurement, labeled from the label (or header) row.  If a
+    file has no wavenumber column, x is computed from its wavelength column
+    (or from pixel, via the CCD C0..C3 wavelength calibration) and the
+    "Laser Wavelength" row.  Dark and reference columns are skipped, as is
+    any column with missing values.
+
+    This replaces scripts/split-spectra.py, without intermediate files.
+*/
+class ExportFile
+{
+    public:
+        std::vector<std::unique_ptr<Measurement>> measurements;
+
+        //! true if contents look like a multi-spectrum export, rather than
+        //! a single column-ordered spectrum, or an ENLIGHTEN save of one
+        //! spectrum ("Pixel,Wavelength,Wavenumber,Processed,Raw,..."), which
+        //! Measurement reads
+        static bool isExport(const std::string& contents);
+
+        //! parse an export file already read into memory
+        //! @throws std::runtime_error if it has no usable x-axis
+        ExportFile(const std::wstring& pathname, const std::string& contents);
+};
+
+#endif
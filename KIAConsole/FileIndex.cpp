@@ -0,0 +1,251 @@
+#include "pch.h"
+
+#include "FileIndex.h"
+
+#include "Util.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+
+namespace
+{
+    struct Index
+    {
+        FILE* f = nullptr;
+        wstring pathname;
+        std::unordered_map<wstring, FileIndex::Entry> entries;
+        long skipped = 0;
+        std::mutex mut;
+    };
+
+    Index s_index;
+
+    FILE* openFile(const wstring& pathname, const wchar_t* mode)
+    {
+#ifdef _WIN32
+        return _wfopen(pathname.c_str(), mode);
+#else
+        return fopen(Util::toString(pathname).c_str(), Util::toString(mode).c_str());
+#endif
+    }
+
+    //! write contents to a temporary file beside pathname, flush it to disk,
+    //! then rename it over pathname, so the old index survives any failure
+    bool replaceFile(const wstring& pathname, const string& contents)
+    {
+        const wstring temp = pathname + L".tmp";
+        FILE* f = openFile(temp, L"wb");
+        if (!f)
+            return false;
+
+        bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size() && fflush(f) == 0;
+#ifdef _WIN32
+        ok = ok && _commit(_fileno(f)) == 0;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && MoveFileExW(temp.c_str(), pathname.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!ok)
+            _wremove(temp.c_str());
+#else
+        ok = ok && fsync(fileno(f)) == 0;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(Util::toString(temp).c_str(), Util::toString(pathname).c_str()) == 0;
+        if (!ok)
+            remove(Util::toString(temp).c_str());
+#endif
+        return ok;
+    }
+
+    //! one "hash size mtime path" line, without its newline
+    void appendLine(string& out, const wstring& pathname, const FileIndex::Entry& entry)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%016" PRIx64 "\t%" PRIu64 "\t%" PRId64 "\t", entry.hash, entry.size, entry.mtime);
+        out += buf;
+        Util::appendUtf8(out, pathname.c_str());
+    }
+
+    //! parse one line into the index
+    //! @returns false if it is malformed
+    bool loadLine(const char* p, const char* end)
+    {
+        FileIndex::Entry entry;
+        char* q;
+        entry.hash = strtoull(p, &q, 16);
+        if (q == p || q >= end || *q != '\t')
+            return false;
+        p = q + 1;
+        entry.size = strtoull(p, &q, 10);
+        if (q == p || q >= end || *q != '\t')
+            return false;
+        p = q + 1;
+        entry.mtime = strtoll(p, &q, 10);
+        if (q == p || q >= end || *q != '\t' || q + 1 >= end)
+            return false;
+        p = q + 1;
+
+        wstring pathname;
+        Util::appendWide(pathname, p, end - p);
+        s_index.entries[pathname] = entry;
+        return true;
+    }
+
+    //! FNV-1a, a word at a time
+    uint64_t hashContents(const string& contents)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        const char* p = contents.data();
+        size_t n = contents.size();
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            uint64_t w;
+            memcpy(&w, p, sizeof(w));
+            h = (h ^ w) * 0x100000001b3ULL;
+            h ^= h >> 29;
+        }
+        for (; n > 0; p++, n--)
+            h = (h ^ (unsigned char) *p) * 0x100000001b3ULL;
+        return h ^ contents.size();
+    }
+}
+
+bool FileIndex::open(const wstring& pathname)
+{
+    std::lock_guard<std::mutex> lock(s_index.mut);
+
+    string contents;
+    Util::readFile(pathname, contents);
+
+    size_t lines = 0;
+    const char* p = contents.data();
+    const char* end = p + contents.size();
+    while (p < end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol || !loadLine(p, eol))
+        {
+            Util::log(L"ERROR: dropping incomplete entries from %ls", pathname.c_str());
+            break;
+        }
+        lines++;
+        p = eol + 1;
+    }
+
+    // compact superseded (or torn) lines away, else just append
+    if (p != end || lines != s_index.entries.size())
+    {
+        string compacted;
+        for (const auto& e : s_index.entries)
+        {
+            appendLine(compacted, e.first, e.second);
+            compacted += '\n';
+        }
+        if (!replaceFile(pathname, compacted))
+        {
+            Util::log(L"ERROR: unable to compact file index %ls", pathname.c_str());
+            s_index.entries.clear();
+            return false;
+        }
+    }
+    s_index.f = openFile(pathname, L"ab");
+
+    if (!s_index.f)
+    {
+        Util::log(L"ERROR: unable to open file index %ls", pathname.c_str());
+        s_index.entries.clear();
+        return false;
+    }
+
+    s_index.pathname = pathname;
+    Util::log(L"Loaded %u processed files from %ls", (unsigned) s_index.entries.size(), pathname.c_str());
+    return true;
+}
+
+void FileIndex::close()
+{
+    std::lock_guard<std::mutex> lock(s_index.mut);
+    if (!s_index.f)
+        return;
+
+    Util::log(L"File index: skipped %ld files already processed, %u files in %ls",
+        s_index.skipped, (unsigned) s_index.entries.size(), s_index.pathname.c_str());
+    fclose(s_index.f);
+    s_index.f = nullptr;
+}
+
+bool FileIndex::isOpen()
+{
+    return s_index.f != nullptr;
+}
+
+bool FileIndex::unchanged(const wstring& pathname, Entry& entry)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_wstat64(pathname.c_str(), &st) != 0)
+        return false;
+    entry.mtime = (int64_t) st.st_mtime;
+#else
+    struct stat st;
+    if (stat(Util::toString(pathname).c_str(), &st) != 0)
+        return false;
+    entry.mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    entry.size = (uint64_t) st.st_size;
+    entry.hash = 0;
+
+    std::lock_guard<std::mutex> lock(s_index.mut);
+    auto it = s_index.entries.find(pathname);
+    if (it == s_index.entries.end() || it->second.size != entry.size || it->second.mtime != entry.mtime)
+        return false;
+    s_index.skipped++;
+    return true;
+}
+
+bool FileIndex::claim(const wstring& pathname, Entry& entry, const string& contents)
+{
+    entry.hash = hashContents(contents);
+
+    std::lock_guard<std::mutex> lock(s_index.mut);
+    Entry& known = s_index.entries[pathname];
+    bool same = known.hash == entry.hash;
+    if (same && (known.size != entry.size || known.mtime != entry.mtime))
+    {
+        // touched, not changed: remember the new mtime, so next time it isn't even read
+        string line;
+        appendLine(line, pathname, entry);
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), s_index.f);
+        fflush(s_index.f);
+    }
+    known = entry;
+    if (same)
+        s_index.skipped++;
+    return !same;
+}
+
+void FileIndex::commit(const wstring& pathname, const Entry& entry)
+{
+    string line;
+    appendLine(line, pathname, entry);
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(s_index.mut);
+    fwrite(line.data(), 1, line.size(), s_index.f);
+    fflush(s_index.f);
+}
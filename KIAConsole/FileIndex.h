@@ -0,0 +1,55 @@
+#ifndef KIACONSOLE_FILE_INDEX_H
+#define KIACONSOLE_FILE_INDEX_H
+
+#include "pch.h"
+
+#include <cstdint>
+#include <string>
+
+/*! @brief Persistent record of the files already processed (--index).
+
+    Lets --watch skip files it handled before a restart, and lets a long
+    --directory run resume where it left off after a crash.  Each processed
+    file is recorded with its size, modification time and a 64-bit hash of
+    its contents.  A file whose size and mtime are unchanged is skipped
+    without being read; one whose size or mtime changed is read, and skipped
+    if its contents hash the same (e.g. it was merely touched or copied over
+    itself).
+
+    The index is a UTF-8 text file, one line per file ("hash size mtime
+    path", tab-separated), appended and flushed as each file's results are
+    written, so a crash loses at most the files in flight.  Later lines for a
+    path supersede earlier ones; the file is compacted when opened, and a
+    torn last line is dropped.
+
+    Files are claimed when read, so one arriving twice while the first copy
+    is still being searched is only searched once.
+*/
+class FileIndex
+{
+    public:
+        struct Entry
+        {
+            uint64_t size = 0;
+            int64_t mtime = 0;              //!< ns since the epoch (seconds on Windows)
+            uint64_t hash = 0;              //!< of the contents (0 until read)
+        };
+
+        //! load (or create) the index file
+        static bool open(const std::wstring& pathname);
+        static void close();                //!< log how many files were skipped
+        static bool isOpen();
+
+        //! stat pathname into entry
+        //! @returns true if it was already processed, unchanged (so needn't be read)
+        static bool unchanged(const std::wstring& pathname, Entry& entry);
+
+        //! hash the contents just read into entry, and claim the file
+        //! @returns false if it was already processed (or claimed) with the same contents
+        static bool claim(const std::wstring& pathname, Entry& entry, const std::string& contents);
+
+        //! record a claimed file as processed
+        static void commit(const std::wstring& pathname, const Entry& entry);
+};
+
+#endif
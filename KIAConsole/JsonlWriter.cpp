@@ -0,0 +1,176 @@
+#include "pch.h"
+
+#include "JsonlWriter.h"
+
+#include "Util.h"
+
+#include <charconv>
+#include <cmath>
+
+using std::string;
+
+static FILE* s_file = nullptr;
+static bool s_flushEachRecord = false;
+static thread_local string* s_capture = nullptr;
+
+void JsonlWriter::open(FILE* f, bool flushEachRecord)
+{
+    s_file = f;
+    s_flushEachRecord = flushEachRecord;
+}
+
+void JsonlWriter::close()
+{
+    if (s_file && s_file != stdout && s_file != stderr)
+        fclose(s_file);
+    else if (s_file)
+        fflush(s_file);
+    s_file = nullptr;
+}
+
+bool JsonlWriter::isOpen()
+{
+    return s_file != nullptr;
+}
+
+void JsonlWriter::beginCapture(string* buffer)
+{
+    s_capture = buffer;
+}
+
+void JsonlWriter::endCapture()
+{
+    s_capture = nullptr;
+}
+
+void JsonlWriter::print(const string& records)
+{
+    if (!s_file || records.empty())
+        return;
+    fwrite(records.data(), 1, records.size(), s_file);
+    if (s_flushEachRecord)
+        fflush(s_file);
+}
+
+//! append s as a quoted, escaped JSON string (UTF-8)
+void JsonlWriter::appendString(string& out, const wchar_t* s)
+{
+    static const char* HEX = "0123456789abcdef";
+
+    out += '"';
+    while (s && *s)
+    {
+        // escape ASCII specials, and pass everything else through appendUtf8
+        wchar_t c = *s;
+        if (c == L'"' || c == L'\\')
+        {
+            out += '\\';
+            out += (char) c;
+            s++;
+        }
+        else if (c < 0x20)
+        {
+            out += "\\u00";
+            out += HEX[(c >> 4) & 0xf];
+            out += HEX[c & 0xf];
+            s++;
+        }
+        else if (c < 0x80)
+        {
+            out += (char) c;
+            s++;
+        }
+        else
+        {
+            // one code point (or surrogate pair) at a time
+            wchar_t cp[3] = { c, 0, 0 };
+            if (c >= 0xd800 && c <= 0xdbff && s[1])
+                cp[1] = *++s;
+            s++;
+            Util::appendUtf8(out, cp);
+        }
+    }
+    out += '"';
+}
+
+//! append the shortest round-trippable representation of value
+void JsonlWriter::appendNumber(string& out, double value)
+{
+    if (!std::isfinite(value))
+    {
+        out += "null";
+        return;
+    }
+
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+void JsonlWriter::write(const Measurement& m, int pixels, const SearchSDK_Match* matches, int matchCount, double elapsedSec, bool timedOut, bool reused, bool local, const wchar_t* rejected)
+{
+    if (!s_file)
+        return;
+
+    static thread_local string record;
+    record.clear();
+
+    int validCount = 0;
+    for (int i = 0; i < matchCount; i++)
+        if (matches[i].m_matchPercentage >= m.min_confidence)
+            validCount++;
+
+    record += "{\"pathname\":";
+    if (m.pathname.empty())
+        record += "null";
+    else
+        appendString(record, m.pathname.c_str());
+
+    record += ",\"request_id\":";
+    if (m.request_id < 0)
+        record += "null";
+    else
+        appendNumber(record, (double) m.request_id);
+
+    record += ",\"label\":";
+    if (m.label.empty())
+        record += "null";
+    else
+        appendString(record, m.label.c_str());
+
+    record += ",\"pixels\":";
+    appendNumber(record, (double) pixels);
+    record += ",\"elapsed_sec\":";
+    appendNumber(record, elapsedSec);
+    record += ",\"min_confidence\":";
+    appendNumber(record, m.min_confidence);
+    record += ",\"valid_count\":";
+    appendNumber(record, validCount);
+    record += timedOut ? ",\"timed_out\":true" : ",\"timed_out\":false";
+    record += reused ? ",\"reused\":true" : ",\"reused\":false";
+    record += local ? ",\"local\":true" : ",\"local\":false";
+    record += ",\"rejected\":";
+    if (!rejected)
+        record += "null";
+    else
+        appendString(record, rejected);
+
+    record += ",\"matches\":[";
+    for (int i = 0; i < matchCount; i++)
+    {
+        const SearchSDK_Match& match = matches[i];
+        if (i)
+            record += ',';
+        record += "{\"name\":";
+        appendString(record, match.m_matchName);
+        record += ",\"percentage\":";
+        appendNumber(record, match.m_matchPercentage);
+        record += match.m_bLocked ? ",\"locked\":true}" : ",\"locked\":false}";
+    }
+    record += "]}\n";
+
+    if (s_capture)
+        *s_capture += record;
+    else
+        print(record);
+}
@@ -0,0 +1,56 @@
+#ifndef KIACONSOLE_JSONL_WRITER_H
+#define KIACONSOLE_JSONL_WRITER_H
+
+#include "pch.h"
+
+#include "SearchSDK.h"
+#include "Measurement.h"
+
+#include <cstdio>
+#include <string>
+
+/*! @brief Machine-readable JSON Lines output of search results (--output jsonl).
+
+    Writes one record per measurement, e.g.
+
+    \code
+    {"pathname":"data/good/Acetone-01.csv","request_id":null,"label":"Acetone","pixels":1024,"elapsed_sec":0.25,"min_confidence":0.6,
+     "valid_count":1,"timed_out":false,"reused":false,"local":false,"rejected":null,"matches":[{"name":"Acetone","percentage":0.93,"locked":false}]}
+    \endcode
+
+    (on a single line).  pathname is null for streamed measurements, and
+    request_id for all but numbered streamed requests.  label is
+    null unless the file gave one (export files hold many labeled spectra), and
+    timed_out is true if the search was canceled at its deadline, and reused
+    if the result was that of a recent near-identical spectrum, and local
+    if it came from the LocalMatcher's reference spectra.  rejected names
+    the QualityGate check a spectrum failed (e.g. "low_range"), in which
+    case it wasn't searched, and has no matches.  Every
+    match SearchSDK returned is included, whether or not it met min_confidence,
+    so consumers can apply their own threshold.
+
+    Records are formatted into a reused per-thread buffer and written with a
+    single fwrite, so there is no per-match allocation.  Like Util::log, a
+    thread may capture its records instead, to keep parallel output in order.
+*/
+class JsonlWriter
+{
+    public:
+        static void open(FILE* f, bool flushEachRecord);
+        static void close();
+        static bool isOpen();
+
+        //! @param pixels  searched (m's own x and y may not have been)
+        static void write(const Measurement& m, int pixels, const SearchSDK_Match* matches, int matchCount, double elapsedSec,
+                          bool timedOut = false, bool reused = false, bool local = false, const wchar_t* rejected = nullptr);
+
+        static void beginCapture(std::string* buffer);
+        static void endCapture();
+        static void print(const std::string& records);  //!< write captured records
+
+    private:
+        static void appendString(std::string& out, const wchar_t* s);
+        static void appendNumber(std::string& out, double value);
+};
+
+#endif
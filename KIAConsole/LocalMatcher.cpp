@@ -0,0 +1,307 @@
+#include "pch.h"
+
+#include "LocalMatcher.h"
+
+#include "DirectoryWalker.h"
+#include "ExportFile.h"
+#include "Resampler.h"
+#include "Simd.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cwctype>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using std::wstring;
+using std::vector;
+
+//! the fingerprint grid (cm-1)
+static const double GRID_FIRST = 400;
+static const double GRID_LAST = 1800;
+static const double GRID_SPACING = 2;
+static const int GRID_POINTS = 701;
+static const int FEATURES = GRID_POINTS - 1;            //!< differences
+static const int STRIDE = (FEATURES + 7) / 8 * 8;       //!< padded to whole AVX2 registers
+
+static struct
+{
+    bool loaded = false;
+    vector<float> rows;                 //!< one fingerprint per reference, STRIDE apart
+    vector<int> compoundOf;             //!< by reference
+    vector<wstring> names;              //!< by compound
+} s_refs;
+
+static Resampler::Settings gridSettings()
+{
+    Resampler::Settings settings;
+    settings.spacing = GRID_SPACING;
+    settings.roiFirst = GRID_FIRST;
+    settings.roiLast = GRID_LAST;
+    return settings;
+}
+
+//! reduce m to a unit-length, mean-centered first difference on the grid
+//! @param out  STRIDE floats (the padding zeroed)
+//! @returns false if m doesn't cover the grid
+static bool fingerprint(const SpectrumView& m, Resampler& resampler, vector<double>& work, float* out)
+{
+    SpectrumView grid;
+    if (!resampler.resample(m, grid) || grid.pixels != GRID_POINTS || std::fabs(grid.x[0] - GRID_FIRST) > 1e-6)
+        return false;
+
+    work.resize(FEATURES);
+    double mean = 0;
+    for (int i = 0; i < FEATURES; i++)
+    {
+        work[i] = grid.y[i + 1] - grid.y[i];
+        mean += work[i];
+    }
+    mean /= FEATURES;
+
+    double norm = 0;
+    for (int i = 0; i < FEATURES; i++)
+    {
+        work[i] -= mean;
+        norm += work[i] * work[i];
+    }
+    if (!(norm > 0))
+        return false;
+
+    const double scale = 1 / std::sqrt(norm);
+    for (int i = 0; i < FEATURES; i++)
+        out[i] = (float) (work[i] * scale);
+    std::fill(out + FEATURES, out + STRIDE, 0.0f);
+    return true;
+}
+
+//! the compound a reference file holds: "Acetone-01.csv" -> "Acetone"
+static wstring labelFromPathname(const wstring& pathname)
+{
+    size_t slash = pathname.find_last_of(L"/\\");
+    wstring name = pathname.substr(slash == wstring::npos ? 0 : slash + 1);
+    size_t dot = name.rfind(L'.');
+    if (dot != wstring::npos)
+        name.erase(dot);
+
+    size_t end = name.size();
+    while (end > 0 && iswdigit(name[end - 1]))
+        end--;
+    if (end < name.size() && end > 0 && (name[end - 1] == L'-' || name[end - 1] == L'_' || name[end - 1] == L' '))
+        name.erase(end - 1);
+    return name;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+
+// Both sum eight lanes the same way, so give identical scores.
+
+static float sumLanes(const float* lanes)
+{
+    float sum = 0;
+    for (int l = 0; l < 8; l++)
+        sum += lanes[l];
+    return sum;
+}
+
+static float dotScalar(const float* a, const float* b)
+{
+    float lanes[8] = {};
+    for (int i = 0; i < STRIDE; i += 8)
+        for (int l = 0; l < 8; l++)
+            lanes[l] += a[i + l] * b[i + l];
+    return sumLanes(lanes);
+}
+
+#ifdef KIACONSOLE_AVX2
+
+AVX2_TARGET static float dotAvx2(const float* a, const float* b)
+{
+    __m256 acc = _mm256_setzero_ps();
+    for (int i = 0; i < STRIDE; i += 8)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, acc);
+    return sumLanes(lanes);
+}
+
+#else
+
+static float dotAvx2(const float* a, const float* b)
+{
+    return dotScalar(a, b);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// LocalMatcher
+////////////////////////////////////////////////////////////////////////////////
+
+bool LocalMatcher::load(const wstring& directory)
+{
+    s_refs = {};
+
+    Resampler resampler(gridSettings());
+    vector<double> work;
+    vector<float> row(STRIDE);
+    std::unordered_map<wstring, int> compounds;
+    int skipped = 0;
+
+    // Measurement logs as it parses; keep that out of the way
+    wstring sink;
+    Util::beginCapture(&sink);
+    for (const wstring& pathname : DirectoryWalker(directory, L"*.csv").list(true))
+    {
+        vector<std::unique_ptr<Measurement>> loaded;
+        std::string contents;
+        bool exported = false;
+        try
+        {
+            if (!Util::readFile(pathname, contents))
+                throw std::runtime_error("unable to read file");
+            exported = ExportFile::isExport(contents);
+            if (exported)
+                loaded = std::move(ExportFile(pathname, contents).measurements);
+            else
+                loaded.emplace_back(new Measurement(pathname, contents));
+        }
+        catch (std::exception&)
+        {
+            skipped++;
+            continue;
+        }
+
+        // a file holds one compound, named by the file (the label rows of
+        // ENLIGHTEN's single-spectrum files are free text, "Acetone 10x50ms");
+        // an export's spectra are named by their labels
+        for (auto& m : loaded)
+        {
+            if (!m->isValid() || !fingerprint(m->view(), resampler, work, row.data()))
+            {
+                skipped++;
+                continue;
+            }
+            s_refs.rows.insert(s_refs.rows.end(), row.begin(), row.end());
+
+            wstring label = exported && !m->label.empty() ? m->label : labelFromPathname(pathname);
+            auto it = compounds.find(label);
+            if (it == compounds.end())
+            {
+                it = compounds.emplace(label, (int) s_refs.names.size()).first;
+                s_refs.names.push_back(label);
+            }
+            s_refs.compoundOf.push_back(it->second);
+        }
+    }
+    Util::endCapture();
+
+    if (s_refs.compoundOf.empty())
+    {
+        Util::log(L"ERROR: no usable reference spectra (covering %.0lf-%.0lf cm-1) in %ls",
+            GRID_FIRST, GRID_LAST, directory.c_str());
+        return false;
+    }
+
+    s_refs.loaded = true;
+    Util::log(L"Loaded %d reference spectra of %d compounds from %ls (%d skipped)",
+        referenceCount(), compoundCount(), directory.c_str(), skipped);
+    return true;
+}
+
+bool LocalMatcher::isLoaded()
+{
+    return s_refs.loaded;
+}
+
+int LocalMatcher::match(const SpectrumView& m, Hit* top, int k)
+{
+    if (!s_refs.loaded || k < 1)
+        return 0;
+
+    // per-thread scratch, so any number of sessions can match at once
+    thread_local Resampler resampler(gridSettings());
+    thread_local vector<double> work;
+    thread_local vector<float> query(STRIDE);
+    thread_local vector<double> best;
+    thread_local vector<Hit> heap;
+
+    if (!fingerprint(m, resampler, work, query.data()))
+        return 0;
+
+    // each compound scores as its best reference
+    const bool avx2 = Simd::haveAvx2();
+    const int references = referenceCount();
+    best.assign(s_refs.names.size(), 0.0);
+    for (int r = 0; r < references; r++)
+    {
+        const float* row = &s_refs.rows[(size_t) r * STRIDE];
+        const double correlation = avx2 ? dotAvx2(query.data(), row) : dotScalar(query.data(), row);
+        const double score = correlation > 0 ? std::min(correlation * correlation, 1.0) : 0;   // float rounding may exceed 1
+        double& b = best[s_refs.compoundOf[r]];
+        if (score > b)
+            b = score;
+    }
+
+    // keep the best k in a min-heap (its front the worst kept)
+    auto better = [](const Hit& a, const Hit& b) { return a.score > b.score; };
+    heap.clear();
+    for (int c = 0; c < (int) best.size(); c++)
+    {
+        if ((int) heap.size() < k)
+        {
+            heap.push_back(Hit());
+            heap.back().compound = c;
+            heap.back().score = best[c];
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (best[c] > heap.front().score)
+        {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back().compound = c;
+            heap.back().score = best[c];
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+
+    std::copy(heap.begin(), heap.end(), top);
+    return (int) heap.size();
+}
+
+const wchar_t* LocalMatcher::name(int compound)
+{
+    return s_refs.names[compound].c_str();
+}
+
+bool LocalMatcher::sameName(const wchar_t* a, const wchar_t* b)
+{
+    auto ignored = [](wchar_t c) { return iswspace(c) || c == L'_'; };
+    while (true)
+    {
+        while (*a && ignored(*a))
+            a++;
+        while (*b && ignored(*b))
+            b++;
+        if (!*a || !*b)
+            return !*a && !*b;
+        if (towlower(*a++) != towlower(*b++))
+            return false;
+    }
+}
+
+int LocalMatcher::compoundCount()
+{
+    return (int) s_refs.names.size();
+}
+
+int LocalMatcher::referenceCount()
+{
+    return (int) s_refs.compoundOf.size();
+}
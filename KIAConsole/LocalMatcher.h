@@ -0,0 +1,65 @@
+#ifndef KIACONSOLE_LOCAL_MATCHER_H
+#define KIACONSOLE_LOCAL_MATCHER_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+
+#include <string>
+
+/*! @brief In-process pre-screen of spectra against a small set of labeled
+           reference spectra (--references).
+
+    Most spectra identified in production are of the same couple of dozen
+    compounds, yet each pays for a full KnowItAll database search.  Given a
+    directory of labeled CSV files (like data/good), each is reduced to a
+    fingerprint, and held in one contiguous float32 array; a spectrum is
+    then scored against every reference in well under a millisecond, and if
+    its best compound is a confident, clear winner (see SearchSession::
+    matchLocally), that result is returned without searching at all.
+
+    A fingerprint is the spectrum resampled onto 2 cm-1 from 400 to 1800
+    cm-1, differenced (which flattens broad fluorescence backgrounds), mean
+    centered and scaled to unit length.  The score of a spectrum against a
+    reference is then the square of their correlation (0 for negative
+    correlation), the hit quality index KnowItAll reports, as a fraction.
+    Each compound scores as its best reference.  References are named by
+    file, less any trailing "-01" style replicate number (their Label rows
+    are free text), and spectra in an export file by its label row.  Spectra not
+    covering the whole range can't be fingerprinted, and always fall through
+    to SearchSDK.
+
+    Scoring uses AVX2 where the CPU has it (see Simd), and picks the best
+    compounds with a bounded heap.  Loaded once at startup, then read-only,
+    so safe to match from any number of threads.
+*/
+class LocalMatcher
+{
+    public:
+        struct Hit
+        {
+            int compound = -1;
+            double score = 0;           //!< squared correlation (0 - 1)
+        };
+
+        //! fingerprint every CSV under directory
+        //! @returns false if none could be
+        static bool load(const std::wstring& directory);
+        static bool isLoaded();
+
+        //! score m against every reference
+        //! @param top  the best k compounds, best first
+        //! @returns how many hits were filled in (0 if m couldn't be fingerprinted)
+        static int match(const SpectrumView& m, Hit* top, int k);
+
+        static const wchar_t* name(int compound);
+
+        //! true if a and b name the same compound, ignoring case, whitespace
+        //! and underscores (reference names come from file names, which
+        //! can't hold KnowItAll's own spelling); synonyms still differ
+        static bool sameName(const wchar_t* a, const wchar_t* b);
+        static int compoundCount();
+        static int referenceCount();
+};
+
+#endif
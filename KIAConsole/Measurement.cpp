@@ -2,25 +2,92 @@
 
 #include "Measurement.h"
 
+#include "BinaryProtocol.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <istream>
-#include <fstream>
 
 using std::string;
 using std::wstring;
 using std::istream;
-using std::ifstream;
-using std::iostream;
 using std::runtime_error;
+using std::chrono::steady_clock;
+
+//! sanity limit, so a request can't have us allocate without bound
+static const int MAX_PIXELS = 1 << 20;
+
+//! true for the characters Util::trim would strip
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+//! case-insensitive comparison of [begin, end) against a lower-case literal
+static bool iequals(const char* begin, const char* end, const char* lower)
+{
+    for (; begin < end && *lower; begin++, lower++)
+        if (tolower((unsigned char) *begin) != *lower)
+            return false;
+    return begin == end && !*lower;
+}
+
+static bool startswith(const char* begin, const char* end, const char* prefix)
+{
+    size_t len = strlen(prefix);
+    return (size_t)(end - begin) >= len && 0 == memcmp(begin, prefix, len);
+}
+
+//! parse a double in place (skipping leading whitespace, like stod)
+static double parseDouble(const char* begin, const char* end)
+{
+    while (begin < end && isSpace(*begin))
+        begin++;
+    if (begin < end && *begin == '+')
+        begin++;
+
+    double value = 0;
+    if (std::from_chars(begin, end, value).ec != std::errc())
+        throw runtime_error(Util::sstring("invalid number: %s", string(begin, end).c_str()));
+    return value;
+}
+
+//! parse an int in place (returning 0 on failure, like atoi)
+static int parseInt(const char* begin, const char* end)
+{
+    while (begin < end && isSpace(*begin))
+        begin++;
+    if (begin < end && *begin == '+')
+        begin++;
+
+    int value = 0;
+    if (std::from_chars(begin, end, value).ec != std::errc())
+        return 0;
+    return value;
+}
 
 Measurement::Measurement(const wstring& pathname)
     : pathname(pathname)
 {
-    ifstream infile(pathname);
-    load(infile);
+    // read the whole file at once into a per-thread buffer, then tokenize in place
+    static thread_local string contents;
+    auto start = steady_clock::now();
+
+    Util::readFile(pathname, contents);
+    load(contents.data(), contents.data() + contents.size());
+    loadTime = steady_clock::now() - start;
+}
+
+Measurement::Measurement(const wstring& pathname, const string& contents)
+    : pathname(pathname)
+{
+    auto start = steady_clock::now();
+    load(contents.data(), contents.data() + contents.size());
+    loadTime = steady_clock::now() - start;
 }
 
 Measurement::Measurement()
@@ -28,105 +95,317 @@ Measurement::Measurement()
     load(std::cin);
 }
 
+Measurement::Measurement(istream& is)
+{
+    load(is);
+}
+
+Measurement::Measurement(int pixels)
+{
+    resize(pixels);
+}
+
+void Measurement::resize(int pixels)
+{
+    this->pixels = pixels;
+    x.resize(pixels);
+    y.resize(pixels);
+    valid = true;
+}
+
+//! parse a complete file image, line by line
+void Measurement::load(const char* begin, const char* end)
+{
+    reset();
+
+    const char* p = begin;
+    bool more = true;
+    while (more && p < end)
+    {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+        more = parseLine(p, eol);
+        p = eol < end ? eol + 1 : end;
+    }
+
+    if (!isQuit)
+        finish();
+}
+
+//! parse streamed lines until the request is complete
 void Measurement::load(istream& is)
+{
+    static thread_local string line;
+
+    reset();
+
+    bool more = true;
+    bool any = false;
+    steady_clock::time_point start;
+    while (more && std::getline(is, line))
+    {
+        // don't count time spent waiting for the client to send a request
+        if (!any)
+            start = steady_clock::now();
+        any = true;
+        more = parseLine(line.data(), line.data() + line.size());
+    }
+
+    if (!any)
+    {
+        Util::log(L"EOF received...shutting down");
+        isQuit = true;
+    }
+
+    if (!isQuit && !isStats)
+        finish();
+
+    if (any)
+        loadTime = steady_clock::now() - start;
+}
+
+void Measurement::reset()
 {
     valid = false;
+    rejected = false;
+    discarded = 0;
+    linecount = -1;
+    using_markers = false;
+    xColumn = 0;
+    yColumn = 1;
+}
 
-    char buf[256];
-    int linecount = -1;
-    bool using_markers = false;
-
-    while (true)
-    {
-        // read the next line
-        is.getline(buf, sizeof(buf));
-        string line(buf);
-        Util::trim(line);
-
-        linecount++;
-
-        // WHY do I have to convert the line to wstring before calling vwprintf?
-        // Docs say %s should work with narrow string...
-        //
-        // Util::log(L"read line [%04d / %d]: [%s]", linecount, pixels, Util::toWstring(line.c_str()).c_str());
-        
-        // skip blanks and comments
-        if (line.size() == 0 || line[0] == '#' || line[0] == '/')
-            continue;
-
-        // streaming data uses start/end markers to ease debugging (not required,
-        // as not found in CSV files).  If we do find a start marker, expect to 
-        // close on an end-marker (otherwise, stop when we've read the expected
-        // number of pixels).
-        if (linecount == 0 && Util::startswith(line, "REQUEST_START"))
-        {
-            using_markers = true;
-            continue;
-        }
-        else if (using_markers && Util::startswith(line, "REQUEST_END"))
-        {
-            break;
-        }
-        else if (Util::startswith(line, "QUIT"))
-        {
-            Util::log(L"QUIT received...shutting down");
-            isQuit = true;
-            return;
-        }
+//! [begin, end) of the column'th comma-delimited field of a line
+//! @returns false if there are fewer fields
+static bool findField(const char* begin, const char* end, int column, const char*& field, const char*& fieldEnd)
+{
+    for (; column > 0; column--)
+    {
+        const char* comma = static_cast<const char*>(memchr(begin, ',', end - begin));
+        if (!comma)
+            return false;
+        begin = comma + 1;
+    }
+    const char* comma = static_cast<const char*>(memchr(begin, ',', end - begin));
+    field = begin;
+    fieldEnd = comma ? comma : end;
+    return true;
+}
+
+/*! Read an ENLIGHTEN column header ("Pixel,Wavelength,Wavenumber,Processed,
+    Raw,Dark,Reference"), taking x from its wavenumber column and y from its
+    processed column (else raw).  Headers without both leave the first two
+    columns in use.
+*/
+void Measurement::selectColumns(const char* begin, const char* end)
+{
+    const char* field;
+    const char* fieldEnd;
+    if (!findField(begin, end, 0, field, fieldEnd) || !(iequals(field, fieldEnd, "pixel")
+        || iequals(field, fieldEnd, "wavelength") || iequals(field, fieldEnd, "wavenumber")))
+        return;
+
+    int wavenumber = -1, processed = -1, raw = -1;
+    for (int i = 0; findField(begin, end, i, field, fieldEnd); i++)
+    {
+        while (field < fieldEnd && isSpace(*field))
+            field++;
+        while (fieldEnd > field && isSpace(fieldEnd[-1]))
+            fieldEnd--;
+
+        if (wavenumber < 0 && iequals(field, fieldEnd, "wavenumber"))
+            wavenumber = i;
+        else if (processed < 0 && iequals(field, fieldEnd, "processed"))
+            processed = i;
+        else if (raw < 0 && iequals(field, fieldEnd, "raw"))
+            raw = i;
+    }
+
+    if (wavenumber >= 0 && (processed >= 0 || raw >= 0))
+    {
+        xColumn = wavenumber;
+        yColumn = processed >= 0 ? processed : raw;
+    }
+}
+
+/*! Parse one line of input, without copying it.
+
+    @param begin  start of line
+    @param end    end of line (exclusive, not including linefeed)
+    @returns false when the measurement is complete (or QUIT was received)
+*/
+bool Measurement::parseLine(const char* begin, const char* end)
+{
+    linecount++;
+
+    // trim
+    while (begin < end && isSpace(*begin))
+        begin++;
+    while (end > begin && isSpace(end[-1]))
+        end--;
+
+    // skip blanks and comments
+    if (begin == end || *begin == '#' || *begin == '/')
+        return true;
+
+    // streaming data uses start/end markers to ease debugging (not required,
+    // as not found in CSV files).  If we do find a start marker, expect to 
+    // close on an end-marker (otherwise, stop when we've read the expected
+    // number of pixels).
+    if (linecount == 0 && startswith(begin, end, "REQUEST_START"))
+    {
+        // optionally numbered ("REQUEST_START, 17"), letting the client keep
+        // several requests in flight
+        const char* id = begin + strlen("REQUEST_START");
+        while (id < end && (isSpace(*id) || *id == ','))
+            id++;
+        if (id < end && '0' <= *id && *id <= '9')
+            std::from_chars(id, end, request_id);
+
+        using_markers = true;
+        return true;
+    }
+    else if (using_markers && startswith(begin, end, "REQUEST_END"))
+    {
+        return false;
+    }
+    else if (startswith(begin, end, "QUIT"))
+    {
+        Util::log(L"QUIT received...shutting down");
+        isQuit = true;
+        return false;
+    }
+    else if (x.empty() && startswith(begin, end, "STATS"))
+    {
+        isStats = true;
+        return false;
+    }
 
-        // Other than unary tokens above, subsequent data is presumed to be comma-
-        // delimited and contain at least two fields.
-        std::vector<string> tokens = Util::split(line, ",");
-        if (tokens.size() < 2)
-            throw runtime_error(Util::sstring("invalid number of tokens: %d (%s)", tokens.size(), line.c_str()));
+    // Other than unary tokens above, subsequent data is presumed to be comma-
+    // delimited and contain at least two fields.  Only the first two are used.
+    const char* comma = static_cast<const char*>(memchr(begin, ',', end - begin));
+    if (!comma)
+        throw runtime_error(Util::sstring("invalid number of tokens: %d (%s)", 1, string(begin, end).c_str()));
 
-        // parse supported request metadata
-        string field = Util::toLower(tokens[0]);
-        if (field == "pixels" || field == "pixel count")
+    const char* field    = begin;
+    const char* fieldEnd = comma;
+    const char* value    = comma + 1;
+    const char* valueEnd = static_cast<const char*>(memchr(value, ',', end - value));
+    if (!valueEnd)
+        valueEnd = end;
+
+    // parse supported request metadata
+    if (iequals(field, fieldEnd, "pixels") || iequals(field, fieldEnd, "pixel count"))
+    {
+        pixels = parseInt(value, valueEnd);
+        if (pixels > MAX_PIXELS)
         {
-            pixels = atoi(tokens[1].c_str());
-            continue;
+            Util::log(L"ERROR: %d pixels is more than the %d allowed", pixels, MAX_PIXELS);
+            rejected = true;
         }
-        else if (field == "max_results")
+        else if (pixels > 0)
         {
-            max_results = atoi(tokens[1].c_str());
-            continue;
+            x.reserve(pixels);
+            y.reserve(pixels);
         }
-        else if (field == "min_confidence")
+        return true;
+    }
+    else if (iequals(field, fieldEnd, "max_results"))
+    {
+        max_results = parseInt(value, valueEnd);
+        if (max_results < 1 || max_results > BinaryProtocol::MAX_RESULTS)
         {
-            // expecting value in range (0, 100) (not 0.00 to 1.00)
-            min_confidence = stod(tokens[1]);
-            continue;
+            Util::log(L"ERROR: max_results %d is not from 1 to %d", max_results, BinaryProtocol::MAX_RESULTS);
+            rejected = true;
         }
+        return true;
+    }
+    else if (iequals(field, fieldEnd, "timeout_ms"))
+    {
+        timeout_ms = parseInt(value, valueEnd);
+        return true;
+    }
+    else if (iequals(field, fieldEnd, "label"))
+    {
+        while (value < valueEnd && isSpace(*value))
+            value++;
+        label.clear();
+        Util::appendWide(label, value, valueEnd - value);
+        return true;
+    }
+    else if (iequals(field, fieldEnd, "min_confidence"))
+    {
+        // expecting value in range (0, 100) (not 0.00 to 1.00)
+        min_confidence = parseDouble(value, valueEnd);
+        return true;
+    }
 
-        // that's all the metadata we support, so otherwise skip lines that don't
-        // start with a digit (lets us parse standard ENLIGHTEN column-ordered CSV)
-        if (!(('0' <= line[0] && line[0] <= '9') || line[0] == '-'))
-            continue;
+    // that's all the metadata we support, so otherwise skip lines that don't
+    // start with a digit (lets us parse standard ENLIGHTEN column-ordered CSV)
+    if (!(('0' <= *begin && *begin <= '9') || *begin == '-'))
+    {
+        selectColumns(begin, end);
+        return true;
+    }
 
-        // presumably we're now reading pixel data
-        x.push_back(stod(tokens[0]));
-        y.push_back(stod(tokens[1]));
+    // presumably we're now reading pixel data (in selected columns, if not the first two)
+    if ((xColumn != 0 || yColumn != 1)
+        && !(findField(begin, end, xColumn, field, fieldEnd) && findField(begin, end, yColumn, value, valueEnd)))
+        throw runtime_error(Util::sstring("missing column %d: %s", std::max(xColumn, yColumn) + 1, string(begin, end).c_str()));
+    if (!rejected && (int) x.size() == MAX_PIXELS)
+    {
+        Util::log(L"ERROR: more than %d pixels sent", MAX_PIXELS);
+        rejected = true;
+    }
+    if (rejected)
+        discarded++;
+    else
+    {
+        x.push_back(parseDouble(field, fieldEnd));
+        y.push_back(parseDouble(value, valueEnd));
+    }
 
-        if (!using_markers && x.size() == pixels)
-        {
-            Util::log(L"Read expected %d pixels", pixels); // matched by KIAWrapper
-            break;
-        }
+    if (!using_markers && (int) x.size() + discarded == pixels)
+    {
+        Util::log(L"Read expected %d pixels", pixels); // matched by KIAWrapper
+        return false;
     }
+    return true;
+}
 
+void Measurement::finish()
+{
     Util::log(L"Finished loading measurement");
-    if (pixels == x.size())
+    if (rejected)
+    {
+        // leave nothing to search
+        x.clear();
+        y.clear();
+        Util::log(L"Measurement invalid; request rejected");
+    }
+    else if (pixels == (int) x.size())
     {
         Util::log(L"Measurement valid (found expected %d pixels)", pixels);
         valid = true;
     }
     else
     {
-        Util::log(L"Measurement invalid; read %d of %d pixels", x.size(), pixels);
+        Util::log(L"Measurement invalid; read %d of %d pixels", (int) x.size(), pixels);
     }
 }
 
+SpectrumView Measurement::view() const
+{
+    SpectrumView v;
+    v.x = x.data();
+    v.y = y.data();
+    v.pixels = (int) std::min(x.size(), y.size());
+    v.max_results = max_results;
+    v.timeout_ms = timeout_ms;
+    return v;
+}
+
 bool Measurement::isValid() const
 {
     return valid && x.size() == y.size() && x.size() > 1;
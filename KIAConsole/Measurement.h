@@ -3,10 +3,26 @@
 
 #include "pch.h"
 
+#include <chrono>
 #include <vector>
 #include <string>
 #include <istream>
 
+/*! @brief x and y arrays held elsewhere (a Measurement, or a SharedRing slot),
+           with the search parameters that go with them.
+
+    The search path reads spectra through a view, so it can search memory it
+    doesn't own without first copying it into a Measurement.
+*/
+struct SpectrumView
+{
+    const double* x = nullptr;
+    const double* y = nullptr;
+    int pixels = 0;
+    int max_results = 20;
+    int timeout_ms = -1;                            //!< as Measurement::timeout_ms
+};
+
 //! Represents a spectral measurement which KIAConsole is asked to identify.
 //! In enlighten.KIAWrapper, this would correspond to a KIARequest.
 class Measurement
@@ -15,21 +31,48 @@ class Measurement
         int pixels = 1024;
         int max_results = 20;
         double min_confidence = 0.60;
+        int timeout_ms = -1;                        //!< search deadline (0 = none, -1 = use --timeout-ms)
+        long request_id = -1;                       //!< from "REQUEST_START, id" (-1 if unnumbered)
         std::vector<double> y;
         std::vector<double> x;
 
         std::wstring pathname;                      //!< if loaded from an external file, vs streaming
+        std::wstring label;                         //!< sample label, if the file (or request) gave one
 
 
         Measurement(const std::wstring& pathname);  //!< instantiate from an external file
+        Measurement(const std::wstring& pathname, const std::string& contents);  //!< ...already read into memory
         Measurement();                              //!< stream from stdin
+        explicit Measurement(std::istream& is);     //!< stream from elsewhere (e.g. a socket)
+        explicit Measurement(int pixels);           //!< x and y to be filled in by caller
+
+        void resize(int pixels);                    //!< presize x and y, for filling in place
+
+        SpectrumView view() const;                  //!< valid until x or y is resized
 
         bool isValid() const;
         bool isQuit = false;
+        bool isStats = false;                       //!< streamed STATS command, rather than a measurement
+
+        //! time spent reading and parsing (for streams, from the first line received)
+        std::chrono::steady_clock::duration loadTime = {};
 
     private:
         void load(std::istream& infile);
+        void load(const char* begin, const char* end);
+        void reset();
+        bool parseLine(const char* begin, const char* end);
+        void finish();
+
         bool valid = false;
+        bool rejected = false;                      //!< metadata out of bounds, so points are discarded
+        int discarded = 0;                          //!< ...and counted here instead
+        int linecount = -1;
+        bool using_markers = false;
+        int xColumn = 0;                            //!< where x and y are in each pixel row (see selectColumns)
+        int yColumn = 1;
+
+        void selectColumns(const char* begin, const char* end);
 };
 
 #endif
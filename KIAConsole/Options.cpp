@@ -3,13 +3,56 @@
 #include "Options.h"
 #include "Util.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
 using std::string;
 
 Options::Options(int argc, char** argv)
 {
     // defaults
+    valid = false;
     streaming = false;
+    binary = false;
+    asyncLog = false;
+    syncFlush = false;
+    bool syncFlushSet = false;
+    jsonl = false;
     directory = L".";
+    watch = false;
+    jobs = 1;
+    bool jobsSet = false;
+    queueDepth = 0;
+    maxInFlight = 4;
+    coalesce = 0;
+    coalesceWindow = 8;
+    coalesceVerify = false;
+    localConfidence = 0.95;
+    localMargin = 0.05;
+    localVerify = false;
+    warmUp = false;
+    cacheReset = false;
+    sorted = false;
+    maxHandleUses = 0;
+    timeoutMS = 0;
+    progressMS = 0;
+
+    // "KIAConsole pack directory corpus" compiles a corpus, and does nothing else
+    if (argc > 1 && Util::toLower(string(argv[1])) == "pack")
+    {
+        if (argc != 4)
+        {
+            printf("ERROR: pack requires directory and corpus file arguments\n");
+            usage();
+            return;
+        }
+        directory = Util::toWstring(argv[2]);
+        pack = Util::toWstring(argv[3]);
+        valid = true;
+        return;
+    }
 
     for (int i = 1; i < argc; i++)
     {
@@ -20,6 +63,46 @@ Options::Options(int argc, char** argv)
             streaming = true;
         else if (s == "--nostreaming")
             streaming = false;
+        else if (s == "--binary")
+            streaming = binary = true;
+        else if (s == "--async-log")
+            asyncLog = true;
+        else if (s == "--sync-flush")
+            syncFlush = syncFlushSet = true;
+        else if (s == "--nosync-flush")
+        {
+            syncFlush = false;
+            syncFlushSet = true;
+        }
+        else if (s == "--output")
+        {
+            string format = i + 1 < argc ? Util::toLower(string(argv[i + 1])) : "";
+            if (format == "text" || format == "jsonl")
+            {
+                i++;
+                jsonl = format == "jsonl";
+            }
+            else
+            {
+                printf("ERROR: --output requires argument 'text' or 'jsonl'\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--output-file")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                outputFile = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --output-file requires argument\n");
+                usage();
+                return;
+            }
+        }
         else if (s == "--directory")
         {
             if (i + 1 < argc)
@@ -34,6 +117,421 @@ Options::Options(int argc, char** argv)
                 return;
             }
         }
+        else if (s == "--jobs")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                i++;
+                jobs = atoi(argv[i]);
+                jobsSet = true;
+            }
+            else
+            {
+                printf("ERROR: --jobs requires positive integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--queue-depth")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                i++;
+                queueDepth = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --queue-depth requires positive integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--max-handle-uses")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            {
+                i++;
+                maxHandleUses = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --max-handle-uses requires non-negative integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--timeout-ms")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            {
+                i++;
+                timeoutMS = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --timeout-ms requires non-negative integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--progress-ms")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            {
+                i++;
+                progressMS = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --progress-ms requires non-negative integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--shm")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                shm = Util::toWstring(argv[i]);
+                streaming = binary = true;
+            }
+            else
+            {
+                printf("ERROR: --shm requires shared memory name\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--serve")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                serve = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --serve requires socket path\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--max-in-flight")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                i++;
+                maxInFlight = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --max-in-flight requires positive integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--coalesce")
+        {
+            double threshold = i + 1 < argc ? atof(argv[i + 1]) : 0;
+            if (threshold > 0 && threshold <= 1)
+            {
+                i++;
+                coalesce = threshold;
+            }
+            else
+            {
+                printf("ERROR: --coalesce requires similarity threshold in (0, 1]\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--coalesce-window")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                i++;
+                coalesceWindow = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --coalesce-window requires positive integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--coalesce-verify")
+            coalesceVerify = true;
+        else if (s == "--corpus")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                corpus = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --corpus requires argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--references")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                references = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --references requires argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--local-confidence")
+        {
+            double score = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (score >= 0 && score <= 1)
+            {
+                i++;
+                localConfidence = score;
+            }
+            else
+            {
+                printf("ERROR: --local-confidence requires score in [0, 1]\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--local-margin")
+        {
+            double score = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (score >= 0 && score <= 1)
+            {
+                i++;
+                localMargin = score;
+            }
+            else
+            {
+                printf("ERROR: --local-margin requires score in [0, 1]\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--local-verify")
+            localVerify = true;
+        else if (s == "--quality-gate")
+            quality.enabled = true;
+        else if (s == "--min-range")
+        {
+            double value = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (value >= 0)
+            {
+                i++;
+                quality.minRange = value;
+                quality.enabled = true;
+            }
+            else
+            {
+                printf("ERROR: --min-range requires non-negative intensity range (counts)\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--min-snr")
+        {
+            double value = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (value >= 0)
+            {
+                i++;
+                quality.minSnr = value;
+                quality.enabled = true;
+            }
+            else
+            {
+                printf("ERROR: --min-snr requires non-negative signal-to-noise ratio\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--saturation-level")
+        {
+            double value = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (value > 0)
+            {
+                i++;
+                quality.saturationLevel = value;
+                quality.enabled = true;
+            }
+            else
+            {
+                printf("ERROR: --saturation-level requires positive intensity (counts)\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--max-saturated")
+        {
+            double value = i + 1 < argc ? atof(argv[i + 1]) : -1;
+            if (value >= 0 && value <= 1)
+            {
+                i++;
+                quality.maxSaturated = value;
+                quality.enabled = true;
+            }
+            else
+            {
+                printf("ERROR: --max-saturated requires fraction in [0, 1]\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--despike")
+            preprocess.despike = true;
+        else if (s == "--smooth")
+        {
+            int window = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (window >= 5 && window % 2 == 1)
+            {
+                i++;
+                preprocess.smooth = window;
+            }
+            else
+            {
+                printf("ERROR: --smooth requires odd window of at least 5 pixels\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--baseline")
+        {
+            double lambda = i + 1 < argc ? atof(argv[i + 1]) : 0;
+            if (lambda > 0)
+            {
+                i++;
+                preprocess.baseline = lambda;
+            }
+            else
+            {
+                printf("ERROR: --baseline requires positive smoothness (e.g. 1e5)\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--normalize")
+            preprocess.normalize = true;
+        else if (s == "--resample")
+        {
+            double spacing = i + 1 < argc ? atof(argv[i + 1]) : 0;
+            if (spacing > 0)
+            {
+                i++;
+                resample.spacing = spacing;
+            }
+            else
+            {
+                printf("ERROR: --resample requires positive grid spacing (cm-1)\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--resample-method")
+        {
+            string method = i + 1 < argc ? Util::toLower(string(argv[i + 1])) : "";
+            if (method == "linear" || method == "cubic")
+            {
+                i++;
+                resample.method = method == "cubic" ? Resampler::CUBIC : Resampler::LINEAR;
+            }
+            else
+            {
+                printf("ERROR: --resample-method requires argument 'linear' or 'cubic'\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--bin")
+        {
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+            {
+                i++;
+                resample.bin = atoi(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --bin requires positive integer argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--roi")
+        {
+            double first = 0, last = 0;
+            if (i + 1 < argc && sscanf(argv[i + 1], "%lf,%lf", &first, &last) == 2 && last > first)
+            {
+                i++;
+                resample.roiFirst = first;
+                resample.roiLast = last;
+            }
+            else
+            {
+                printf("ERROR: --roi requires argument 'first,last' (cm-1, first < last)\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--warm-up")
+            warmUp = true;
+        else if (s == "--sorted")
+            sorted = true;
+        else if (s == "--watch")
+            watch = true;
+        else if (s == "--index")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                index = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --index requires argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--cache")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                cache = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --cache requires argument\n");
+                usage();
+                return;
+            }
+        }
+        else if (s == "--cache-reset")
+            cacheReset = true;
+        else if (s == "--library")
+        {
+            if (i + 1 < argc)
+            {
+                i++;
+                library = Util::toWstring(argv[i]);
+            }
+            else
+            {
+                printf("ERROR: --library requires argument\n");
+                usage();
+                return;
+            }
+        }
         else
         {
             printf("ERROR: unrecognized argument: %s\n", s.c_str());
@@ -41,6 +539,45 @@ Options::Options(int argc, char** argv)
             return;
         }
     }
+
+    if (jsonl && binary)
+    {
+        printf("ERROR: --output jsonl is not supported with --binary or --shm\n");
+        usage();
+        return;
+    }
+
+    if (!corpus.empty() && (streaming || !serve.empty() || watch))
+    {
+        printf("ERROR: --corpus is not supported with --streaming, --serve or --watch\n");
+        usage();
+        return;
+    }
+
+    if (watch && (streaming || !serve.empty()))
+    {
+        printf("ERROR: --watch is not supported with --streaming or --serve\n");
+        usage();
+        return;
+    }
+
+    // a watcher always keeps an index, so it can pick up where it left off
+    if (watch && index.empty())
+        index = directory + L"/.kiaconsole-index";
+
+    // a server's workers are shared by all its clients
+    if (!serve.empty() && !jobsSet)
+        jobs = std::max(1, (int) std::thread::hardware_concurrency());
+
+    // by default, keep a couple of spectra ready for each search worker
+    if (queueDepth == 0)
+        queueDepth = 2 * jobs;
+
+    // streaming clients (and anyone watching) wait on each result, so by
+    // default don't leave it queued
+    if (!syncFlushSet)
+        syncFlush = streaming || watch;
+
     valid = true;
 }
 
@@ -49,9 +586,102 @@ void Options::usage()
     printf(
         "KnowItAll Console (C) 2021, Wasatch Photonics\n\n"
         "Usage:\n"
-        "  KIAConsole [--streaming] [--directory \\path\\to\\spectra]\n\n"
+        "  KIAConsole pack \\path\\to\\spectra path\n"
+        "  KIAConsole [--streaming [--binary] [--max-in-flight n]] [--shm name] [--serve path]\n"
+        "             [--directory \\path\\to\\spectra [--sorted] [--watch] [--index path]] [--corpus path]\n"
+        "             [--jobs n [--queue-depth n]]\n"
+        "             [--max-handle-uses n] [--async-log [--[no]sync-flush]] [--library \\path\\to\\SearchSDK.dll]\n"
+        "             [--output text|jsonl [--output-file path]] [--timeout-ms n] [--progress-ms n]\n"
+        "             [--warm-up] [--cache path [--cache-reset]] [--coalesce threshold [--coalesce-window n] [--coalesce-verify]]\n"
+        "             [--references dir [--local-confidence score] [--local-margin score] [--local-verify]]\n"
+        "             [--quality-gate [--min-range n] [--min-snr n] [--saturation-level n] [--max-saturated f]]\n"
+        "             [--despike] [--smooth n] [--baseline lambda] [--normalize]\n"
+        "             [--resample spacing [--resample-method linear|cubic]] [--bin n] [--roi first,last]\n\n"
         "  --streaming   read series of (wavenumber, intensity) pairs from STDIN,\n"
         "                starting with 'PIXELS, n' to indicate following pixel count\n"
-        "  --directory   path in which to search for .csv files (defaults to current)\n\n"
+        "                (send 'STATS' to log latency statistics so far)\n"
+        "  --max-in-flight  numbered requests ('REQUEST_START, id') to search at\n"
+        "                once when streaming, each on its own search handle; results\n"
+        "                return as they finish, between 'RESULT_START, id' and\n"
+        "                'RESULT_END, id' (default 4)\n"
+        "  --binary      stream length-prefixed binary frames (float64 x/y arrays) on\n"
+        "                STDIN/STDOUT instead of text; logs go to STDERR (implies\n"
+        "                --streaming; see BinaryProtocol.h)\n"
+        "  --shm         search spectra in place in this shared memory ring, created\n"
+        "                by the client; STDIN/STDOUT carry only one-byte notifications\n"
+        "                (implies --binary; see SharedRing.h)\n"
+        "  --serve       initialize once, then serve any number of local clients on\n"
+        "                this Unix domain socket, each speaking the --streaming text\n"
+        "                protocol, on a shared pool of --jobs workers (default one\n"
+        "                per CPU); --max-in-flight limits each client's queue\n"
+        "  --directory   path in which to search for .csv files (defaults to current)\n"
+        "  --sorted      search the directory's files in pathname order, once all are\n"
+        "                found (default: search each as soon as it is found)\n"
+        "  --watch       keep running, searching CSV files as they are written or moved\n"
+        "                into the directory tree (Linux; until SIGINT or SIGTERM)\n"
+        "  --index       skip files recorded in this index as already processed, and\n"
+        "                record each file as it is done, so a run can resume where it\n"
+        "                left off (--watch defaults to .kiaconsole-index in --directory)\n"
+        "  --corpus      search the spectra in this file, packed beforehand with\n"
+        "                'KIAConsole pack \\path\\to\\spectra path' (much faster to\n"
+        "                re-run than --directory, as nothing need be parsed)\n"
+        "  --jobs        number of files to search in parallel in directory mode, each\n"
+        "                worker with its own search handle (default 1)\n"
+        "  --queue-depth files to read and parse ahead of the search workers in\n"
+        "                directory mode (default 2 per job)\n"
+        "  --max-handle-uses  searches to run on one search handle before closing and\n"
+        "                reopening it (default 0, meaning keep it open until exit)\n"
+        "  --timeout-ms  cancel searches still running after this long, reporting a\n"
+        "                timeout (default 0, meaning no deadline; requests may set\n"
+        "                their own with 'timeout_ms, n')\n"
+        "  --progress-ms sample search progress every n ms (default 0), logging it as\n"
+        "                it's taken, or with the file's or numbered request's output\n"
+        "  --async-log   write log output from a background thread, in batches\n"
+        "  --sync-flush  with --async-log, flush the log at the end of each request\n"
+        "                (default when --streaming or --watch; --nosync-flush to disable)\n"
+        "  --warm-up     search a built-in synthetic spectrum during startup, so the\n"
+        "                first real search finds the databases already open\n"
+        "  --cache       keep search results in this file, and answer repeat spectra\n"
+        "                from it (discarded if the search library changes, but NOT if\n"
+        "                KnowItAll's databases do: use --cache-reset after updating them)\n"
+        "  --cache-reset discard the results already in the --cache file\n"
+        "  --coalesce    when streaming, reuse the results of any of the last few\n"
+        "                spectra correlating with the new one at threshold or better\n"
+        "                (e.g. 0.9999), rather than searching again\n"
+        "  --coalesce-window  recent spectra to compare against (default 8)\n"
+        "  --coalesce-verify  search reused spectra anyway, and report how often the\n"
+        "                top match agreed (for tuning the threshold)\n"
+        "  --references  pre-screen each spectrum against the labeled CSV spectra in\n"
+        "                this directory, answering confident matches without searching\n"
+        "  --local-confidence  minimum score (0-1) of the best local match (default 0.95)\n"
+        "  --local-margin  ...and its minimum lead over the next compound (default 0.05)\n"
+        "  --local-verify  search locally matched spectra anyway, and report how often\n"
+        "                the top match agreed (for tuning the confidence); names are\n"
+        "                compared ignoring case, spaces and underscores, so reference\n"
+        "                files must be named as KnowItAll names the compound\n"
+        "  --quality-gate  reject spectra not worth searching (non-finite values,\n"
+        "                wavenumbers out of order, too little range, saturated, or too\n"
+        "                noisy), reporting no matches and why\n"
+        "  --min-range   least intensity range (counts) to search (default 200; 0 for\n"
+        "                normalized spectra); implies --quality-gate, as do the next three\n"
+        "  --min-snr     least signal-to-noise ratio to search (default 5)\n"
+        "  --saturation-level  intensity (counts) at which a pixel is saturated\n"
+        "                (default 65000)\n"
+        "  --max-saturated  fraction of saturated pixels tolerated (default 0.01)\n"
+        "  --despike     replace cosmic-ray spikes by interpolating across them\n"
+        "  --smooth      Savitzky-Golay smooth over this many pixels (odd, >= 5)\n"
+        "  --baseline    subtract an asymmetric least squares baseline of this\n"
+        "                smoothness (e.g. 1e5), removing fluorescence background\n"
+        "  --normalize   scale each spectrum so its largest intensity is 1\n"
+        "  --resample    resample each spectrum onto an evenly spaced grid of this many\n"
+        "                cm-1 per point, and search it with RunSearchEvenlySpaced\n"
+        "  --resample-method  'linear' (default) or 'cubic' interpolation\n"
+        "  --bin         average each n adjacent pixels before resampling\n"
+        "  --roi         search only wavenumbers from first to last (cm-1), e.g. 400,1800\n"
+        "  --library     load SearchSDK entry points from this DLL or shared object\n"
+        "                (e.g. libMockSearchSDK.so), rather than the installed KnowItAll\n"
+        "  --output      'jsonl' to also write one JSON record per measurement (pathname,\n"
+        "                pixels, elapsed time and all matches), alongside the log\n"
+        "  --output-file write JSON Lines records to this file rather than STDOUT\n\n"
     );
 }
@@ -3,6 +3,10 @@
 
 #include "pch.h"
 
+#include "Preprocessor.h"
+#include "QualityGate.h"
+#include "Resampler.h"
+
 #include <string>
 
 class Options
@@ -10,7 +14,39 @@ class Options
 public:
     bool valid;
     bool streaming;
+    bool binary;                //!< stream length-prefixed binary frames instead of text
+    bool asyncLog;              //!< write log lines from a background thread
+    bool syncFlush;             //!< flush the log at the end of each streamed request
+    bool jsonl;                 //!< also write one JSON Lines record per measurement
+    std::wstring outputFile;    //!< where to write JSON Lines records (empty = stdout)
     std::wstring directory;
+    bool sorted;                //!< search directory's files in name order (else as found)
+    std::wstring pack;          //!< "pack": compile directory's spectra into this corpus file, then exit
+    std::wstring corpus;        //!< search the spectra in this packed corpus file (empty = don't)
+    bool watch;                 //!< search CSV files as they arrive under directory
+    std::wstring index;         //!< record of files already processed (empty = none)
+    std::wstring shm;           //!< search spectra in this client-created SharedRing (empty = don't)
+    std::wstring serve;         //!< serve clients on this Unix domain socket (empty = don't)
+    int jobs;                   //!< number of parallel search workers in directory and server modes
+    int queueDepth;             //!< files read ahead of the search workers in directory mode
+    int maxInFlight;            //!< numbered streamed requests searched concurrently
+    int maxHandleUses;          //!< searches per handle before reopening (0 = unlimited)
+    int timeoutMS;              //!< default search deadline (0 = none)
+    int progressMS;             //!< log progress of long searches this often (0 = never)
+    double coalesce;            //!< reuse results of recent spectra this similar (0 = never)
+    int coalesceWindow;         //!< how many recent spectra to compare against
+    bool coalesceVerify;        //!< search reused spectra anyway, to measure agreement
+    std::wstring references;    //!< pre-screen against labeled spectra in this directory (empty = don't)
+    double localConfidence;     //!< minimum score of a local match to skip searching
+    double localMargin;         //!< ...and its minimum lead over the runner-up
+    bool localVerify;           //!< search locally matched spectra anyway, to measure agreement
+    QualityGate::Settings quality;  //!< thresholds below which spectra aren't searched
+    Preprocessor::Settings preprocess;  //!< despiking, smoothing, baseline removal, normalization
+    Resampler::Settings resample;   //!< uniform grid to search spectra on (default: as measured)
+    bool warmUp;                //!< search a synthetic spectrum while starting up
+    std::wstring cache;         //!< persistent result cache file (empty = none)
+    bool cacheReset;            //!< discard the cache's results at startup (e.g. after a database update)
+    std::wstring library;       //!< explicit SearchSDK DLL / shared object (else use registry)
 
     Options(int argc, char **argv);
     void usage();
@@ -0,0 +1,412 @@
+#include "pch.h"
+
+#include "Preprocessor.h"
+
+#include "Simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+using std::chrono::steady_clock;
+
+//! ALS asymmetry: weight of points above the baseline (those below get 1 - this)
+static const double ALS_ASYMMETRY = 0.01;
+static const int ALS_ITERATIONS = 10;         //!< at most
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+
+// Each takes the pixel count as both N (0 = not known until runtime) and n,
+// and computes exactly the same values (in the same order) in either version.
+
+namespace scalar_kernels
+{
+    //! out[i] = y[i + 1] - y[i]
+    template <int N> void diff(const double* y, double* out, int n)
+    {
+        const int count = (N ? N : n) - 1;
+        for (int i = 0; i < count; i++)
+            out[i] = y[i + 1] - y[i];
+    }
+
+    //! v[i] = |v[i] - center|
+    template <int N> void absDeviation(double* v, int n, double center)
+    {
+        for (int i = 0; i < (N ? N : n); i++)
+            v[i] = std::fabs(v[i] - center);
+    }
+
+    //! out[i] = sum of c[k] * y[i - m + k], for each i with a full window
+    template <int N> void convolve(const double* y, double* out, int n, const double* c, int m)
+    {
+        const int count = N ? N : n;
+        for (int i = m; i < count - m; i++)
+        {
+            double acc = 0;
+            for (int k = 0; k <= 2 * m; k++)
+                acc += c[k] * y[i - m + k];
+            out[i] = acc;
+        }
+    }
+
+    template <int N> void alsWeights(const double* y, const double* z, double* w, int n)
+    {
+        for (int i = 0; i < (N ? N : n); i++)
+            w[i] = y[i] > z[i] ? ALS_ASYMMETRY : 1 - ALS_ASYMMETRY;
+    }
+
+    //! y[i] -= z[i]
+    template <int N> void subtract(double* y, const double* z, int n)
+    {
+        for (int i = 0; i < (N ? N : n); i++)
+            y[i] -= z[i];
+    }
+
+    template <int N> double maxValue(const double* y, int n)
+    {
+        double result = -std::numeric_limits<double>::infinity();
+        for (int i = 0; i < (N ? N : n); i++)
+            result = std::max(result, y[i]);
+        return result;
+    }
+
+    template <int N> void scale(double* y, int n, double factor)
+    {
+        for (int i = 0; i < (N ? N : n); i++)
+            y[i] *= factor;
+    }
+}
+
+#ifdef KIACONSOLE_AVX2
+
+namespace avx2_kernels
+{
+    template <int N> AVX2_TARGET void diff(const double* y, double* out, int n)
+    {
+        const int count = (N ? N : n) - 1;
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(y + i + 1), _mm256_loadu_pd(y + i)));
+        for (; i < count; i++)
+            out[i] = y[i + 1] - y[i];
+    }
+
+    template <int N> AVX2_TARGET void absDeviation(double* v, int n, double center)
+    {
+        const int count = N ? N : n;
+        const __m256d c = _mm256_set1_pd(center);
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm256_storeu_pd(v + i, _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(v + i), c)));
+        for (; i < count; i++)
+            v[i] = std::fabs(v[i] - center);
+    }
+
+    template <int N> AVX2_TARGET void convolve(const double* y, double* out, int n, const double* c, int m)
+    {
+        const int count = N ? N : n;
+        int i = m;
+        for (; i + 4 <= count - m; i += 4)
+        {
+            __m256d acc = _mm256_setzero_pd();
+            for (int k = 0; k <= 2 * m; k++)
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(c[k]), _mm256_loadu_pd(y + i - m + k)));
+            _mm256_storeu_pd(out + i, acc);
+        }
+        for (; i < count - m; i++)
+        {
+            double acc = 0;
+            for (int k = 0; k <= 2 * m; k++)
+                acc += c[k] * y[i - m + k];
+            out[i] = acc;
+        }
+    }
+
+    template <int N> AVX2_TARGET void alsWeights(const double* y, const double* z, double* w, int n)
+    {
+        const int count = N ? N : n;
+        const __m256d above = _mm256_set1_pd(ALS_ASYMMETRY);
+        const __m256d below = _mm256_set1_pd(1 - ALS_ASYMMETRY);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256d mask = _mm256_cmp_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(z + i), _CMP_GT_OQ);
+            _mm256_storeu_pd(w + i, _mm256_blendv_pd(below, above, mask));
+        }
+        for (; i < count; i++)
+            w[i] = y[i] > z[i] ? ALS_ASYMMETRY : 1 - ALS_ASYMMETRY;
+    }
+
+    template <int N> AVX2_TARGET void subtract(double* y, const double* z, int n)
+    {
+        const int count = N ? N : n;
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm256_storeu_pd(y + i, _mm256_sub_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(z + i)));
+        for (; i < count; i++)
+            y[i] -= z[i];
+    }
+
+    template <int N> AVX2_TARGET double maxValue(const double* y, int n)
+    {
+        const int count = N ? N : n;
+        __m256d acc = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            acc = _mm256_max_pd(acc, _mm256_loadu_pd(y + i));
+
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, acc);
+        double result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        for (; i < count; i++)
+            result = std::max(result, y[i]);
+        return result;
+    }
+
+    template <int N> AVX2_TARGET void scale(double* y, int n, double factor)
+    {
+        const int count = N ? N : n;
+        const __m256d f = _mm256_set1_pd(factor);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm256_storeu_pd(y + i, _mm256_mul_pd(_mm256_loadu_pd(y + i), f));
+        for (; i < count; i++)
+            y[i] *= factor;
+    }
+}
+
+#else
+
+namespace avx2_kernels = scalar_kernels;
+
+#endif
+
+//! call kernel's AVX2 or scalar version
+#define KERNEL(avx2, kernel) ((avx2) ? avx2_kernels::kernel<N> : scalar_kernels::kernel<N>)
+
+////////////////////////////////////////////////////////////////////////////////
+// Preprocessor
+////////////////////////////////////////////////////////////////////////////////
+
+Preprocessor::Preprocessor(const Settings& settings)
+    : settings(settings)
+{
+    // quadratic Savitzky-Golay smoothing weights, for half-width m
+    if (settings.smooth > 0)
+    {
+        const int m = std::max(2, settings.smooth / 2);
+        const double norm = (2.0 * m - 1) * (2.0 * m + 1) * (2.0 * m + 3);
+        for (int k = -m; k <= m; k++)
+            coefficients.push_back((3.0 * (3.0 * m * m + 3.0 * m - 1) - 15.0 * k * k) / norm);
+    }
+}
+
+void Preprocessor::process(const SpectrumView& in, SpectrumView& out, Stats& stats)
+{
+    out = in;
+    if (!in.y || in.pixels < 1)
+        return;
+
+    const int n = in.pixels;
+    y.assign(in.y, in.y + n);
+
+    const bool avx2 = settings.simd && Simd::haveAvx2();
+    switch (n)
+    {
+        case 1024: run<1024>(n, avx2, stats); break;
+        case 2048: run<2048>(n, avx2, stats); break;
+        default:   run<0>(n, avx2, stats);    break;
+    }
+    out.y = y.data();
+}
+
+template <int N>
+void Preprocessor::run(int n, bool avx2, Stats& stats)
+{
+    auto start = steady_clock::now();
+    auto lap = [&](Stats::Stage stage)
+    {
+        auto now = steady_clock::now();
+        stats.record(stage, now - start);
+        start = now;
+    };
+
+    if (settings.despike)
+    {
+        despike<N>(n, avx2);
+        lap(Stats::STAGE_DESPIKE);
+    }
+    if (settings.smooth > 0)
+    {
+        smooth<N>(n, avx2);
+        lap(Stats::STAGE_SMOOTH);
+    }
+    if (settings.baseline > 0)
+    {
+        removeBaseline<N>(n, avx2);
+        lap(Stats::STAGE_BASELINE);
+    }
+    if (settings.normalize)
+    {
+        normalize<N>(n, avx2);
+        lap(Stats::STAGE_NORMALIZE);
+    }
+}
+
+double Preprocessor::median(const double* values, int n)
+{
+    sorted.assign(values, values + n);
+    auto mid = sorted.begin() + n / 2;
+    std::nth_element(sorted.begin(), mid, sorted.end());
+    return *mid;
+}
+
+template <int N>
+void Preprocessor::despike(int n, bool avx2)
+{
+    if (n < 3)
+        return;
+
+    // steps between neighbors, and their median absolute deviation
+    work.resize(n);
+    KERNEL(avx2, diff)(y.data(), work.data(), n);
+    const double center = median(work.data(), n - 1);
+    KERNEL(avx2, absDeviation)(work.data(), n - 1, center);
+    const double mad = median(work.data(), n - 1);
+    if (!(mad > 0))
+        return;
+
+    // |modified z-score| = 0.6745 |step - median| / MAD
+    const double limit = settings.spikeThreshold * mad / 0.6745;
+    spikes.assign(n, 0);
+    bool any = false;
+    for (int i = 0; i < n - 1; i++)
+    {
+        if (work[i] > limit)
+        {
+            spikes[i] = spikes[i + 1] = 1;
+            any = true;
+        }
+    }
+    if (!any)
+        return;
+
+    // interpolate across each run of flagged pixels
+    for (int i = 0; i < n; )
+    {
+        if (!spikes[i])
+        {
+            i++;
+            continue;
+        }
+        int end = i;
+        while (end < n && spikes[end])
+            end++;
+
+        const int lo = i - 1;
+        const int hi = end;
+        for (int j = i; j < end; j++)
+        {
+            if (lo >= 0 && hi < n)
+                y[j] = y[lo] + (y[hi] - y[lo]) * (j - lo) / (double) (hi - lo);
+            else if (lo >= 0)
+                y[j] = y[lo];
+            else if (hi < n)
+                y[j] = y[hi];
+        }
+        i = end;
+    }
+}
+
+template <int N>
+void Preprocessor::smooth(int n, bool avx2)
+{
+    const int m = (int) coefficients.size() / 2;
+    if (n < 2 * m + 1)
+        return;
+
+    // the edges (without a full window) keep their values
+    work.assign(y.begin(), y.end());
+    KERNEL(avx2, convolve)(y.data(), work.data(), n, coefficients.data(), m);
+    y.swap(work);
+}
+
+template <int N>
+void Preprocessor::removeBaseline(int n, bool avx2)
+{
+    if (n < 4)
+        return;
+
+    // reweight until no point changes sides (usually well before the limit)
+    weights.assign(n, 1.0);
+    fit.resize(n);
+    for (int iteration = 0; iteration < ALS_ITERATIONS; iteration++)
+    {
+        solveBaseline(n);
+        if (iteration + 1 == ALS_ITERATIONS)
+            break;
+
+        previous.swap(weights);
+        weights.resize(n);
+        KERNEL(avx2, alsWeights)(y.data(), fit.data(), weights.data(), n);
+        if (weights == previous)
+            break;
+    }
+    KERNEL(avx2, subtract)(y.data(), fit.data(), n);
+}
+
+/*! Solve (W + lambda D'D) z = W y for the baseline z, where W holds the
+    weights and D is the second difference operator, so the system is
+    symmetric pentadiagonal; factored as L D L' (unit lower L with two
+    subdiagonals l1 and l2, diagonal d), then forward and back substituted.
+    Inherently sequential, so scalar.
+*/
+void Preprocessor::solveBaseline(int n)
+{
+    const double lambda = settings.baseline;
+    l1.resize(n);
+    l2.resize(n);
+    d.resize(n);
+    inverse.resize(n);
+
+    // bands of D'D: diagonal 1 5 6 ... 6 5 1, first subdiagonal -2 -4 ... -4 -2, second 1
+    auto diagonal = [n](int i) { return (i == 0 || i == n - 1) ? 1.0 : (i == 1 || i == n - 2) ? 5.0 : 6.0; };
+    auto subdiagonal = [n](int i) { return (i == 1 || i == n - 1) ? -2.0 : -4.0; };
+
+    l1[0] = l2[0] = l2[1] = 0;
+    d[0] = weights[0] + lambda * diagonal(0);
+    inverse[0] = 1 / d[0];
+    l1[1] = lambda * subdiagonal(1) * inverse[0];
+    d[1] = weights[1] + lambda * diagonal(1) - l1[1] * l1[1] * d[0];
+    inverse[1] = 1 / d[1];
+    for (int i = 2; i < n; i++)
+    {
+        l2[i] = lambda * inverse[i - 2];
+        l1[i] = (lambda * subdiagonal(i) - l2[i] * l1[i - 1] * d[i - 2]) * inverse[i - 1];
+        d[i] = weights[i] + lambda * diagonal(i) - l1[i] * l1[i] * d[i - 1] - l2[i] * l2[i] * d[i - 2];
+        inverse[i] = 1 / d[i];
+    }
+
+    // L u = W y, then L' z = u / d
+    fit[0] = weights[0] * y[0];
+    fit[1] = weights[1] * y[1] - l1[1] * fit[0];
+    for (int i = 2; i < n; i++)
+        fit[i] = weights[i] * y[i] - l1[i] * fit[i - 1] - l2[i] * fit[i - 2];
+
+    fit[n - 1] *= inverse[n - 1];
+    fit[n - 2] = fit[n - 2] * inverse[n - 2] - l1[n - 1] * fit[n - 1];
+    for (int i = n - 3; i >= 0; i--)
+        fit[i] = fit[i] * inverse[i] - l1[i + 1] * fit[i + 1] - l2[i + 2] * fit[i + 2];
+}
+
+template <int N>
+void Preprocessor::normalize(int n, bool avx2)
+{
+    const double peak = KERNEL(avx2, maxValue)(y.data(), n);
+    if (peak > 0)
+        KERNEL(avx2, scale)(y.data(), n, 1 / peak);
+}
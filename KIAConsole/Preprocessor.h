@@ -0,0 +1,86 @@
+#ifndef KIACONSOLE_PREPROCESSOR_H
+#define KIACONSOLE_PREPROCESSOR_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+#include "Stats.h"
+
+#include <vector>
+
+/*! @brief Cleans up spectra before they are searched (--despike, --smooth,
+           --baseline, --normalize).
+
+    Raw 785 nm spectra carry cosmic-ray spikes and a broad fluorescence
+    background, either of which can crowd the real compound out of the top
+    matches.  Each stage is enabled separately, and runs in this order:
+
+    - despike: pixels at either end of an outlying step (modified z-score of
+      the first difference, from its median absolute deviation, beyond
+      spikeThreshold) are replaced by interpolating between the nearest good
+      pixels either side;
+    - smooth: Savitzky-Golay (quadratic) filter over smooth pixels (odd; the
+      first and last smooth / 2 pixels are left as they are);
+    - baseline: asymmetric least squares (Eilers and Boelens), with
+      smoothness baseline (lambda, e.g. 1e5) and asymmetry 0.01, reweighted
+      (by a pentadiagonal solve each pass) until no point changes sides of
+      the fit, or ten passes; the fitted baseline is subtracted;
+    - normalize: scaled so the largest intensity is 1.
+
+    The arithmetic-heavy kernels (differences, the smoothing convolution,
+    baseline weights and subtraction, and normalization) have AVX2 versions,
+    used when the CPU supports them (see Simd), and a scalar fallback; both
+    give identical results.  Each is a template on the pixel
+    count, instantiated for the common 1024 and 2048 (so loop bounds are
+    known at compile time), and for anything else.
+
+    Each stage's time is recorded in the session's Stats.  Not thread-safe:
+    each SearchSession keeps its own.
+*/
+class Preprocessor
+{
+    public:
+        struct Settings
+        {
+            bool despike = false;
+            double spikeThreshold = 6;  //!< modified z-score beyond which a step is a spike
+            int smooth = 0;             //!< Savitzky-Golay window, pixels (odd, >= 5; 0 = off)
+            double baseline = 0;        //!< ALS smoothness lambda (0 = off)
+            bool normalize = false;
+            bool simd = true;           //!< use AVX2 kernels, if the CPU has them
+
+            //! true if any stage is enabled
+            bool enabled() const { return despike || smooth > 0 || baseline > 0 || normalize; }
+        };
+
+        explicit Preprocessor(const Settings& settings);
+
+        //! preprocess in.y into this object's buffer
+        //! @param out  in, with y replaced (valid until the next call)
+        void process(const SpectrumView& in, SpectrumView& out, Stats& stats);
+
+        const Settings settings;
+
+    private:
+        std::vector<double> coefficients;   //!< Savitzky-Golay weights, smooth of them
+        std::vector<double> y;              //!< spectrum being processed
+        std::vector<double> work;           //!< scratch (differences, smoothed copy)
+        std::vector<double> sorted;         //!< scratch for medians
+        std::vector<unsigned char> spikes;  //!< flags, by pixel
+        std::vector<double> weights;        //!< ALS weights
+        std::vector<double> previous;       //!< ...from the last pass
+        std::vector<double> fit;            //!< ALS baseline
+        std::vector<double> l1, l2, d;      //!< ALS factorization
+        std::vector<double> inverse;        //!< 1 / d
+
+        template <int N> void run(int n, bool avx2, Stats& stats);
+        template <int N> void despike(int n, bool avx2);
+        template <int N> void smooth(int n, bool avx2);
+        template <int N> void removeBaseline(int n, bool avx2);
+        template <int N> void normalize(int n, bool avx2);
+
+        double median(const double* values, int n);
+        void solveBaseline(int n);
+};
+
+#endif
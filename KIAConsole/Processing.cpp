@@ -0,0 +1,967 @@
+#include "pch.h"
+
+#include "Processing.h"
+
+#include "BinaryProtocol.h"
+#include "BoundedQueue.h"
+#include "Corpus.h"
+#include "DirectoryWalker.h"
+#include "ExportFile.h"
+#include "FileIndex.h"
+#include "JsonlWriter.h"
+#include "SharedRing.h"
+#include "Startup.h"
+#include "Util.h"
+
+#include <atomic>
+#include <cstring>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+
+using std::vector;
+using std::string;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::wstring;
+
+//! files found ahead of the reader in directory mode (the walker waits beyond that)
+static const size_t PATH_QUEUE_DEPTH = 4096;
+
+//! log what the Watchdog saw of session's last search (progress samples, and
+//! any cancellation), which it leaves to the searching thread so that the
+//! lines stay within subject's own block of output
+static void logWatchdog(const SearchSession& session, const wstring& subject)
+{
+    for (const Watchdog::Progress& p : session.progress())
+        Util::log(L"Search progress (%ls): %.0lf%% after %.2lf sec", subject.c_str(), p.percent, p.elapsedSec);
+    if (session.timedOut())
+        Util::log(L"ERROR: search of %ls exceeded %d ms deadline; canceled", subject.c_str(), session.deadline());
+}
+
+//! Search a single spectrum and report the results
+//! @param m        the spectrum to identify
+//! @param session  warm search handle and match buffer to use
+bool processMeasurement(const Measurement& m, SearchSession& session)
+{
+    return processMeasurement(m, m.view(), session);
+}
+
+//! Search a spectrum held elsewhere, and report the results
+//! @param m         pathname, label and min_confidence to report with
+//! @param spectrum  what to search (in place of m's own x and y)
+//! @param session   warm search handle and match buffer to use
+bool processMeasurement(const Measurement& m, const SpectrumView& spectrum, SearchSession& session)
+{
+    auto start = steady_clock::now();
+
+    Util::log(L"Begin processing");
+    if (!session.search(spectrum))
+        return false;
+
+    SearchSDK_Match* matches = session.matches();
+    int matchCount = session.matchCount();
+
+    auto end = steady_clock::now();
+    duration<double> elapsedSec = end - start;
+
+    if (session.timedOut() || !session.progress().empty())
+        logWatchdog(session, !m.pathname.empty() ? m.pathname
+            : m.request_id >= 0 ? L"request " + std::to_wstring(m.request_id) : wstring(L"streamed spectrum"));
+
+    // a canceled search still completes the request (with no matches), so the
+    // client isn't left waiting
+    if (session.timedOut())
+        Util::log(L"ERROR: search timed out after %0.2lf sec", elapsedSec.count());
+    else if (session.reused())
+        Util::log(L"Reusing results of a near-identical spectrum from %0.2lf sec ago (similarity %.6lf)",
+            session.reusedAgeSec, session.similarity);
+    else if (session.matchedLocally())
+        Util::log(L"Matched locally against reference spectra (score %.4lf)", session.localScore);
+    else if (session.rejection() != QualityGate::PASS)
+    {
+        const QualityGate::Report& q = session.quality();
+        Util::log(L"Rejected: reason=%ls non_finite=%d axis_reversals=%d saturated=%.4lf range=%.1lf snr=%.1lf",
+            QualityGate::name(q.reason), q.nonFinite, q.axisReversals, q.saturated, q.range, q.snr);
+    }
+
+    // count matches that meet the threshold
+    int validCount = 0;
+    for (int i = 0; i < matchCount; i++)
+    {
+        SearchSDK_Match& match = matches[i];
+
+        // skip low-quality matches
+        if (match.m_matchPercentage >= m.min_confidence)
+            validCount++;
+    }
+
+    Util::log(L"Found %d matches in %0.2lf sec", validCount, elapsedSec.count()); // matched by KIAWrapper
+    for (int i = 0; i < matchCount; i++)
+    {
+        SearchSDK_Match& match = matches[i];
+
+        // skip low-quality matches
+        if (match.m_matchPercentage < m.min_confidence)
+            continue;
+
+        Util::log(L"Match %d: %ls with %.2lf%% confidence (%ls)", // matched by KIAWrapper
+            i, match.m_matchName, 100.0 * match.m_matchPercentage, match.m_bLocked ? L"expired" : L"licensed");
+    }
+
+    // machine-readable record, if requested (--output jsonl)
+    JsonlWriter::write(m, spectrum.pixels, matches, matchCount, elapsedSec.count(), session.timedOut(), session.reused(), session.matchedLocally(),
+        session.rejection() != QualityGate::PASS ? QualityGate::name(session.rejection()) : nullptr);
+
+    Util::log(L"Processing complete");
+
+    session.stats.record(Stats::STAGE_FORMAT, steady_clock::now() - end);
+    session.stats.measurements++;
+    Startup::mark(L"first result");
+    return true;
+}
+
+//! one spectrum (or unreadable file) in flight through the directory pipeline,
+//! or one numbered streamed request
+struct PipelineItem
+{
+    size_t index = 0;                   //!< position in the directory, or request id
+    wstring pathname;
+    std::unique_ptr<Measurement> m;     //!< null if the file could not be parsed
+    wstring log;                        //!< captured log lines, printed in file order
+    string record;                      //!< captured JSON Lines record
+    bool lastOfFile = false;            //!< the file is done once this item is written
+    FileIndex::Entry indexEntry;        //!< to record the file in the FileIndex
+};
+
+typedef std::unique_ptr<PipelineItem> PipelineItemPtr;
+
+/*! Process files through a bounded three-stage pipeline.
+
+    - a reader thread loads and parses each file, in the order they arrive
+      in paths (until it is closed), so the next spectrum is ready as soon as
+      a search worker is free.  A multi-spectrum export file (see
+      ExportFile) is read once and fed through as one item per spectrum.
+      With a FileIndex open, files it has already seen are skipped.
+    - opts.jobs search workers, each with its own search session
+    - the calling thread, which writes each file's captured log (and JSON
+      Lines record) in arrival order, so output reads exactly as it would
+      from a sequential run, and records each finished file in the FileIndex
+
+    At most opts.queueDepth spectra wait between stages, and the reader stops
+    reading ahead once that many (plus one per worker) are unwritten, so
+    memory stays bounded however slow any stage is.
+
+    @param files    set to the number of files read
+    @param spectra  set to the number of items (spectra or unreadable files) processed
+    @returns the sum of per-file read and search times, for speedup reporting
+             (-1 if the library failed to start)
+*/
+static double processFilesPipelined(BoundedQueue<wstring>& paths, const SearchLibrary& library, const Options& opts,
+                                    Stats& stats, size_t& files, size_t& spectra)
+{
+    const size_t depth = (size_t) opts.queueDepth;
+    const size_t maxInFlight = 2 * depth + opts.jobs;
+
+    BoundedQueue<PipelineItemPtr> parsed(depth);
+    BoundedQueue<PipelineItemPtr> searched(maxInFlight);
+
+    // the writer's progress, so the reader can stay within maxInFlight
+    std::mutex mut;
+    std::condition_variable cv;
+    size_t written = 0;
+
+    double readerSec = 0;
+    double searchSec = 0;
+    std::atomic<int> searchersLeft(opts.jobs);
+
+    // the reader starts before the library is ready, so is busy over a
+    // longer span than the searchers and writer
+    auto readerStart = steady_clock::now();
+    std::thread reader([&]()
+    {
+        Stats readerStats;
+        string contents;
+        size_t index = 0;
+        size_t fileCount = 0;
+        wstring pathname;
+        while (paths.pop(pathname))
+        {
+            if (fileCount == 0)
+                Startup::mark(L"first file found");
+
+            // already processed (in this run or an earlier one)?
+            FileIndex::Entry indexEntry;
+            const bool indexed = FileIndex::isOpen();
+            if (indexed && FileIndex::unchanged(pathname, indexEntry))
+                continue;
+
+            auto start = steady_clock::now();
+            const bool read = Util::readFile(pathname, contents);
+            if (indexed && read && !FileIndex::claim(pathname, indexEntry, contents))
+                continue;
+            fileCount++;
+
+            wstring fileLog;
+            vector<std::unique_ptr<Measurement>> loaded;
+
+            Util::beginCapture(&fileLog);
+            try
+            {
+                Util::log(L"Processing %ls", pathname.c_str());
+                Util::log(L"Loading %ls", pathname.c_str());
+                if (ExportFile::isExport(contents))
+                    loaded = std::move(ExportFile(pathname, contents).measurements);
+                else
+                    loaded.emplace_back(new Measurement(pathname, contents));
+                readerStats.record(Stats::STAGE_PARSE, steady_clock::now() - start);
+                if (index == 0)
+                    Startup::mark(L"first file parsed");
+            }
+            catch (std::exception& e)
+            {
+                Util::log(L"ERROR: exception processing %ls: %ls", pathname.c_str(), Util::toWstring(e.what()).c_str());
+                loaded.clear();
+            }
+            Util::endCapture();
+            readerSec += duration<double>(steady_clock::now() - start).count();
+
+            // an unreadable file still passes through, to keep its log in order
+            if (loaded.empty())
+                loaded.emplace_back();
+
+            bool closed = false;
+            for (size_t k = 0; k < loaded.size() && !closed; k++, index++)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mut);
+                    cv.wait(lock, [&]() { return index < written + maxInFlight; });
+                }
+
+                PipelineItemPtr item(new PipelineItem);
+                item->index = index;
+                item->pathname = pathname;
+                item->m = std::move(loaded[k]);
+                if (k == 0)
+                    item->log.swap(fileLog);
+                item->lastOfFile = indexed && read && k + 1 == loaded.size();
+                item->indexEntry = indexEntry;
+
+                const Measurement* m = item->m.get();
+                if (loaded.size() > 1 && m)
+                {
+                    Util::beginCapture(&item->log);
+                    Util::log(L"Processing spectrum %u of %u (%ls)", (unsigned) k + 1, (unsigned) loaded.size(), m->label.c_str());
+                    Util::endCapture();
+                }
+
+                closed = !parsed.push(std::move(item));
+            }
+            if (closed)
+                break;
+        }
+        parsed.close();
+        files = fileCount;
+        spectra = index;
+
+        std::lock_guard<std::mutex> lock(mut);
+        stats.add(readerStats);
+    });
+
+    auto searcher = [&]()
+    {
+        SearchSession session(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS);
+        session.configure(opts, false);
+
+        double workerSec = 0;
+        PipelineItemPtr item;
+        while (parsed.pop(item))
+        {
+            auto start = steady_clock::now();
+
+            Util::beginCapture(&item->log);
+            JsonlWriter::beginCapture(&item->record);
+            try
+            {
+                const Measurement* m = item->m.get();
+                if (m && m->isValid() && !processMeasurement(*m, session))
+                    Util::log(L"ERROR: could not open search on %ls", m->pathname.c_str());
+            }
+            catch (std::exception& e)
+            {
+                Util::log(L"ERROR: exception processing %ls: %ls", item->pathname.c_str(), Util::toWstring(e.what()).c_str());
+            }
+            JsonlWriter::endCapture();
+            Util::endCapture();
+
+            // done with the spectrum itself; only its output remains
+            item->m.reset();
+            workerSec += duration<double>(steady_clock::now() - start).count();
+
+            searched.push(std::move(item));
+        }
+
+        session.close();
+        if (--searchersLeft == 0)
+            searched.close();
+
+        std::lock_guard<std::mutex> lock(mut);
+        searchSec += workerSec;
+        stats.add(session.stats);
+    };
+
+    // the library may still be loading (see Startup); the reader carries on
+    // meanwhile, until the parsed queue fills
+    if (!Startup::waitLibrary())
+    {
+        paths.close();
+        parsed.close();
+        reader.join();
+        return -1;
+    }
+
+    auto start = steady_clock::now();
+
+    vector<std::thread> threads;
+    for (int i = 0; i < opts.jobs; i++)
+        threads.emplace_back(searcher);
+
+    // write each spectrum's output as soon as it and all its predecessors are done
+    double writerSec = 0;
+    std::map<size_t, PipelineItemPtr> pending;
+    PipelineItemPtr item;
+    while (searched.pop(item))
+    {
+        pending[item->index] = std::move(item);
+
+        auto writeStart = steady_clock::now();
+        size_t next = written;
+        for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it), next++)
+        {
+            Util::print(it->second->log);
+            JsonlWriter::print(it->second->record);
+            if (it->second->lastOfFile)
+                FileIndex::commit(it->second->pathname, it->second->indexEntry);
+        }
+        if (opts.syncFlush && next != written)
+            Util::flushLog();
+        writerSec += duration<double>(steady_clock::now() - writeStart).count();
+
+        if (next != written)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                written = next;
+            }
+            cv.notify_all();
+        }
+    }
+
+    reader.join();
+    for (auto& t : threads)
+        t.join();
+
+    auto end = steady_clock::now();
+    double elapsedSec = duration<double>(end - start).count();
+    double readerElapsedSec = duration<double>(end - readerStart).count();
+    if (elapsedSec > 0)
+        Util::log(L"Pipeline utilization: reader %.1lf%%, search %.1lf%% (%d workers), writer %.1lf%%",
+            100 * readerSec / readerElapsedSec, 100 * searchSec / (opts.jobs * elapsedSec), opts.jobs, 100 * writerSec / elapsedSec);
+
+    return readerSec + searchSec;
+}
+
+double processFiles(BoundedQueue<wstring>& paths, const SearchLibrary& library, const Options& opts, Stats& stats)
+{
+    if (opts.jobs > 1)
+        Util::log(L"Processing with %d jobs", opts.jobs);
+
+    auto start = steady_clock::now();
+    size_t files = 0;
+    size_t spectra = 0;
+    double busySec = processFilesPipelined(paths, library, opts, stats, files, spectra);
+    if (busySec < 0)
+        return -1;
+
+    double elapsedSec = duration<double>(steady_clock::now() - start).count();
+    if (elapsedSec > 0 && spectra != files)
+        Util::log(L"Processed %u files (%u spectra) in %.2lf sec (%.2lf spectra/sec, %.2lfx speedup over sequential per-spectrum time)",
+            (unsigned)files, (unsigned)spectra, elapsedSec, spectra / elapsedSec, busySec / elapsedSec);
+    else if (elapsedSec > 0)
+        Util::log(L"Processed %u files in %.2lf sec (%.2lf files/sec, %.2lfx speedup over sequential per-file time)",
+            (unsigned)files, elapsedSec, files / elapsedSec, busySec / elapsedSec);
+    return elapsedSec;
+}
+
+void processDirectory(const SearchLibrary& library, const Options& opts)
+{
+    Util::log(L"Searching for CSV files in %ls", opts.directory.c_str());
+
+    Stats stats;
+    DirectoryWalker walker(opts.directory, L"*.csv");
+    double elapsedSec;
+
+    if (opts.sorted)
+    {
+        // the whole tree is walked before the first file is searched
+        auto start = steady_clock::now();
+        vector<wstring> files = walker.list(true);
+        Util::log(L"Found %u files", (unsigned)files.size());
+        Startup::mark(L"files found");
+        stats.record(Stats::STAGE_DISCOVERY, steady_clock::now() - start);
+
+        BoundedQueue<wstring> paths(files.size() + 1);
+        for (wstring& pathname : files)
+            paths.push(std::move(pathname));
+        paths.close();
+
+        elapsedSec = processFiles(paths, library, opts, stats);
+    }
+    else
+    {
+        // search each file as it's found, while the walk continues
+        BoundedQueue<wstring> paths(PATH_QUEUE_DEPTH);
+        walker.start(paths);
+        elapsedSec = processFiles(paths, library, opts, stats);
+        paths.close();
+
+        size_t found = walker.join();
+        if (found)
+            Util::log(L"Found %u files in %0.2lf sec (first after %0.1lf ms)",
+                (unsigned)found, walker.elapsedSec, walker.firstSec * 1000);
+        else
+            Util::log(L"Found 0 files in %0.2lf sec (first after none)", walker.elapsedSec);
+        stats.record(Stats::STAGE_DISCOVERY,
+            std::chrono::duration_cast<steady_clock::duration>(duration<double>(walker.elapsedSec)));
+    }
+
+    if (elapsedSec >= 0)
+        stats.report(elapsedSec);
+}
+
+/*! Search every spectrum in the opts.corpus file (see Corpus).
+
+    Spectra are searched in place in the mapping, so nothing is read, parsed
+    or allocated per spectrum: each of opts.jobs workers takes the next from
+    a shared counter, and reports it through its own reused Measurement,
+    holding just the pathname, label and request parameters.  Each
+    spectrum's log (and JSON Lines record) is captured into one of a ring of
+    reused slots, and written by the calling thread in corpus order, so
+    output reads as it would from directory mode.
+*/
+void processCorpus(const SearchLibrary& library, const Options& opts)
+{
+    Corpus corpus;
+    if (!corpus.open(opts.corpus))
+        return;
+    Startup::mark(L"corpus mapped");
+
+    const uint32_t count = corpus.count();
+    Util::log(L"Searching %u spectra in %ls", count, opts.corpus.c_str());
+
+    if (!Startup::waitLibrary())
+        return;
+    if (opts.jobs > 1)
+        Util::log(L"Processing with %d jobs", opts.jobs);
+
+    struct Slot
+    {
+        wstring log;
+        string record;
+        bool done = false;
+    };
+
+    // a worker may run this far ahead of the writer
+    const size_t slotCount = (size_t) opts.queueDepth + opts.jobs;
+    vector<Slot> slots(slotCount);
+
+    std::mutex mut;
+    std::condition_variable done;       //!< a slot is ready to write
+    std::condition_variable freed;      //!< the writer has moved on
+    size_t written = 0;
+    std::atomic<uint32_t> next(0);
+    Stats stats;
+
+    auto searcher = [&]()
+    {
+        SearchSession session(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS);
+        session.configure(opts, false);
+
+        Measurement m(0);
+        for (uint32_t i = next++; i < count; i = next++)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                freed.wait(lock, [&]() { return i < written + slotCount; });
+            }
+
+            // strings keep their capacity, so this stops allocating once warm
+            const CorpusEntry& entry = corpus.entry(i);
+            m.pathname.clear();
+            Util::appendWide(m.pathname, corpus.pathname(i), strlen(corpus.pathname(i)));
+            m.label.clear();
+            Util::appendWide(m.label, corpus.label(i), strlen(corpus.label(i)));
+            m.pixels = (int) entry.pixels;
+            m.max_results = entry.maxResults;
+            m.min_confidence = entry.minConfidence;
+            m.timeout_ms = entry.timeoutMS;
+
+            Slot& slot = slots[i % slotCount];
+            slot.log.clear();
+            slot.record.clear();
+            Util::beginCapture(&slot.log);
+            JsonlWriter::beginCapture(&slot.record);
+            try
+            {
+                Util::log(L"Processing %ls", m.pathname.c_str());
+                if (!processMeasurement(m, corpus.view(i), session))
+                    Util::log(L"ERROR: could not open search on %ls", m.pathname.c_str());
+            }
+            catch (std::exception& e)
+            {
+                Util::log(L"ERROR: exception processing %ls: %ls", m.pathname.c_str(), Util::toWstring(e.what()).c_str());
+            }
+            JsonlWriter::endCapture();
+            Util::endCapture();
+
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                slot.done = true;
+            }
+            done.notify_one();
+        }
+        session.close();
+
+        std::lock_guard<std::mutex> lock(mut);
+        stats.add(session.stats);
+    };
+
+    auto start = steady_clock::now();
+    vector<std::thread> threads;
+    for (int i = 0; i < opts.jobs; i++)
+        threads.emplace_back(searcher);
+
+    // no worker touches a slot again until written passes it
+    while (written < count)
+    {
+        Slot& slot = slots[written % slotCount];
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            done.wait(lock, [&]() { return slot.done; });
+            slot.done = false;
+        }
+
+        Util::print(slot.log);
+        JsonlWriter::print(slot.record);
+        if (opts.syncFlush)
+            Util::flushLog();
+
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            written++;
+        }
+        freed.notify_all();
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    double elapsedSec = duration<double>(steady_clock::now() - start).count();
+    if (elapsedSec > 0)
+        Util::log(L"Processed %u spectra in %.2lf sec (%.2lf spectra/sec)", count, elapsedSec, count / elapsedSec);
+    stats.report(elapsedSec);
+}
+
+/*! Searches numbered stream requests ("REQUEST_START, id") concurrently.
+
+    Up to opts.maxInFlight requests are outstanding at once, each worker
+    with its own warm search session; submit() blocks beyond that, so the
+    client is held off by stdin backpressure.  Each request's log (and JSON
+    Lines record) is captured and printed as one block, between
+    "RESULT_START, id" and "RESULT_END, id", as soon as it completes, so
+    results may return out of order.
+*/
+class StreamWorkers
+{
+    public:
+        StreamWorkers(const SearchLibrary& library, const Options& opts, std::mutex& outputMut)
+            : opts(opts),
+              outputMut(outputMut),
+              queue((size_t) opts.maxInFlight)
+        {
+            for (int i = 0; i < opts.maxInFlight; i++)
+            {
+                sessions.emplace_back(new SearchSession(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS));
+                sessions.back()->configure(opts, true);
+            }
+            for (auto& session : sessions)
+                threads.emplace_back(&StreamWorkers::run, this, session.get());
+        }
+
+        ~StreamWorkers()
+        {
+            stop();
+        }
+
+        //! queue a request, first waiting while maxInFlight are outstanding
+        void submit(PipelineItemPtr item)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                idle.wait(lock, [&]() { return inFlight < (size_t) opts.maxInFlight; });
+                inFlight++;
+            }
+            queue.push(std::move(item));
+        }
+
+        //! wait until every request submitted so far has been answered
+        void drain()
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            idle.wait(lock, [&]() { return inFlight == 0; });
+        }
+
+        //! finish outstanding requests, then close every search handle
+        void stop()
+        {
+            queue.close();
+            for (auto& t : threads)
+                t.join();
+            threads.clear();
+            for (auto& session : sessions)
+                session->close();
+        }
+
+        //! add worker statistics to total (only while drained)
+        void addStats(Stats& total) const
+        {
+            for (auto& session : sessions)
+                total.add(session->stats);
+        }
+
+    private:
+        const Options& opts;
+        std::mutex& outputMut;      //!< held while printing, so blocks don't interleave
+        BoundedQueue<PipelineItemPtr> queue;
+        vector<std::unique_ptr<SearchSession>> sessions;
+        vector<std::thread> threads;
+
+        std::mutex mut;
+        std::condition_variable idle;
+        size_t inFlight = 0;
+
+        void run(SearchSession* session)
+        {
+            PipelineItemPtr item;
+            while (queue.pop(item))
+            {
+                Util::beginCapture(&item->log);
+                JsonlWriter::beginCapture(&item->record);
+                Util::log(L"RESULT_START, %ld", (long) item->index);
+                try
+                {
+                    if (!processMeasurement(*item->m, *session))
+                        Util::log(L"ERROR: could not open search for request %ld", (long) item->index);
+                }
+                catch (std::exception& e)
+                {
+                    Util::log(L"ERROR: exception processing request %ld: %ls", (long) item->index, Util::toWstring(e.what()).c_str());
+                }
+                Util::log(L"RESULT_END, %ld", (long) item->index);
+                JsonlWriter::endCapture();
+                Util::endCapture();
+
+                {
+                    std::lock_guard<std::mutex> lock(outputMut);
+                    Util::print(item->log);
+                    JsonlWriter::print(item->record);
+                    if (opts.syncFlush)
+                        Util::flushLog();
+                }
+                item.reset();
+
+                {
+                    std::lock_guard<std::mutex> lock(mut);
+                    inFlight--;
+                }
+                idle.notify_all();
+            }
+        }
+};
+
+void processStream(const SearchLibrary& library, const Options& opts)
+{
+    Util::log(L"Starting stream processing");
+
+    // keep one warm handle across requests
+    SearchSession session(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS);
+    session.configure(opts, true);
+    auto start = steady_clock::now();
+
+    // started by the first numbered request; until then, nothing is captured
+    // and unnumbered requests run exactly as they always have
+    std::unique_ptr<StreamWorkers> workers;
+    std::mutex outputMut;
+
+    auto report = [&]()
+    {
+        Stats total;
+        total.add(session.stats);
+        if (workers)
+            workers->addStats(total);
+        total.report(duration<double>(steady_clock::now() - start).count());
+    };
+
+    while (true)
+    {
+        // once workers may be printing, hold our own log lines until the
+        // request is read, then print them as one block
+        wstring parseLog;
+        if (workers)
+            Util::beginCapture(&parseLog);
+
+        std::unique_ptr<Measurement> m;
+        string error;
+        try
+        {
+            // not sure, but suspect this is actually throwing an EOF exception 
+            // we're not catching on shutdown
+            m.reset(new Measurement());
+        }
+        catch (std::exception &e)
+        {
+            error = e.what();
+        }
+
+        if (workers)
+        {
+            Util::endCapture();
+            std::lock_guard<std::mutex> lock(outputMut);
+            Util::print(parseLog);
+        }
+
+        if (!error.empty())
+        {
+            if (workers)
+                workers->drain();
+            Util::log(L"ERROR: exception parsing streamed input: %ls", Util::toWstring(error.c_str()).c_str());
+            break;
+        }
+
+        if (m->isQuit)
+            break;
+
+        if (m->request_id >= 0 && !m->isStats)
+        {
+            if (!workers)
+                workers.reset(new StreamWorkers(library, opts, outputMut));
+
+            session.stats.record(Stats::STAGE_PARSE, m->loadTime);
+            PipelineItemPtr item(new PipelineItem);
+            item->index = (size_t) m->request_id;
+            item->m = std::move(m);
+            workers->submit(std::move(item));
+            continue;
+        }
+
+        // unnumbered requests (and STATS) wait for everything before them
+        if (workers)
+            workers->drain();
+
+        if (m->isStats)
+        {
+            // report statistics so far, on request
+            report();
+            Util::flushLog();
+            continue;
+        }
+
+        session.stats.record(Stats::STAGE_PARSE, m->loadTime);
+        try
+        {
+            processMeasurement(*m, session);
+        }
+        catch (std::exception &e)
+        {
+            Util::log(L"ERROR: exception processing streamed input: %ls", Util::toWstring(e.what()).c_str());
+            break;
+        }
+
+        // don't leave the client waiting on "Processing complete"
+        if (opts.syncFlush)
+            Util::flushLog();
+    }
+
+    session.close();
+    if (workers)
+        workers->stop();
+    report();
+    Util::log(L"Stream processing complete");
+}
+
+/*! Stream processing using the length-prefixed binary protocol.
+
+    Log output moves to stderr, leaving stdout for result frames.  Requests
+    are read into a single reused Measurement, and nothing is logged per
+    request except errors.
+*/
+void processBinaryStream(const SearchLibrary& library, const Options& opts)
+{
+    Util::log(L"Starting binary stream processing");
+
+    BinaryProtocol::setBinaryMode(stdin);
+    BinaryProtocol::setBinaryMode(stdout);
+
+    SearchSession session(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS);
+    session.configure(opts, true);
+    Measurement m(0);
+    uint32_t requestId = 0;
+    auto runStart = steady_clock::now();
+
+    while (true)
+    {
+        BinaryProtocol::ReadStatus status = BinaryProtocol::readRequest(stdin, m, requestId);
+        if (status == BinaryProtocol::READ_QUIT)
+        {
+            Util::log(L"QUIT received...shutting down");
+            break;
+        }
+        else if (status != BinaryProtocol::READ_REQUEST)
+            break;
+
+        auto start = steady_clock::now();
+        int32_t result = BinaryProtocol::STATUS_OK;
+        if (m.max_results < 1 || m.max_results > BinaryProtocol::MAX_RESULTS)
+            result = BinaryProtocol::STATUS_INVALID;
+        else if (!session.search(m))
+            result = BinaryProtocol::STATUS_FAILED;
+        else if (session.timedOut())
+            result = BinaryProtocol::STATUS_TIMEOUT;
+        else if (session.rejection() != QualityGate::PASS)
+            result = BinaryProtocol::STATUS_REJECTED;
+        auto end = steady_clock::now();
+        double elapsedSec = duration<double>(end - start).count();
+        if (session.timedOut() || !session.progress().empty())
+            logWatchdog(session, L"request " + std::to_wstring(requestId));
+
+        int matchCount = result == BinaryProtocol::STATUS_OK ? session.matchCount() : 0;
+        uint32_t flags = session.reused() ? BinaryProtocol::RESULT_REUSED : 0;
+        if (session.matchedLocally())
+            flags |= BinaryProtocol::RESULT_LOCAL;
+        flags |= (uint32_t) session.rejection() << BinaryProtocol::RESULT_REASON_SHIFT;
+        if (!BinaryProtocol::writeResult(stdout, requestId, result, elapsedSec, session.matches(), matchCount, m.min_confidence, flags))
+        {
+            Util::log(L"ERROR: could not write result %u", requestId);
+            break;
+        }
+        session.stats.record(Stats::STAGE_FORMAT, steady_clock::now() - end);
+        session.stats.measurements++;
+        Startup::mark(L"first result");
+    }
+
+    session.close();
+    session.stats.report(duration<double>(steady_clock::now() - runStart).count());
+    Util::log(L"Binary stream processing complete (%ld requests)", session.stats.measurements);
+}
+
+void processSharedMemory(const SearchLibrary& library, const Options& opts)
+{
+    Util::log(L"Starting shared memory processing on %ls", opts.shm.c_str());
+
+    SharedRing ring;
+    if (!ring.open(opts.shm))
+        return;
+    Util::log(L"Attached %u request slots of %u pixels", ring.slotCount(), ring.maxPixels());
+
+    BinaryProtocol::setBinaryMode(stdin);
+    BinaryProtocol::setBinaryMode(stdout);
+
+    SearchSession session(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS);
+    session.configure(opts, true);
+    string frame;
+    auto runStart = steady_clock::now();
+
+    bool running = true;
+    while (running)
+    {
+        // a notification may cover several requests (and one may already
+        // have been answered along with an earlier one)
+        int c = fgetc(stdin);
+        if (c == EOF)
+            break;
+        if (c == SharedRing::NOTIFY_QUIT)
+        {
+            Util::log(L"QUIT received...shutting down");
+            running = false;
+        }
+
+        while (SharedRequestSlot* slot = ring.nextRequest())
+        {
+            // the client can rewrite the slot at any time, so read its header
+            // once, and check and use only that copy
+            SharedRequestSlot request;
+            memcpy(&request, slot, sizeof(request));
+            const uint32_t requestId = request.requestId;
+            const double minConfidence = request.minConfidence;
+
+            auto start = steady_clock::now();
+            int32_t result = BinaryProtocol::STATUS_OK;
+            const bool valid = request.pixels >= 2 && request.pixels <= ring.maxPixels()
+                && request.maxResults >= 1 && request.maxResults <= BinaryProtocol::MAX_RESULTS;
+
+            // search the slot's spectrum in place
+            SpectrumView v;
+            if (valid)
+            {
+                v.x = ring.x(slot);
+                v.y = ring.y(slot);
+                v.pixels = (int) request.pixels;
+                v.max_results = request.maxResults;
+                v.timeout_ms = request.timeoutMS ? (int) request.timeoutMS : -1;
+            }
+
+            if (!valid)
+                result = BinaryProtocol::STATUS_INVALID;
+            else if (!session.search(v))
+                result = BinaryProtocol::STATUS_FAILED;
+            else if (session.timedOut())
+                result = BinaryProtocol::STATUS_TIMEOUT;
+            else if (session.rejection() != QualityGate::PASS)
+                result = BinaryProtocol::STATUS_REJECTED;
+            auto end = steady_clock::now();
+            ring.releaseRequest();
+            if (session.timedOut() || !session.progress().empty())
+                logWatchdog(session, L"request " + std::to_wstring(requestId));
+
+            int matchCount = result == BinaryProtocol::STATUS_OK ? session.matchCount() : 0;
+            uint32_t flags = session.reused() ? BinaryProtocol::RESULT_REUSED : 0;
+            if (session.matchedLocally())
+                flags |= BinaryProtocol::RESULT_LOCAL;
+            flags |= (uint32_t) session.rejection() << BinaryProtocol::RESULT_REASON_SHIFT;
+            BinaryProtocol::formatResult(frame, requestId, result, duration<double>(end - start).count(),
+                session.matches(), matchCount, minConfidence, flags, ring.resultBytes());
+            if (!ring.publishResult(frame))
+            {
+                Util::log(L"ERROR: no result slot free for request %u (more than %u requests outstanding)", requestId, ring.slotCount());
+                running = false;
+                break;
+            }
+            fputc(SharedRing::NOTIFY_RESULT, stdout);
+            fflush(stdout);
+
+            session.stats.record(Stats::STAGE_FORMAT, steady_clock::now() - end);
+            session.stats.measurements++;
+            Startup::mark(L"first result");
+        }
+    }
+
+    session.close();
+    session.stats.report(duration<double>(steady_clock::now() - runStart).count());
+    Util::log(L"Shared memory processing complete (%ld requests)", session.stats.measurements);
+}
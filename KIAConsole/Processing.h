@@ -0,0 +1,52 @@
+#ifndef KIACONSOLE_PROCESSING_H
+#define KIACONSOLE_PROCESSING_H
+
+#include "pch.h"
+
+#include "BoundedQueue.h"
+#include "Measurement.h"
+#include "Options.h"
+#include "SearchLibrary.h"
+#include "SearchSession.h"
+#include "Stats.h"
+
+#include <string>
+
+/*! @file
+    @brief The processing modes of KIAConsole (directory, corpus, text
+           stream, binary stream and shared memory, plus the file pipeline
+           --watch feeds), and the per-measurement search and report
+           they share.
+
+    Kept apart from main() so KIABench can drive the same code paths.
+*/
+
+//! search one spectrum and log (and optionally record) its matches
+//! @returns false if no search handle could be opened
+bool processMeasurement(const Measurement& m, SearchSession& session);
+
+//! ...searching spectrum (e.g. in a Corpus) in place of m's own x and y,
+//! which need not be loaded; m supplies the rest (pathname, label, min_confidence)
+bool processMeasurement(const Measurement& m, const SpectrumView& spectrum, SearchSession& session);
+
+//! search every CSV under opts.directory (reading ahead, on opts.jobs workers)
+void processDirectory(const SearchLibrary& library, const Options& opts);
+
+//! search every spectrum in the opts.corpus file (on opts.jobs workers)
+void processCorpus(const SearchLibrary& library, const Options& opts);
+
+//! search each CSV pushed to paths, until it is closed (reading ahead, on
+//! opts.jobs workers), skipping any the FileIndex has already seen
+//! @returns elapsed seconds (-1 if the library failed to start)
+double processFiles(BoundedQueue<std::wstring>& paths, const SearchLibrary& library, const Options& opts, Stats& stats);
+
+//! search text requests from std::cin until QUIT or EOF
+void processStream(const SearchLibrary& library, const Options& opts);
+
+//! search binary request frames from stdin until QUIT or EOF
+void processBinaryStream(const SearchLibrary& library, const Options& opts);
+
+//! search requests in the opts.shm SharedRing as stdin notifies them, until QUIT or EOF
+void processSharedMemory(const SearchLibrary& library, const Options& opts);
+
+#endif
@@ -0,0 +1,202 @@
+#include "pch.h"
+
+#include "QualityGate.h"
+
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const wchar_t* REASON_NAMES[QualityGate::REASON_COUNT] =
+{
+    L"pass",
+    L"too_short",
+    L"non_finite",
+    L"not_monotonic",
+    L"low_range",
+    L"saturated",
+    L"low_snr"
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+
+//! per-lane accumulators of one pass (counts held as doubles, exact to 2^53)
+struct Lanes
+{
+    double lo[4], hi[4], sum[4], noise[4];
+    double nonFinite[4], up[4], down[4], saturated[4];
+};
+
+// Both versions cover pixels i < (n - 2) / 4 * 4, lane i % 4 accumulating
+// y[i], the x step from i and the second difference from i, with exactly
+// the same arithmetic; the remainder is left to check().
+
+static void scalarPass(const double* x, const double* y, int n, double level, Lanes& a)
+{
+    const int blocks = (n - 2) / 4 * 4;
+    for (int i = 0; i < blocks; i += 4)
+    {
+        for (int l = 0; l < 4; l++)
+        {
+            const double v = y[i + l];
+            a.lo[l] = v < a.lo[l] ? v : a.lo[l];
+            a.hi[l] = v > a.hi[l] ? v : a.hi[l];
+            a.sum[l] += v;
+            a.noise[l] += std::fabs(v - 2 * y[i + l + 1] + y[i + l + 2]);
+            a.nonFinite[l] += (v - v == 0 ? 0 : 1) + (x[i + l] - x[i + l] == 0 ? 0 : 1);
+
+            const double step = x[i + l + 1] - x[i + l];
+            a.up[l] += step > 0 ? 1 : 0;
+            a.down[l] += step < 0 ? 1 : 0;
+            a.saturated[l] += v >= level ? 1 : 0;
+        }
+    }
+}
+
+#ifdef KIACONSOLE_AVX2
+
+AVX2_TARGET static void avx2Pass(const double* x, const double* y, int n, double level, Lanes& a)
+{
+    const int blocks = (n - 2) / 4 * 4;
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1);
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d saturation = _mm256_set1_pd(level);
+
+    __m256d lo = _mm256_loadu_pd(a.lo), hi = _mm256_loadu_pd(a.hi);
+    __m256d sum = _mm256_loadu_pd(a.sum), noise = _mm256_loadu_pd(a.noise);
+    __m256d nonFinite = _mm256_loadu_pd(a.nonFinite), saturated = _mm256_loadu_pd(a.saturated);
+    __m256d up = _mm256_loadu_pd(a.up), down = _mm256_loadu_pd(a.down);
+
+    for (int i = 0; i < blocks; i += 4)
+    {
+        const __m256d v = _mm256_loadu_pd(y + i);
+        const __m256d x0 = _mm256_loadu_pd(x + i);
+
+        // as the scalar ternaries: v unless v is NaN
+        lo = _mm256_blendv_pd(lo, v, _mm256_cmp_pd(v, lo, _CMP_LT_OQ));
+        hi = _mm256_blendv_pd(hi, v, _mm256_cmp_pd(v, hi, _CMP_GT_OQ));
+        sum = _mm256_add_pd(sum, v);
+
+        __m256d d2 = _mm256_add_pd(_mm256_sub_pd(v, _mm256_mul_pd(two, _mm256_loadu_pd(y + i + 1))), _mm256_loadu_pd(y + i + 2));
+        noise = _mm256_add_pd(noise, _mm256_andnot_pd(sign, d2));
+
+        // x - x is NaN (so unequal to 0) only for NaN or infinite x
+        __m256d badY = _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(v, v), zero, _CMP_NEQ_UQ), one);
+        __m256d badX = _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(x0, x0), zero, _CMP_NEQ_UQ), one);
+        nonFinite = _mm256_add_pd(nonFinite, _mm256_add_pd(badY, badX));
+
+        __m256d step = _mm256_sub_pd(_mm256_loadu_pd(x + i + 1), x0);
+        up = _mm256_add_pd(up, _mm256_and_pd(_mm256_cmp_pd(step, zero, _CMP_GT_OQ), one));
+        down = _mm256_add_pd(down, _mm256_and_pd(_mm256_cmp_pd(step, zero, _CMP_LT_OQ), one));
+        saturated = _mm256_add_pd(saturated, _mm256_and_pd(_mm256_cmp_pd(v, saturation, _CMP_GE_OQ), one));
+    }
+
+    _mm256_storeu_pd(a.lo, lo);
+    _mm256_storeu_pd(a.hi, hi);
+    _mm256_storeu_pd(a.sum, sum);
+    _mm256_storeu_pd(a.noise, noise);
+    _mm256_storeu_pd(a.nonFinite, nonFinite);
+    _mm256_storeu_pd(a.up, up);
+    _mm256_storeu_pd(a.down, down);
+    _mm256_storeu_pd(a.saturated, saturated);
+}
+
+#else
+
+static void avx2Pass(const double* x, const double* y, int n, double level, Lanes& a)
+{
+    scalarPass(x, y, n, level, a);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// QualityGate
+////////////////////////////////////////////////////////////////////////////////
+
+QualityGate::QualityGate(const Settings& settings)
+    : settings(settings)
+{
+}
+
+const wchar_t* QualityGate::name(Reason reason)
+{
+    return reason >= 0 && reason < REASON_COUNT ? REASON_NAMES[reason] : L"unknown";
+}
+
+QualityGate::Reason QualityGate::check(const SpectrumView& m, Report& report) const
+{
+    report = Report();
+    const int n = m.pixels;
+    if (n < 3 || !m.x || !m.y)
+        return report.reason = TOO_SHORT;
+
+    Lanes a;
+    for (int l = 0; l < 4; l++)
+    {
+        a.lo[l] = a.hi[l] = m.y[0];
+        a.sum[l] = a.noise[l] = a.nonFinite[l] = a.up[l] = a.down[l] = a.saturated[l] = 0;
+    }
+
+    if (settings.simd && Simd::haveAvx2())
+        avx2Pass(m.x, m.y, n, settings.saturationLevel, a);
+    else
+        scalarPass(m.x, m.y, n, settings.saturationLevel, a);
+
+    // combine the lanes, then finish off the last few pixels one at a time
+    double lo = a.lo[0], hi = a.hi[0], sum = 0, noise = 0, nonFinite = 0, up = 0, down = 0, saturated = 0;
+    for (int l = 0; l < 4; l++)
+    {
+        lo = std::min(lo, a.lo[l]);
+        hi = std::max(hi, a.hi[l]);
+        sum += a.sum[l];
+        noise += a.noise[l];
+        nonFinite += a.nonFinite[l];
+        up += a.up[l];
+        down += a.down[l];
+        saturated += a.saturated[l];
+    }
+    for (int i = (n - 2) / 4 * 4; i < n; i++)
+    {
+        const double v = m.y[i];
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+        sum += v;
+        nonFinite += (v - v == 0 ? 0 : 1) + (m.x[i] - m.x[i] == 0 ? 0 : 1);
+        saturated += v >= settings.saturationLevel ? 1 : 0;
+        if (i + 1 < n)
+        {
+            const double step = m.x[i + 1] - m.x[i];
+            up += step > 0 ? 1 : 0;
+            down += step < 0 ? 1 : 0;
+        }
+        if (i + 2 < n)
+            noise += std::fabs(v - 2 * m.y[i + 1] + m.y[i + 2]);
+    }
+
+    report.nonFinite = (int) nonFinite;
+    report.axisReversals = (int) (n - 1 - std::max(up, down));
+    report.range = hi - lo;
+    report.saturated = saturated / n;
+
+    // mean absolute second difference of white noise is sqrt(12 / pi) sigma
+    const double sigma = noise / (n - 2) * 0.5116633539732443;
+    const double signal = hi - sum / n;
+    report.snr = sigma > 0 ? signal / sigma : (signal > 0 ? HUGE_VAL : 0);
+
+    if (report.nonFinite)
+        report.reason = NON_FINITE;
+    else if (report.axisReversals)
+        report.reason = NOT_MONOTONIC;
+    else if (report.range <= settings.minRange)
+        report.reason = LOW_RANGE;
+    else if (report.saturated > settings.maxSaturated)
+        report.reason = SATURATED;
+    else if (report.snr < settings.minSnr)
+        report.reason = LOW_SNR;
+    return report.reason;
+}
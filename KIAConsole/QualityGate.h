@@ -0,0 +1,79 @@
+#ifndef KIACONSOLE_QUALITY_GATE_H
+#define KIACONSOLE_QUALITY_GATE_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+
+/*! @brief Rejects spectra not worth searching (--quality-gate).
+
+    Measurement::isValid() only checks the pixel count, so dark frames,
+    saturated frames, flat lines, NaNs and scrambled axes all cost a full
+    SearchSDK search, and come back with junk matches.  One pass over x and
+    y measures:
+
+    - non-finite values: NaN or infinite x or y;
+    - axis reversals: x steps against the overall direction, or repeated x
+      (either direction is fine, as long as it is strict);
+    - range: highest less lowest intensity (a dark frame spans a few
+      hundred counts at most, a flat line none);
+    - saturation: fraction of pixels at or above saturationLevel;
+    - SNR: (highest - mean intensity) / noise, the noise estimated from the
+      mean absolute second difference (sqrt(pi / 12) of it, for white
+      noise), which cosmic-ray spikes sway less than an RMS would.
+
+    A spectrum is rejected for the first of these (in that order, as
+    Reason) to fail its threshold.  The pass has an AVX2 version, used when
+    the CPU supports it (see Simd), and a scalar fallback accumulating in
+    the same order, so both give identical reports; either takes a few
+    microseconds on a 1024-pixel spectrum.  Thresholds are in detector
+    counts, so set minRange to 0 for spectra normalized by the client.
+*/
+class QualityGate
+{
+    public:
+        //! why a spectrum was rejected (names as logged: "too_short", "non_finite"...)
+        enum Reason
+        {
+            PASS,
+            TOO_SHORT,          //!< fewer than 3 pixels
+            NON_FINITE,
+            NOT_MONOTONIC,
+            LOW_RANGE,
+            SATURATED,
+            LOW_SNR,
+            REASON_COUNT
+        };
+
+        struct Settings
+        {
+            bool enabled = false;
+            double minRange = 200;          //!< counts; a spectrum spanning no more is rejected
+            double saturationLevel = 65000; //!< counts at or above which a pixel is saturated
+            double maxSaturated = 0.01;     //!< fraction of saturated pixels tolerated
+            double minSnr = 5;
+            bool simd = true;               //!< use the AVX2 pass, if the CPU has it
+        };
+
+        struct Report
+        {
+            Reason reason = PASS;
+            int nonFinite = 0;
+            int axisReversals = 0;
+            double range = 0;
+            double saturated = 0;           //!< fraction of pixels
+            double snr = 0;                 //!< HUGE_VAL if noiseless
+        };
+
+        explicit QualityGate(const Settings& settings);
+
+        //! measure m, and decide whether it's worth searching
+        //! @returns report.reason
+        Reason check(const SpectrumView& m, Report& report) const;
+
+        static const wchar_t* name(Reason reason);
+
+        const Settings settings;
+};
+
+#endif
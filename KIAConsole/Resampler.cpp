@@ -0,0 +1,305 @@
+#include "pch.h"
+
+#include "Resampler.h"
+
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+
+// Each AVX2 kernel does four outputs at a time, gathering its inputs through
+// interval (or the bin's stride), with exactly the scalar arithmetic (no
+// FMA), and leaves the remainder to the scalar kernel; the two give
+// bitwise-identical results.
+
+namespace scalar_kernels
+{
+    //! average runs of b pixels, bins first to m - 1
+    static void bin(const double* x, const double* y, int n, int b, bool reverse, double* outX, double* outY, int first, int m)
+    {
+        for (int k = first; k < m; k++)
+        {
+            const int lo = k * b;
+            const int hi = std::min(lo + b, n);
+            double sumX = 0;
+            double sumY = 0;
+            for (int j = lo; j < hi; j++)
+            {
+                const int src = reverse ? n - 1 - j : j;
+                sumX += x[src];
+                sumY += y[src];
+            }
+            outX[k] = sumX / (hi - lo);
+            outY[k] = sumY / (hi - lo);
+        }
+    }
+
+    //! position of each grid point within its interval, clamped to [0, 1]
+    static void position(const double* x, const double* grid, const int* interval, double* t, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const int j = interval[i];
+            const double dx = x[j + 1] - x[j];
+            const double f = dx > 0 ? (grid[i] - x[j]) / dx : 0;
+            t[i] = std::min(std::max(f, 0.0), 1.0);
+        }
+    }
+
+    static void linear(const double* y, const int* interval, const double* t, double* out, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const int j = interval[i];
+            out[i] = y[j] + t[i] * (y[j + 1] - y[j]);
+        }
+    }
+
+    static void cubic(const double* x, const double* y, const double* slope, const int* interval, const double* t, double* out, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const int j = interval[i];
+            const double h = x[j + 1] - x[j];
+            const double s = t[i];
+            const double s2 = s * s;
+            const double s3 = s2 * s;
+            out[i] = (2 * s3 - 3 * s2 + 1) * y[j]
+                   + (s3 - 2 * s2 + s) * h * slope[j]
+                   + (-2 * s3 + 3 * s2) * y[j + 1]
+                   + (s3 - s2) * h * slope[j + 1];
+        }
+    }
+}
+
+#ifdef KIACONSOLE_AVX2
+
+namespace avx2_kernels
+{
+    //! four doubles from base[index] (masked, as the plain gather leaves its source undefined)
+    AVX2_TARGET static inline __m256d gather(const double* base, __m128i index)
+    {
+        const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, index, all, 8);
+    }
+
+    AVX2_TARGET static void bin(const double* x, const double* y, int n, int b, bool reverse, double* outX, double* outY, int first, int m)
+    {
+        // only whole bins here; a short last bin is left to the scalar kernel
+        const int whole = n / b;
+        const __m128i lanes = _mm_setr_epi32(0, b, 2 * b, 3 * b);
+        const __m256d width = _mm256_set1_pd((double) b);
+        int k = first;
+        for (; k + 4 <= whole; k += 4)
+        {
+            __m256d sumX = _mm256_setzero_pd();
+            __m256d sumY = _mm256_setzero_pd();
+            for (int j = 0; j < b; j++)
+            {
+                __m128i src = _mm_add_epi32(_mm_set1_epi32(k * b + j), lanes);
+                if (reverse)
+                    src = _mm_sub_epi32(_mm_set1_epi32(n - 1), src);
+                sumX = _mm256_add_pd(sumX, gather(x, src));
+                sumY = _mm256_add_pd(sumY, gather(y, src));
+            }
+            _mm256_storeu_pd(outX + k, _mm256_div_pd(sumX, width));
+            _mm256_storeu_pd(outY + k, _mm256_div_pd(sumY, width));
+        }
+        scalar_kernels::bin(x, y, n, b, reverse, outX, outY, k, m);
+    }
+
+    AVX2_TARGET static void position(const double* x, const double* grid, const int* interval, double* t, int count)
+    {
+        const __m128i one = _mm_set1_epi32(1);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d unit = _mm256_set1_pd(1);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i j = _mm_loadu_si128(reinterpret_cast<const __m128i*>(interval + i));
+            const __m256d x0 = gather(x, j);
+            const __m256d dx = _mm256_sub_pd(gather(x, _mm_add_epi32(j, one)), x0);
+
+            // as the scalar ternaries: 0 unless dx > 0, and NaN passes the clamp
+            __m256d f = _mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(grid + i), x0), dx);
+            f = _mm256_and_pd(_mm256_cmp_pd(dx, zero, _CMP_GT_OQ), f);
+            _mm256_storeu_pd(t + i, _mm256_min_pd(unit, _mm256_max_pd(zero, f)));
+        }
+        scalar_kernels::position(x, grid + i, interval + i, t + i, count - i);
+    }
+
+    AVX2_TARGET static void linear(const double* y, const int* interval, const double* t, double* out, int count)
+    {
+        const __m128i one = _mm_set1_epi32(1);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i j = _mm_loadu_si128(reinterpret_cast<const __m128i*>(interval + i));
+            const __m256d y0 = gather(y, j);
+            const __m256d y1 = gather(y, _mm_add_epi32(j, one));
+            _mm256_storeu_pd(out + i, _mm256_add_pd(y0, _mm256_mul_pd(_mm256_loadu_pd(t + i), _mm256_sub_pd(y1, y0))));
+        }
+        scalar_kernels::linear(y, interval + i, t + i, out + i, count - i);
+    }
+
+    AVX2_TARGET static void cubic(const double* x, const double* y, const double* slope, const int* interval, const double* t, double* out, int count)
+    {
+        const __m128i one = _mm_set1_epi32(1);
+        const __m256d c1 = _mm256_set1_pd(1);
+        const __m256d c2 = _mm256_set1_pd(2);
+        const __m256d c3 = _mm256_set1_pd(3);
+        const __m256d cm2 = _mm256_set1_pd(-2);
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i j0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(interval + i));
+            const __m128i j1 = _mm_add_epi32(j0, one);
+            const __m256d h = _mm256_sub_pd(gather(x, j1), gather(x, j0));
+            const __m256d s = _mm256_loadu_pd(t + i);
+            const __m256d s2 = _mm256_mul_pd(s, s);
+            const __m256d s3 = _mm256_mul_pd(s2, s);
+
+            // the scalar expression, term by term and in the same order
+            const __m256d a = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(c2, s3), _mm256_mul_pd(c3, s2)), c1);
+            const __m256d b = _mm256_mul_pd(_mm256_add_pd(_mm256_sub_pd(s3, _mm256_mul_pd(c2, s2)), s), h);
+            const __m256d c = _mm256_add_pd(_mm256_mul_pd(cm2, s3), _mm256_mul_pd(c3, s2));
+            const __m256d d = _mm256_mul_pd(_mm256_sub_pd(s3, s2), h);
+            __m256d v = _mm256_mul_pd(a, gather(y, j0));
+            v = _mm256_add_pd(v, _mm256_mul_pd(b, gather(slope, j0)));
+            v = _mm256_add_pd(v, _mm256_mul_pd(c, gather(y, j1)));
+            v = _mm256_add_pd(v, _mm256_mul_pd(d, gather(slope, j1)));
+            _mm256_storeu_pd(out + i, v);
+        }
+        scalar_kernels::cubic(x, y, slope, interval + i, t + i, out + i, count - i);
+    }
+}
+
+#else
+
+namespace avx2_kernels = scalar_kernels;
+
+#endif
+
+#define KERNEL(avx2, kernel) ((avx2) ? avx2_kernels::kernel : scalar_kernels::kernel)
+
+////////////////////////////////////////////////////////////////////////////////
+// Resampler
+////////////////////////////////////////////////////////////////////////////////
+
+Resampler::Resampler(const Settings& settings)
+    : settings(settings)
+{
+}
+
+bool Resampler::resample(const SpectrumView& in, SpectrumView& out)
+{
+    if (!in.x || !in.y || in.pixels < 2)
+        return false;
+
+    const bool avx2 = settings.simd && Simd::haveAvx2();
+    const double* x = in.x;
+    const double* y = in.y;
+    int n = in.pixels;
+    if (settings.bin > 1 || x[0] > x[n - 1])
+    {
+        bin(in, avx2);
+        x = srcX.data();
+        y = srcY.data();
+        n = (int) srcX.size();
+        if (n < 2)
+            return false;
+    }
+
+    double first = x[0];
+    double last = x[n - 1];
+    if (settings.roiLast > settings.roiFirst)
+    {
+        first = std::max(first, settings.roiFirst);
+        last = std::min(last, settings.roiLast);
+    }
+    if (!(last > first))
+        return false;
+
+    int count;
+    double step;
+    if (settings.spacing > 0)
+    {
+        step = settings.spacing;
+        count = (int) std::floor((last - first) / step + 1e-9) + 1;
+    }
+    else
+    {
+        // as many points as the input has within the region of interest
+        count = (int) (std::upper_bound(x, x + n, last) - std::lower_bound(x, x + n, first));
+        step = count > 1 ? (last - first) / (count - 1) : 0;
+    }
+    if (count < 2)
+        return false;
+
+    gridX.resize(count);
+    gridY.resize(count);
+    for (int i = 0; i < count; i++)
+        gridX[i] = first + i * step;
+
+    locate(x, n, avx2);
+    if (settings.method == CUBIC)
+        interpolateCubic(x, y, n, avx2);
+    else
+        KERNEL(avx2, linear)(y, interval.data(), t.data(), gridY.data(), count);
+
+    out = in;
+    out.x = gridX.data();
+    out.y = gridY.data();
+    out.pixels = count;
+    return true;
+}
+
+//! average runs of settings.bin pixels into srcX / srcY, in ascending x order
+void Resampler::bin(const SpectrumView& in, bool avx2)
+{
+    const int n = in.pixels;
+    const int b = std::max(1, settings.bin);
+    const int m = (n + b - 1) / b;
+
+    srcX.resize(m);
+    srcY.resize(m);
+    KERNEL(avx2, bin)(in.x, in.y, n, b, in.x[0] > in.x[n - 1], srcX.data(), srcY.data(), 0, m);
+}
+
+//! find the input interval [k, k+1] holding each grid point, and how far along it lies
+void Resampler::locate(const double* x, int n, bool avx2)
+{
+    const int count = (int) gridX.size();
+    interval.resize(count);
+    t.resize(count);
+
+    // the grid ascends, so one forward scan of the input suffices
+    int k = 0;
+    for (int i = 0; i < count; i++)
+    {
+        while (k < n - 2 && x[k + 1] <= gridX[i])
+            k++;
+        interval[i] = k;
+    }
+
+    KERNEL(avx2, position)(x, gridX.data(), interval.data(), t.data(), count);
+}
+
+//! cubic Hermite spline, with slopes from central differences (one-sided at the ends)
+void Resampler::interpolateCubic(const double* x, const double* y, int n, bool avx2)
+{
+    slope.resize(n);
+    slope[0] = x[1] > x[0] ? (y[1] - y[0]) / (x[1] - x[0]) : 0;
+    slope[n - 1] = x[n - 1] > x[n - 2] ? (y[n - 1] - y[n - 2]) / (x[n - 1] - x[n - 2]) : 0;
+    for (int k = 1; k < n - 1; k++)
+    {
+        const double dx = x[k + 1] - x[k - 1];
+        slope[k] = dx > 0 ? (y[k + 1] - y[k - 1]) / dx : 0;
+    }
+
+    KERNEL(avx2, cubic)(x, y, slope.data(), interval.data(), t.data(), gridY.data(), (int) gridX.size());
+}
@@ -0,0 +1,79 @@
+#ifndef KIACONSOLE_RESAMPLER_H
+#define KIACONSOLE_RESAMPLER_H
+
+#include "pch.h"
+
+#include "Measurement.h"
+
+#include <vector>
+
+/*! @brief Resamples spectra onto a uniform wavenumber grid, for
+           SearchSDK_RunSearchEvenlySpaced (--resample).
+
+    A spectrometer's wavenumber axis is uneven (about 1.2 to 2.2 cm-1 per
+    pixel across a typical 1024-pixel spectrum), so by default every search
+    passes both axes to SearchSDK_RunSearchUnevenlySpaced, which must itself
+    interpolate onto the library's grid.  Resampling first lets the search
+    take the evenly spaced path, and a coarser grid (fewer points) searches
+    faster, at some risk to the match; see ResampleBench for latency and
+    top-match agreement at various spacings.
+
+    In order, a spectrum is:
+    - binned: each run of bin adjacent pixels averaged into one (bin > 1),
+    - cropped to the region of interest [roiFirst, roiLast], if given, and
+    - interpolated (linearly, or by cubic Hermite spline) onto a grid of the
+      given spacing, starting at the first wavenumber kept; with no spacing,
+      the grid keeps as many points as the cropped spectrum had.
+
+    Each step runs as separate passes over contiguous arrays (finding every
+    output point's interval first, then the arithmetic).  Binning and the
+    arithmetic run as AVX2 kernels if the CPU has them, else as scalar loops
+    giving identical results; finding the intervals is a sequential scan.
+    Every input is gathered through an interval, and gathers cost nearly as
+    much as the scalar loads they replace, so AVX2 gains little here (at
+    most about 15%; ResampleBench times both).  A descending x axis is
+    reversed.
+
+    Not thread-safe: each SearchSession keeps its own.
+*/
+class Resampler
+{
+    public:
+        enum Method { LINEAR, CUBIC };
+
+        struct Settings
+        {
+            double spacing = 0;     //!< cm-1 between grid points (0 = as many as input)
+            Method method = LINEAR;
+            int bin = 1;            //!< pixels averaged together before interpolating
+            double roiFirst = 0;    //!< region of interest, cm-1 (ignored unless roiLast > roiFirst)
+            double roiLast = 0;
+            bool simd = true;       //!< use AVX2 kernels, if the CPU has them
+
+            //! true if spectra are to be resampled at all
+            bool enabled() const { return spacing > 0 || bin > 1 || roiLast > roiFirst; }
+        };
+
+        explicit Resampler(const Settings& settings);
+
+        //! resample in into this object's buffers
+        //! @param out  the resampled spectrum, valid until the next call
+        //!             (search parameters are copied from in)
+        //! @returns false if fewer than two points fall within the region of interest
+        bool resample(const SpectrumView& in, SpectrumView& out);
+
+        const Settings settings;
+
+    private:
+        std::vector<double> srcX, srcY;     //!< binned (or reversed) input
+        std::vector<double> slope;          //!< dy/dx at each input point (cubic)
+        std::vector<double> gridX, gridY;   //!< output
+        std::vector<int> interval;          //!< input interval [k, k+1] holding each output point
+        std::vector<double> t;              //!< position of each output point within its interval
+
+        void bin(const SpectrumView& in, bool avx2);
+        void locate(const double* x, int n, bool avx2);
+        void interpolateCubic(const double* x, const double* y, int n, bool avx2);
+};
+
+#endif
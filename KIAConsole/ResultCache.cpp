@@ -0,0 +1,345 @@
+#include "pch.h"
+
+#include "ResultCache.h"
+
+#include "BinaryProtocol.h"
+#include "Util.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+using std::string;
+using std::wstring;
+using std::vector;
+
+namespace
+{
+    const char FILE_MAGIC[8] = { 'K', 'I', 'A', 'C', 'A', 'C', 'H', 'E' };
+
+    #pragma pack(push, 1)
+    struct FileHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t fingerprint;
+        uint64_t reserved2;
+    };
+    #pragma pack(pop)
+
+    struct KeyHash
+    {
+        size_t operator()(const ResultCache::Key& key) const { return (size_t) (key.a ^ key.b); }
+    };
+
+    struct CachedMatch
+    {
+        double percentage;
+        const wchar_t* name;    //!< interned in Cache::names
+        bool locked;
+    };
+
+    //! matches [first, first + count) of Cache::matches
+    struct Entry
+    {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    struct Cache
+    {
+        FILE* f = nullptr;
+        wstring pathname;
+        std::unordered_map<ResultCache::Key, Entry, KeyHash> index;
+        vector<CachedMatch> matches;
+        std::unordered_set<wstring> names;     //!< node-based, so c_str() pointers are stable
+        long hits = 0;
+        long misses = 0;
+        long loaded = 0;
+        std::mutex mut;
+    };
+
+    Cache s_cache;
+
+    uint32_t checksum(const char* data, size_t len)
+    {
+        uint32_t h = 0x811c9dc5;
+        for (size_t i = 0; i < len; i++)
+            h = (h ^ (unsigned char) data[i]) * 0x01000193;
+        return h;
+    }
+
+    //! add a result to the in-memory index (caller holds the mutex)
+    void index(const ResultCache::Key& key, const SearchSDK_Match* matches, int count)
+    {
+        Entry entry = { (uint32_t) s_cache.matches.size(), (uint32_t) count };
+        for (int i = 0; i < count; i++)
+        {
+            const wstring& name = *s_cache.names.insert(matches[i].m_matchName ? matches[i].m_matchName : L"").first;
+            s_cache.matches.push_back({ matches[i].m_matchPercentage, name.c_str(), matches[i].m_bLocked });
+        }
+        s_cache.index[key] = entry;
+    }
+
+    //! parse one record at p, adding it to the index
+    //! @returns bytes consumed, or 0 if the record is torn or corrupt
+    size_t loadRecord(const char* p, const char* end)
+    {
+        ResultCache::RecordHeader header;
+        if ((size_t) (end - p) < sizeof(header))
+            return 0;
+        memcpy(&header, p, sizeof(header));
+        if (header.magic != ResultCache::RECORD_MAGIC || header.length > (size_t) (end - p) - sizeof(header))
+            return 0;
+
+        const char* body = p + sizeof(header);
+        const char* bodyEnd = body + header.length;
+        if (checksum(body, header.length) != header.checksum)
+            return 0;
+
+        // the checksum doesn't cover the header, so don't trust its count
+        if (header.matchCount > header.length / sizeof(BinaryMatch))
+            return 0;
+
+        static thread_local vector<SearchSDK_Match> matches;
+        static thread_local vector<wstring> names;
+        matches.resize(header.matchCount);
+        names.resize(header.matchCount);
+
+        const char* q = body;
+        for (uint32_t i = 0; i < header.matchCount; i++)
+        {
+            BinaryMatch record;
+            if ((size_t) (bodyEnd - q) < sizeof(record))
+                return 0;
+            memcpy(&record, q, sizeof(record));
+            q += sizeof(record);
+            if (record.nameBytes > (size_t) (bodyEnd - q))
+                return 0;
+
+            names[i].clear();
+            Util::appendWide(names[i], q, record.nameBytes);
+            q += record.nameBytes;
+
+            matches[i].m_matchPercentage = record.percentage;
+            matches[i].m_matchName = &names[i][0];
+            matches[i].m_bLocked = (record.flags & BinaryProtocol::MATCH_LOCKED) != 0;
+        }
+
+        ResultCache::Key key;
+        key.a = header.keyA;
+        key.b = header.keyB;
+        index(key, matches.data(), (int) header.matchCount);
+        return sizeof(header) + header.length;
+    }
+
+    FILE* openFile(const wstring& pathname, const wchar_t* mode)
+    {
+#ifdef _WIN32
+        return _wfopen(pathname.c_str(), mode);
+#else
+        return fopen(Util::toString(pathname).c_str(), Util::toString(mode).c_str());
+#endif
+    }
+}
+
+bool ResultCache::open(const wstring& pathname, uint64_t libraryFingerprint, bool reset)
+{
+    std::lock_guard<std::mutex> lock(s_cache.mut);
+
+    // read whatever is there
+    string contents;
+    if (reset)
+        Util::log(L"Resetting result cache %ls", pathname.c_str());
+    else if (FILE* f = openFile(pathname, L"rb"))
+    {
+        char buf[64 * 1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            contents.append(buf, n);
+        fclose(f);
+    }
+
+    size_t good = 0;
+    FileHeader header;
+    if (contents.size() >= sizeof(header))
+    {
+        memcpy(&header, contents.data(), sizeof(header));
+        if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) || header.version != VERSION)
+            Util::log(L"ERROR: %ls is not a version %u result cache; discarding it", pathname.c_str(), VERSION);
+        else if (header.fingerprint != libraryFingerprint)
+            Util::log(L"Result cache %ls was written by a different search library; discarding it", pathname.c_str());
+        else
+        {
+            good = sizeof(header);
+            const char* end = contents.data() + contents.size();
+            while (good < contents.size())
+            {
+                size_t len = loadRecord(contents.data() + good, end);
+                if (!len)
+                {
+                    Util::log(L"ERROR: dropping %u bytes of incomplete records from %ls",
+                        (unsigned) (contents.size() - good), pathname.c_str());
+                    break;
+                }
+                good += len;
+                s_cache.loaded++;
+            }
+        }
+    }
+
+    // rewrite the file if anything was discarded, else just append to it
+    if (good != contents.size() || good == 0)
+    {
+        s_cache.f = openFile(pathname, L"wb");
+        if (s_cache.f)
+        {
+            if (good == 0)
+            {
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+                header.version = VERSION;
+                header.fingerprint = libraryFingerprint;
+                fwrite(&header, sizeof(header), 1, s_cache.f);
+            }
+            else
+                fwrite(contents.data(), 1, good, s_cache.f);
+            fflush(s_cache.f);
+        }
+    }
+    else
+        s_cache.f = openFile(pathname, L"ab");
+
+    if (!s_cache.f)
+    {
+        Util::log(L"ERROR: unable to open result cache %ls", pathname.c_str());
+        s_cache.index.clear();
+        s_cache.matches.clear();
+        return false;
+    }
+
+    s_cache.pathname = pathname;
+    Util::log(L"Loaded %ld cached results from %ls", s_cache.loaded, pathname.c_str());
+    return true;
+}
+
+void ResultCache::close()
+{
+    std::lock_guard<std::mutex> lock(s_cache.mut);
+    if (!s_cache.f)
+        return;
+
+    long total = s_cache.hits + s_cache.misses;
+    Util::log(L"Result cache: %ld hits, %ld misses (%.1lf%% hit rate), %u results in %ls",
+        s_cache.hits, s_cache.misses, total ? 100.0 * s_cache.hits / total : 0.0,
+        (unsigned) s_cache.index.size(), s_cache.pathname.c_str());
+
+    fclose(s_cache.f);
+    s_cache.f = nullptr;
+}
+
+bool ResultCache::isOpen()
+{
+    return s_cache.f != nullptr;
+}
+
+ResultCache::Key ResultCache::key(const SpectrumView& m, int technique, int xUnits, int yUnits)
+{
+    // two independent 64-bit word-at-a-time hashes, for a 128-bit key
+    Key key;
+    key.a = 0xcbf29ce484222325ULL;
+    key.b = 0x9e3779b97f4a7c15ULL;
+
+    auto mix = [&](uint64_t w)
+    {
+        key.a = (key.a ^ w) * 0x100000001b3ULL;
+        key.a ^= key.a >> 29;
+        key.b = (key.b + w) * 0xbf58476d1ce4e5b9ULL;
+        key.b = (key.b << 31) | (key.b >> 33);
+    };
+
+    mix((uint64_t) m.pixels);
+    mix((uint64_t) technique);
+    mix((uint64_t) xUnits);
+    mix((uint64_t) yUnits);
+    mix((uint64_t) m.max_results);
+
+    uint64_t w;
+    for (int i = 0; i < m.pixels; i++)
+    {
+        memcpy(&w, &m.x[i], sizeof(w));
+        mix(w);
+    }
+    for (int i = 0; i < m.pixels; i++)
+    {
+        memcpy(&w, &m.y[i], sizeof(w));
+        mix(w);
+    }
+    return key;
+}
+
+bool ResultCache::lookup(const Key& key, vector<SearchSDK_Match>& buffer, int& count)
+{
+    std::lock_guard<std::mutex> lock(s_cache.mut);
+
+    auto it = s_cache.index.find(key);
+    if (it == s_cache.index.end())
+    {
+        s_cache.misses++;
+        return false;
+    }
+    s_cache.hits++;
+
+    const Entry& entry = it->second;
+    if (buffer.size() < entry.count)
+        buffer.resize(entry.count);
+
+    for (uint32_t i = 0; i < entry.count; i++)
+    {
+        const CachedMatch& cached = s_cache.matches[entry.first + i];
+        buffer[i].m_matchPercentage = cached.percentage;
+        buffer[i].m_matchName = const_cast<wchar_t*>(cached.name);
+        buffer[i].m_bLocked = cached.locked;
+    }
+    count = (int) entry.count;
+    return true;
+}
+
+void ResultCache::insert(const Key& key, const SearchSDK_Match* matches, int count)
+{
+    // format the record outside the lock
+    static thread_local string record;
+    record.assign(sizeof(RecordHeader), '\0');
+    for (int i = 0; i < count; i++)
+    {
+        size_t pos = record.size();
+        record.append(sizeof(BinaryMatch), '\0');
+        Util::appendUtf8(record, matches[i].m_matchName);
+
+        BinaryMatch match;
+        match.percentage = matches[i].m_matchPercentage;
+        match.flags = matches[i].m_bLocked ? BinaryProtocol::MATCH_LOCKED : 0;
+        match.nameBytes = (uint32_t) (record.size() - pos - sizeof(BinaryMatch));
+        memcpy(&record[pos], &match, sizeof(match));
+    }
+
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.length = (uint32_t) (record.size() - sizeof(header));
+    header.keyA = key.a;
+    header.keyB = key.b;
+    header.matchCount = (uint32_t) count;
+    header.checksum = checksum(record.data() + sizeof(header), header.length);
+    memcpy(&record[0], &header, sizeof(header));
+
+    std::lock_guard<std::mutex> lock(s_cache.mut);
+    if (!s_cache.f || s_cache.index.count(key))
+        return;
+
+    index(key, matches, count);
+    fwrite(record.data(), 1, record.size(), s_cache.f);
+    fflush(s_cache.f);
+}
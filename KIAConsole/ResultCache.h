@@ -0,0 +1,73 @@
+#ifndef KIACONSOLE_RESULT_CACHE_H
+#define KIACONSOLE_RESULT_CACHE_H
+
+#include "pch.h"
+
+#include "SearchSDK.h"
+#include "Measurement.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*! @brief Persistent cache of search results, keyed by spectrum content (--cache).
+
+    Reprocessing the same archives (e.g. while tuning thresholds) otherwise
+    repeats every SearchSDK search.  Each result is stored under a 128-bit
+    hash of the x and y arrays, technique, x/y units and max_results, with
+    the full match list SearchSDK returned, so a different min_confidence can
+    be applied to a cached result without searching again.
+
+    The file is append-only: a 32-byte header (magic "KIACACHE", version and
+    library fingerprint), then one record per result, each a
+    ResultCache::RecordHeader followed by matchCount BinaryMatch records and
+    their UTF-8 names (as in BinaryProtocol).  At startup the whole file is
+    read into an in-memory index.  A file written by a different search
+    library (see SearchLibrary::fingerprint) is discarded, as is any torn
+    record at its end.  The fingerprint can't see KnowItAll's databases, so
+    after installing or updating one the cache must be reset (--cache-reset).
+
+    One process at a time should use a given cache file.
+*/
+class ResultCache
+{
+    public:
+        struct Key
+        {
+            uint64_t a = 0;
+            uint64_t b = 0;
+
+            bool operator==(const Key& other) const { return a == other.a && b == other.b; }
+        };
+
+        #pragma pack(push, 1)
+        struct RecordHeader
+        {
+            uint32_t magic;             //!< RECORD_MAGIC ("KIAC")
+            uint32_t length;            //!< bytes following this header
+            uint64_t keyA;
+            uint64_t keyB;
+            uint32_t matchCount;
+            uint32_t checksum;          //!< FNV-1a of the bytes following this header
+        };
+        #pragma pack(pop)
+
+        static const uint32_t VERSION = 1;
+        static const uint32_t RECORD_MAGIC = 0x4341494b;    //!< "KIAC"
+
+        //! load (or create) the cache file
+        //! @param reset  discard any results already in it
+        static bool open(const std::wstring& pathname, uint64_t libraryFingerprint, bool reset = false);
+        static void close();                                //!< log hit / miss counts
+        static bool isOpen();
+
+        static Key key(const SpectrumView& m, int technique, int xUnits, int yUnits);
+
+        //! copy a cached result into buffer (growing it as needed)
+        //! @returns false on a miss
+        static bool lookup(const Key& key, std::vector<SearchSDK_Match>& buffer, int& count);
+
+        static void insert(const Key& key, const SearchSDK_Match* matches, int count);
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "pch.h"
+
+#include "SearchLibrary.h"
+
+#include "Util.h"
+
+#ifdef _WIN32
+#include <atlconv.h>        // for LPOLESTR, etc
+#include <atlstr.h>         // for CString
+#include <winbase.h>        // for SetDllDirectory?
+#else
+#include <dlfcn.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+using std::wstring;
+
+//! open the given library, returning its module handle (or NULL)
+void* SearchLibrary::open(const wstring& pathname)
+{
+    Util::log(L"Trying to load %ls", pathname.c_str());
+#ifdef _WIN32
+    return ::LoadLibrary(pathname.c_str());
+#else
+    void* handle = dlopen(Util::toString(pathname).c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        Util::log(L"dlopen failed: %ls", Util::toWstring(dlerror()).c_str());
+    return handle;
+#endif
+}
+
+void* SearchLibrary::getSymbol(const char* name)
+{
+#ifdef _WIN32
+    return reinterpret_cast<void*>(::GetProcAddress(static_cast<HMODULE>(module), name));
+#else
+    return dlsym(module, name);
+#endif
+}
+
+//! given a loaded DLL, grab key function handles
+bool SearchLibrary::mapFunctionHandles()
+{
+    Util::log(L"Obtaining function handles");
+    initFn                    = reinterpret_cast<SearchSDK_InitFn                   >(getSymbol("SearchSDK_Init"));
+    exitFn                    = reinterpret_cast<SearchSDK_ExitFn                   >(getSymbol("SearchSDK_Exit"));
+    openSearchFn              = reinterpret_cast<SearchSDK_OpenSearchFn             >(getSymbol("SearchSDK_OpenSearch"));
+    closeSearchFn             = reinterpret_cast<SearchSDK_CloseSearchFn            >(getSymbol("SearchSDK_CloseSearch"));
+    runSearchEvenlySpacedFn   = reinterpret_cast<SearchSDK_RunSearchEvenlySpacedFn  >(getSymbol("SearchSDK_RunSearchEvenlySpaced"));
+    runSearchUnevenlySpacedFn = reinterpret_cast<SearchSDK_RunSearchUnevenlySpacedFn>(getSymbol("SearchSDK_RunSearchUnevenlySpaced"));
+    cancelSearchFn            = reinterpret_cast<SearchSDK_CancelSearchFn           >(getSymbol("SearchSDK_CancelSearch"));
+    getProgressPercentageFn   = reinterpret_cast<SearchSDK_GetProgressPercentageFn  >(getSymbol("SearchSDK_GetProgressPercentage"));
+
+    if (!initFn                    ||
+        !exitFn                    ||
+        !openSearchFn              ||
+        !closeSearchFn             ||
+        !runSearchEvenlySpacedFn   ||
+        !runSearchUnevenlySpacedFn ||
+        !cancelSearchFn            ||
+        !getProgressPercentageFn)
+    {
+        Util::log(L"ERROR: could not obtain one or more search handles");
+        return false;
+    }
+    return true;
+}
+
+bool SearchLibrary::load(const wstring& pathname)
+{
+    module = open(pathname);
+    if (!module)
+    {
+        Util::log(L"ERROR: could not load %ls", pathname.c_str());
+        return false;
+    }
+    this->pathname = pathname;
+
+    // Take handles to library function entry points
+    return mapFunctionHandles();
+}
+
+uint64_t SearchLibrary::fingerprint() const
+{
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_wstat64(pathname.c_str(), &st) == 0)
+#else
+    struct stat st;
+    if (stat(Util::toString(pathname).c_str(), &st) == 0)
+#endif
+    {
+        size = (uint64_t) st.st_size;
+        mtime = (uint64_t) st.st_mtime;
+    }
+
+    // FNV-1a over the pathname, then size and mtime
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&](const void* data, size_t len)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; i++)
+            h = (h ^ p[i]) * 0x100000001b3ULL;
+    };
+    mix(pathname.data(), pathname.size() * sizeof(wchar_t));
+    mix(&size, sizeof(size));
+    mix(&mtime, sizeof(mtime));
+    return h;
+}
+
+#ifdef _WIN32
+
+//! load the SearchSDK.DLL
+bool SearchLibrary::load()
+{
+    static const GUID clsid = {0xd8711b25, 0x71ca, 0x11d3, {0x9d, 0xfd, 0x0, 0xe0, 0x81, 0x10, 0x22, 0x90}};
+    LPOLESTR lpOleStr = 0;
+    ::StringFromCLSID(clsid, &lpOleStr);
+    if (!lpOleStr || !lpOleStr[0])
+    {
+        Util::log(L"ERROR: could not generate Class GUID");
+        return false;
+    }
+    Util::log(L"Generated Class GUID %ls", lpOleStr);
+
+    WCHAR sToFind[256];
+    swprintf_s(sToFind, L"CLSID\\%s\\LocalServer32", lpOleStr);
+    ::CoTaskMemFree(lpOleStr);
+
+    Util::log(L"Looking for registry key: %ls", sToFind);
+    HKEY hKey=0;
+    ::RegOpenKey(HKEY_CLASSES_ROOT, sToFind, &hKey);
+    if (!hKey)
+    {
+        Util::log(L"ERROR: could not find registry key: %ls", sToFind);
+        return false;
+    }
+
+    WCHAR filePath[_MAX_PATH+12] = {0};
+    LONG len = _MAX_PATH;
+    Util::log(L"Querying for filepath associated with registry key");
+    ::RegQueryValue(hKey, L"", filePath, &len);
+    ::RegCloseKey(hKey);
+    if (!filePath[0])
+    {
+        Util::log(L"ERROR: could not find filepath associated with registry key");
+        return false;
+    }
+
+    WCHAR drive[_MAX_DRIVE];
+    WCHAR dir[_MAX_DIR+12];
+    _wsplitpath(filePath, drive, dir, 0, 0);
+    _wmakepath(filePath, drive, dir, 0, 0);
+
+    // In order for the SearchSDK.dll to load all of its dependencies, it is necessary to set the DLL directory
+    Util::log(L"Setting DDL search path to %ls", filePath);
+    SetDllDirectory(filePath);
+
+    wcscat(filePath, L"SearchSDK");
+    wcscat(filePath, L".dll");
+
+    module = open(filePath);
+    if (!module)
+    {
+        // Try to load the 32 bit version, if available.
+
+        // move search dir to 32-bit dir
+        wcscat(dir, L"32 bit DLLs\\");
+        _wmakepath(filePath, drive, dir, 0, 0);
+        SetDllDirectory(filePath);
+
+        // load 32-bit DLL
+        _wmakepath(filePath, drive, dir, L"SearchSDK", L".dll");
+        module = open(filePath);
+        if (!module)
+        {
+            Util::log(L"ERROR: could not find or load SearchSDK.dll");
+            return false;
+        }
+    }
+    pathname = filePath;
+
+    // Take handles to DLL function entry points
+    return mapFunctionHandles();
+}
+
+#else
+
+//! there is no installed KnowItAll to find outside Windows
+bool SearchLibrary::load()
+{
+    Util::log(L"ERROR: no SearchSDK library specified (try --library path/to/libMockSearchSDK.so)");
+    return false;
+}
+
+#endif
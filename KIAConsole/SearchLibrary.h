@@ -0,0 +1,52 @@
+#ifndef KIACONSOLE_SEARCH_LIBRARY_H
+#define KIACONSOLE_SEARCH_LIBRARY_H
+
+#include "pch.h"
+
+#include "SearchSDK.h"      // KnowItAll API
+
+#include <cstdint>
+#include <string>
+
+/*! @brief Loads the KnowItAll SearchSDK and holds its function handles.
+
+    By default (Windows only), SearchSDK.dll is located through the registry
+    entry of the installed KnowItAll executable, as in Wiley's sample code.
+
+    Alternately, any DLL or shared object exporting the eight SearchSDK_*
+    entry points can be loaded by pathname (LoadLibrary on Windows, dlopen
+    elsewhere).  This is how MockSearchSDK is used to exercise KIAConsole on
+    build machines without a KnowItAll license.
+*/
+class SearchLibrary
+{
+    public:
+        // function pointers into the SearchSDK library
+        SearchSDK_InitFn                    initFn                    = nullptr;
+        SearchSDK_ExitFn                    exitFn                    = nullptr;
+        SearchSDK_OpenSearchFn              openSearchFn              = nullptr;
+        SearchSDK_CloseSearchFn             closeSearchFn             = nullptr;
+        SearchSDK_RunSearchEvenlySpacedFn   runSearchEvenlySpacedFn   = nullptr;
+        SearchSDK_RunSearchUnevenlySpacedFn runSearchUnevenlySpacedFn = nullptr;
+        SearchSDK_CancelSearchFn            cancelSearchFn            = nullptr;
+        SearchSDK_GetProgressPercentageFn   getProgressPercentageFn   = nullptr;
+
+        std::wstring pathname;                      //!< library actually loaded
+
+        bool load();                                //!< find KnowItAll's SearchSDK.dll through the registry
+        bool load(const std::wstring& pathname);    //!< load a specific DLL or shared object
+
+        //! identifies the loaded library build (pathname, size and modification
+        //! time), so results it produced aren't mistaken for another's; the
+        //! SDK exposes nothing of its databases, so they aren't covered
+        uint64_t fingerprint() const;
+
+    private:
+        void* module = nullptr;
+
+        void* open(const std::wstring& pathname);
+        void* getSymbol(const char* name);
+        bool mapFunctionHandles();
+};
+
+#endif
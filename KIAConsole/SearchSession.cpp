@@ -0,0 +1,336 @@
+#include "pch.h"
+
+#include "SearchSession.h"
+
+#include "BinaryProtocol.h"
+#include "ResultCache.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cwchar>
+
+using std::chrono::steady_clock;
+
+SearchSession::SearchSession(const SearchLibrary& library, int maxUses, int timeoutMS, int progressMS)
+    : library(library),
+      maxUses(maxUses),
+      timeoutMS(timeoutMS),
+      progressMS(progressMS),
+      buffer(1)
+{
+}
+
+SearchSession::~SearchSession()
+{
+    close();
+}
+
+bool SearchSession::open()
+{
+    auto start = steady_clock::now();
+    handle = library.openSearchFn();
+    if (!handle)
+        return false;
+
+    stats.record(Stats::STAGE_OPEN, steady_clock::now() - start);
+    uses = 0;
+    return true;
+}
+
+void SearchSession::close()
+{
+    if (!handle)
+        return;
+
+    // releases any resources associated with this search, including match names
+    auto start = steady_clock::now();
+    library.closeSearchFn(handle);
+    stats.record(Stats::STAGE_CLOSE, steady_clock::now() - start);
+
+    handle = nullptr;
+}
+
+void SearchSession::configure(const Options& opts, bool live)
+{
+    qualityGate(opts.quality);
+    preprocess(opts.preprocess);
+    prescreen(opts.localConfidence, opts.localMargin, opts.localVerify);
+    resample(opts.resample);
+    if (live && opts.coalesce > 0)
+        coalesce(opts.coalesce, opts.coalesceWindow, opts.coalesceVerify);
+}
+
+void SearchSession::coalesce(double threshold, int window, bool verify)
+{
+    coalescer.reset(new Coalescer(threshold, window));
+    verifyCoalescing = verify;
+}
+
+void SearchSession::prescreen(double confidence, double margin, bool verify)
+{
+    prescreening = LocalMatcher::isLoaded();
+    localConfidence = confidence;
+    localMargin = margin;
+    verifyLocal = verify;
+}
+
+void SearchSession::qualityGate(const QualityGate::Settings& settings)
+{
+    gate.reset(settings.enabled ? new QualityGate(settings) : nullptr);
+}
+
+void SearchSession::preprocess(const Preprocessor::Settings& settings)
+{
+    preprocessor.reset(settings.enabled() ? new Preprocessor(settings) : nullptr);
+}
+
+void SearchSession::resample(const Resampler::Settings& settings)
+{
+    resampler.reset(settings.enabled() ? new Resampler(settings) : nullptr);
+}
+
+bool SearchSession::search(const Measurement& m)
+{
+    return search(m.view());
+}
+
+bool SearchSession::search(const SpectrumView& spectrum)
+{
+    count = 0;
+    canceled = false;
+    failed = false;
+    wasReused = false;
+    wasLocal = false;
+    localScore = 0;
+    watch.progress.clear();
+    deadlineMS = 0;
+    report = QualityGate::Report();
+
+    // a malformed request (see Measurement::parseLine) must not size the match buffer
+    if (spectrum.pixels < 2 || spectrum.max_results < 1 || spectrum.max_results > BinaryProtocol::MAX_RESULTS)
+    {
+        Util::log(L"ERROR: invalid request (%d pixels, max_results %d); not searched", spectrum.pixels, spectrum.max_results);
+        failed = true;
+        return true;
+    }
+
+    // don't waste a search on a spectrum that can't match anything
+    if (gate)
+    {
+        auto start = steady_clock::now();
+        gate->check(spectrum, report);
+        stats.record(Stats::STAGE_QUALITY, steady_clock::now() - start);
+        stats.qualityChecks++;
+        if (report.reason != QualityGate::PASS)
+        {
+            stats.rejected[report.reason]++;
+            return true;
+        }
+    }
+
+    // everything from here on (coalescing and the cache included) sees the
+    // preprocessed and resampled spectrum
+    SpectrumView cleaned = spectrum;
+    if (preprocessor)
+        preprocessor->process(spectrum, cleaned, stats);
+
+    SpectrumView m = cleaned;
+    if (resampler && !resampler->resample(cleaned, m))
+    {
+        Util::log(L"ERROR: spectrum has too few points within the region of interest to resample");
+        failed = true;
+        return true;
+    }
+
+    // reuse the result of a recent, nearly identical spectrum
+    const SearchSDK_Match* prior = nullptr;
+    int priorCount = 0;
+    if (coalescer)
+    {
+        prior = coalescer->find(m, priorCount, similarity, reusedAgeSec);
+        stats.recordSimilarity(similarity, prior != nullptr);
+
+        if (prior && !verifyCoalescing)
+        {
+            if ((int) buffer.size() < priorCount)
+                buffer.resize(priorCount);
+            std::copy(prior, prior + priorCount, buffer.begin());
+            count = priorCount;
+            wasReused = true;
+            return true;
+        }
+    }
+
+    // serve repeat spectra from the result cache, without touching a handle
+    ResultCache::Key key;
+    bool cached = false;
+    if (ResultCache::isOpen())
+    {
+        key = ResultCache::key(m, SEARCHSDK_TECHNIQUE_RAMAN, SEARCHSDK_XUNIT_WAVENUMBERS, SEARCHSDK_YUNIT_ARBITRARYINTENSITY);
+        cached = ResultCache::lookup(key, buffer, count);
+        if (cached)
+            stats.cacheHits++;
+    }
+
+    // answer confident matches locally (unless reusing a prior result anyway)
+    int hitCount = 0;
+    if (!cached && prescreening && !prior)
+        hitCount = matchLocally(spectrum, m.max_results);
+
+    if (hitCount && !verifyLocal)
+    {
+        useLocalMatches(hitCount);
+        return true;
+    }
+
+    if (!cached)
+    {
+        if (!runSearch(m))
+            return false;
+        if (ResultCache::isOpen() && !canceled && !failed)
+            ResultCache::insert(key, matches(), count);
+    }
+
+    if (hitCount)
+    {
+        // verifying: compare the top match, then serve the local result as usual
+        bool agree = count > 0 && LocalMatcher::sameName(buffer[0].m_matchName, LocalMatcher::name(hits[0].compound));
+        stats.localVerified++;
+        if (agree)
+            stats.localAgreed++;
+
+        useLocalMatches(hitCount);
+        canceled = failed = false;
+        return true;
+    }
+
+    if (prior)
+    {
+        // verifying: compare the top match, then serve the reused result as usual
+        bool agree = count > 0 && priorCount > 0 && !wcscmp(buffer[0].m_matchName, prior[0].m_matchName);
+        stats.coalesceVerified++;
+        if (agree)
+            stats.coalesceAgreed++;
+
+        if ((int) buffer.size() < priorCount)
+            buffer.resize(priorCount);
+        std::copy(prior, prior + priorCount, buffer.begin());
+        count = priorCount;
+        canceled = failed = false;
+        wasReused = true;
+    }
+    else if (coalescer && !canceled && !failed)
+        coalescer->add(m, matches(), count);
+    return true;
+}
+
+//! score spectrum against the LocalMatcher's references
+//! @returns how many hits there are, if the best is confident and clear (else 0)
+int SearchSession::matchLocally(const SpectrumView& spectrum, int maxResults)
+{
+    if ((int) hits.size() < maxResults)
+        hits.resize(maxResults);
+
+    auto start = steady_clock::now();
+    int n = LocalMatcher::match(spectrum, hits.data(), maxResults);
+    stats.record(Stats::STAGE_PRESCREEN, steady_clock::now() - start);
+    stats.localChecks++;
+
+    if (!n)
+        return 0;
+    localScore = hits[0].score;
+    if (hits[0].score < localConfidence || (n > 1 && hits[0].score - hits[1].score < localMargin))
+        return 0;
+
+    stats.localHits++;
+    return n;
+}
+
+//! replace the match buffer with the first hitCount local hits
+void SearchSession::useLocalMatches(int hitCount)
+{
+    if ((int) buffer.size() < hitCount)
+        buffer.resize(hitCount);
+
+    // names are owned by the LocalMatcher, so outlive any handle
+    for (int i = 0; i < hitCount; i++)
+    {
+        buffer[i].m_matchPercentage = hits[i].score;
+        buffer[i].m_matchName = const_cast<wchar_t*>(LocalMatcher::name(hits[i].compound));
+        buffer[i].m_bLocked = false;
+    }
+    count = hitCount;
+    wasLocal = true;
+}
+
+//! search on a warm handle, opening one if needed (evenly spaced, if m was resampled)
+//! @returns false if no handle could be opened
+bool SearchSession::runSearch(const SpectrumView& m)
+{
+    if (handle && maxUses > 0 && uses >= maxUses)
+        close();
+
+    if (!handle && !open())
+        return false;
+
+    // grow (never shrink) the reusable match buffer
+    if ((int) buffer.size() < m.max_results)
+        buffer.resize(m.max_results);
+
+    count = m.max_results;
+    uses++;
+
+    Util::log(resampler ? L"Calling RunSearchEvenlySpaced" : L"Calling RunSearchUnevenlySpaced");
+
+    // requests may override the default deadline (0 = none)
+    deadlineMS = m.timeout_ms >= 0 ? m.timeout_ms : timeoutMS;
+    bool watched = deadlineMS > 0 || progressMS > 0;
+    if (watched)
+        Watchdog::instance().begin(watch, library, handle, deadlineMS, progressMS, !Util::isCapturing());
+
+    auto start = steady_clock::now();
+    bool ok;
+    if (resampler)
+        ok = library.runSearchEvenlySpacedFn(
+            handle,
+            SEARCHSDK_TECHNIQUE_RAMAN,
+            m.y,
+            m.pixels,
+            m.x[0],
+            m.x[m.pixels - 1],
+            SEARCHSDK_XUNIT_WAVENUMBERS,
+            SEARCHSDK_YUNIT_ARBITRARYINTENSITY,
+            matches(),
+           &count);
+    else
+        ok = library.runSearchUnevenlySpacedFn(
+            handle,
+            SEARCHSDK_TECHNIQUE_RAMAN,
+            m.x,
+            m.y,
+            m.pixels,
+            SEARCHSDK_XUNIT_WAVENUMBERS,
+            SEARCHSDK_YUNIT_ARBITRARYINTENSITY,
+            matches(),
+           &count);
+    stats.record(Stats::STAGE_SEARCH, steady_clock::now() - start);
+
+    if (watched && Watchdog::instance().end(watch))
+    {
+        // whatever the search returned, the caller has given up on it
+        canceled = true;
+        count = 0;
+        close();
+        stats.timeouts++;
+    }
+    else if (!ok)
+    {
+        Util::log(L"ERROR: search failed; recycling search handle");
+        failed = true;
+        count = 0;
+        close();
+        stats.recycles++;
+    }
+    return true;
+}
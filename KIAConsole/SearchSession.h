@@ -0,0 +1,151 @@
+#ifndef KIACONSOLE_SEARCH_SESSION_H
+#define KIACONSOLE_SEARCH_SESSION_H
+
+#include "pch.h"
+
+#include "SearchLibrary.h"
+#include "Coalescer.h"
+#include "LocalMatcher.h"
+#include "Measurement.h"
+#include "Options.h"
+#include "Preprocessor.h"
+#include "QualityGate.h"
+#include "Resampler.h"
+#include "Stats.h"
+#include "Watchdog.h"
+
+#include <memory>
+#include <vector>
+
+/*! @brief A warm search handle and match buffer, reused across measurements.
+
+    Opening and closing a SEARCHSDK_HANDLE for every spectrum is measurable
+    overhead in streaming mode, so a session keeps one handle open until
+    shutdown, or until it has served maxUses searches (0 = no limit).  A
+    handle whose search fails is closed and reopened on next use, in case it
+    was left in a bad state.
+
+    With a ResultCache open, spectra already searched are answered from the
+    cache, and new results are added to it (unless the search failed or
+    timed out).
+
+    With the quality gate enabled, each raw spectrum is checked first, and
+    one rejected (see QualityGate) is answered with no matches and no search;
+    rejection() says why.
+
+    With preprocessing enabled, each spectrum is first despiked, smoothed,
+    baseline-corrected and/or normalized (see Preprocessor).  With
+    resampling enabled, it is then resampled onto a uniform
+    grid (see Resampler) and searched with SearchSDK_RunSearchEvenlySpaced.
+
+    With coalescing enabled (live streaming), a spectrum nearly identical to
+    one searched moments ago reuses that result instead; see Coalescer.
+
+    With pre-screening enabled (--references), a spectrum not otherwise
+    answered is first scored against the LocalMatcher's references; if its
+    best compound scores at least confidence, and beats the runner-up by at
+    least margin, those scores are returned as its matches without searching.
+    The raw spectrum is pre-screened, as the references are raw too.  Local
+    results aren't added to the ResultCache, being nearly as cheap to redo.
+
+    If a deadline applies (timeoutMS, or the measurement's own timeout_ms),
+    the Watchdog cancels searches that overrun it; a canceled search returns
+    no matches, reports timedOut(), and its handle is likewise recycled.
+
+    Match names are owned by the handle, so results are only valid until the
+    next call to search() or close().
+*/
+class SearchSession
+{
+    public:
+        Stats stats;            //!< open / search / close latency, plus whatever the caller records
+
+        SearchSession(const SearchLibrary& library, int maxUses = 0, int timeoutMS = 0, int progressMS = 0);
+        ~SearchSession();
+
+        //! @returns false if no handle could be opened (a failed search is
+        //!          logged, and leaves zero matches)
+        bool search(const Measurement& m);
+        bool search(const SpectrumView& m);             //!< e.g. straight from a SharedRing slot
+        void close();
+
+        SearchSDK_Match* matches() { return &buffer[0]; }
+        int matchCount() const { return count; }
+        bool isOpen() const { return handle != nullptr; }
+        bool timedOut() const { return canceled; }      //!< last search was canceled at its deadline
+        int deadline() const { return deadlineMS; }     //!< of last search, in ms (0 = none)
+
+        //! Watchdog samples of the last search's progress (if --progress-ms), for
+        //! the caller to log with its other output (empty unless it was
+        //! capturing its log; otherwise they were logged as taken)
+        const std::vector<Watchdog::Progress>& progress() const { return watch.progress; }
+
+        //! set up the quality gate, preprocessing, pre-screening and resampling
+        //! from opts, plus coalescing if live (the streaming modes)
+        void configure(const Options& opts, bool live);
+
+        //! reuse results of recent near-identical spectra (see Coalescer)
+        //! @param verify  search anyway, counting how often the top match agrees
+        void coalesce(double threshold, int window, bool verify);
+
+        //! clean up spectra before searching them (does nothing unless settings.enabled())
+        void preprocess(const Preprocessor::Settings& settings);
+
+        //! resample spectra onto a uniform grid, searching them evenly spaced
+        //! (does nothing unless settings.enabled())
+        void resample(const Resampler::Settings& settings);
+
+        //! reject spectra not worth searching (does nothing unless settings.enabled)
+        void qualityGate(const QualityGate::Settings& settings);
+
+        //! answer confident matches from the LocalMatcher (which must be loaded)
+        //! @param confidence  minimum score (0 - 1) of the best compound
+        //! @param margin      minimum lead of the best compound over the next
+        //! @param verify      search anyway, counting how often the top match agrees
+        void prescreen(double confidence, double margin, bool verify);
+
+        bool reused() const { return wasReused; }       //!< last result came from the Coalescer
+        double similarity = 0;                          //!< of last reused spectrum to its original
+        double reusedAgeSec = 0;                        //!< age of last reused result
+
+        bool matchedLocally() const { return wasLocal; }    //!< last result came from the LocalMatcher
+        double localScore = 0;                          //!< of last spectrum's best local compound
+
+        //! why the last spectrum was rejected (QualityGate::PASS if it wasn't)
+        QualityGate::Reason rejection() const { return report.reason; }
+        const QualityGate::Report& quality() const { return report; }      //!< of last spectrum checked
+
+    private:
+        const SearchLibrary& library;
+        SEARCHSDK_HANDLE handle = nullptr;
+        int maxUses = 0;
+        int uses = 0;
+        int count = 0;
+        int timeoutMS = 0;      //!< default deadline per search (0 = none)
+        int progressMS = 0;     //!< log progress of searches running this long (0 = never)
+        int deadlineMS = 0;     //!< of the last search
+        Watchdog::Watch watch;  //!< of the last search
+        bool canceled = false;
+        bool failed = false;
+        bool wasReused = false;
+        bool verifyCoalescing = false;
+        bool prescreening = false;
+        bool verifyLocal = false;
+        bool wasLocal = false;
+        double localConfidence = 0;
+        double localMargin = 0;
+        std::vector<LocalMatcher::Hit> hits;
+        QualityGate::Report report;
+        std::unique_ptr<QualityGate> gate;
+        std::unique_ptr<Coalescer> coalescer;
+        std::unique_ptr<Preprocessor> preprocessor;
+        std::unique_ptr<Resampler> resampler;
+        std::vector<SearchSDK_Match> buffer;
+
+        bool open();
+        bool runSearch(const SpectrumView& m);
+        int matchLocally(const SpectrumView& spectrum, int maxResults);
+        void useLocalMatches(int hitCount);
+};
+
+#endif
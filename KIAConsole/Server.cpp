@@ -0,0 +1,451 @@
+#include "pch.h"
+
+#include "Server.h"
+
+#include "JsonlWriter.h"
+#include "Measurement.h"
+#include "Processing.h"
+#include "SearchSession.h"
+#include "Util.h"
+
+#include <csignal>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::shared_ptr;
+using std::unique_ptr;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+//! one client, with its own search session and queue of parsed requests
+struct Server::Connection
+{
+    int id = 0;
+    int fd = -1;
+    steady_clock::time_point connected = steady_clock::now();
+    unique_ptr<SearchSession> session;
+    Stats parseStats;                               //!< recorded by the reader thread
+    std::deque<unique_ptr<Measurement>> pending;    //!< guarded by Server::mut
+    bool busy = false;                              //!< a worker is searching one of its requests
+    int unsent = 0;                                 //!< results not yet written (guarded by Server::mut)
+    bool finished = false;                          //!< reader thread is done, and can be joined
+    std::thread reader;
+    std::thread writer;
+
+    //! output waiting for the writer thread
+    struct Outgoing
+    {
+        string bytes;
+        bool result;                                //!< counted in unsent
+    };
+    std::mutex sendMut;                             //!< guards outbox and closing
+    std::condition_variable sendable;
+    std::deque<Outgoing> outbox;
+    bool closing = false;                           //!< nothing more will be sent
+
+    //! queue log lines for the writer thread to send back to the client
+    void send(const wstring& lines, bool result = false)
+    {
+        if (lines.empty() && !result)
+            return;
+        std::lock_guard<std::mutex> lock(sendMut);
+        outbox.push_back(Outgoing { Util::toString(lines), result });
+        sendable.notify_one();
+    }
+
+    //! let the writer thread finish what's queued, and exit
+    void endSending()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sendMut);
+            closing = true;
+        }
+        sendable.notify_one();
+    }
+};
+
+#ifndef _WIN32
+
+static volatile std::sig_atomic_t s_signaled = 0;
+
+static void onSignal(int)
+{
+    s_signaled = 1;
+}
+
+namespace
+{
+    //! lets Measurement parse requests straight off a socket
+    class SocketBuf : public std::streambuf
+    {
+        public:
+            explicit SocketBuf(int fd) : fd(fd) {}
+
+        protected:
+            int_type underflow() override
+            {
+                ssize_t n;
+                do
+                    n = ::read(fd, buf, sizeof(buf));
+                while (n < 0 && errno == EINTR);
+                if (n <= 0)
+                    return traits_type::eof();
+                setg(buf, buf, buf + n);
+                return traits_type::to_int_type(*gptr());
+            }
+
+        private:
+            int fd;
+            char buf[64 * 1024];
+    };
+}
+
+#endif
+
+Server::Server(const SearchLibrary& library, const Options& opts)
+    : library(library),
+      opts(opts)
+{
+}
+
+Server::~Server()
+{
+#ifndef _WIN32
+    if (listenFD >= 0)
+        ::close(listenFD);
+#endif
+}
+
+bool Server::run()
+{
+#ifdef _WIN32
+    Util::log(L"ERROR: --serve is not supported on Windows");
+    return false;
+#else
+    const string path = Util::toString(opts.serve);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        Util::log(L"ERROR: socket path too long: %ls", opts.serve.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    // a socket file left behind by a server that didn't exit cleanly would
+    // make bind fail, so remove it (unless a server is still listening on it)
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (sockaddr*) &addr, sizeof(addr)) == 0)
+    {
+        ::close(probe);
+        Util::log(L"ERROR: a server is already listening on %ls", opts.serve.c_str());
+        return false;
+    }
+    if (probe >= 0)
+        ::close(probe);
+    unlink(path.c_str());
+
+    listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFD < 0 || bind(listenFD, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(listenFD, 16) != 0)
+    {
+        Util::log(L"ERROR: unable to listen on %ls: %ls", opts.serve.c_str(), Util::toWstring(strerror(errno)).c_str());
+        return false;
+    }
+
+    // clients may disconnect mid-reply
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Util::log(L"Serving on %ls with %d workers", opts.serve.c_str(), opts.jobs);
+    Util::flushLog();
+    auto start = steady_clock::now();
+
+    for (int i = 0; i < opts.jobs; i++)
+        workers.emplace_back(&Server::runWorker, this);
+
+    // poll, so a signal is noticed promptly even if no client ever connects
+    while (!s_signaled)
+    {
+        pollfd pfd = { listenFD, POLLIN, 0 };
+        if (poll(&pfd, 1, 250) > 0 && (pfd.revents & POLLIN))
+            accept();
+        reap(false);
+    }
+    Util::log(L"Signal received...shutting down");
+
+    ::close(listenFD);
+    listenFD = -1;
+    unlink(path.c_str());
+
+    // end every connection's input; each reader then waits for its own
+    // queued requests to finish
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        for (auto& conn : connections)
+            shutdown(conn->fd, SHUT_RD);
+    }
+    reap(true);
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopping = true;
+    }
+    work.notify_all();
+    for (auto& t : workers)
+        t.join();
+    workers.clear();
+
+    stats.report(duration<double>(steady_clock::now() - start).count());
+    Util::log(L"Server shut down");
+    return true;
+#endif
+}
+
+#ifndef _WIN32
+
+void Server::accept()
+{
+    int fd = ::accept(listenFD, nullptr, nullptr);
+    if (fd < 0)
+        return;
+
+    shared_ptr<Connection> conn(new Connection);
+    conn->fd = fd;
+    conn->session.reset(new SearchSession(library, opts.maxHandleUses, opts.timeoutMS, opts.progressMS));
+    conn->session->configure(opts, true);
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        conn->id = nextId++;
+        connections.push_back(conn);
+    }
+    Util::log(L"Client %d connected", conn->id);
+    conn->writer = std::thread(&Server::write, this, conn);
+    conn->reader = std::thread(&Server::read, this, conn);
+}
+
+//! parse one connection's requests until it sends QUIT or disconnects
+void Server::read(shared_ptr<Connection> conn)
+{
+    SocketBuf buf(conn->fd);
+    std::istream is(&buf);
+
+    while (true)
+    {
+        // the client sees our parse log, as it would from --streaming
+        wstring log;
+        unique_ptr<Measurement> m;
+        Util::beginCapture(&log);
+        try
+        {
+            m.reset(new Measurement(is));
+        }
+        catch (std::exception& e)
+        {
+            Util::log(L"ERROR: exception parsing streamed input: %ls", Util::toWstring(e.what()).c_str());
+        }
+        Util::endCapture();
+        conn->send(log);
+
+        if (!m || m->isQuit)
+            break;
+
+        std::unique_lock<std::mutex> lock(mut);
+        if (m->isStats)
+        {
+            // this connection's statistics, once its earlier requests are done
+            idle.wait(lock, [&]() { return conn->pending.empty() && !conn->busy; });
+            lock.unlock();
+
+            Stats connStats;
+            connStats.add(conn->parseStats);
+            connStats.add(conn->session->stats);
+            wstring report;
+            Util::beginCapture(&report);
+            connStats.report(duration<double>(steady_clock::now() - conn->connected).count());
+            Util::endCapture();
+            conn->send(report);
+            continue;
+        }
+
+        conn->parseStats.record(Stats::STAGE_PARSE, m->loadTime);
+
+        // backpressure: stop reading this client while it has enough queued
+        // (including replies it hasn't read yet)
+        idle.wait(lock, [&]() { return conn->pending.size() + (size_t) conn->unsent < (size_t) opts.maxInFlight; });
+        conn->pending.push_back(std::move(m));
+        if (!conn->busy && conn->pending.size() == 1)
+        {
+            ready.push_back(conn);
+            work.notify_one();
+        }
+    }
+
+    // finish whatever it sent before leaving
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        idle.wait(lock, [&]() { return conn->pending.empty() && !conn->busy; });
+    }
+    conn->session->close();
+    conn->endSending();
+    conn->writer.join();
+    ::close(conn->fd);
+
+    Stats connStats;
+    connStats.add(conn->parseStats);
+    connStats.add(conn->session->stats);
+    Util::log(L"Client %d disconnected (%ld requests)", conn->id, connStats.measurements);
+
+    std::lock_guard<std::mutex> lock(mut);
+    stats.add(connStats);
+    conn->finished = true;
+}
+
+/*! Search requests from whichever connection has waited longest.
+
+    A connection is in the ready queue while it has requests queued and none
+    running; after each request it goes to the back, so connections take
+    turns however many requests each has queued.
+*/
+void Server::runWorker()
+{
+    std::unique_lock<std::mutex> lock(mut);
+    while (true)
+    {
+        work.wait(lock, [&]() { return stopping || !ready.empty(); });
+        if (ready.empty())
+            return;
+
+        shared_ptr<Connection> conn = ready.front();
+        ready.pop_front();
+        conn->busy = true;
+        unique_ptr<Measurement> m = std::move(conn->pending.front());
+        conn->pending.pop_front();
+        lock.unlock();
+        idle.notify_all();
+
+        wstring log;
+        string record;
+        Util::beginCapture(&log);
+        JsonlWriter::beginCapture(&record);
+        if (m->request_id >= 0)
+            Util::log(L"RESULT_START, %ld", m->request_id);
+        try
+        {
+            if (!processMeasurement(*m, *conn->session))
+                Util::log(L"ERROR: could not open search handle");
+        }
+        catch (std::exception& e)
+        {
+            Util::log(L"ERROR: exception processing request: %ls", Util::toWstring(e.what()).c_str());
+        }
+        if (m->request_id >= 0)
+            Util::log(L"RESULT_END, %ld", m->request_id);
+        JsonlWriter::endCapture();
+        Util::endCapture();
+
+        // the connection's writer sends it, so a client that has stopped
+        // reading can't block this worker
+        lock.lock();
+        conn->unsent++;
+        lock.unlock();
+        conn->send(log, true);
+        JsonlWriter::print(record);
+
+        lock.lock();
+        conn->busy = false;
+        if (!conn->pending.empty())
+        {
+            ready.push_back(conn);
+            work.notify_one();
+        }
+        idle.notify_all();
+    }
+}
+
+//! send one connection's queued output, in order, until it is closing
+void Server::write(shared_ptr<Connection> conn)
+{
+    bool gone = false;      // the client has disconnected, so output is just discarded
+    while (true)
+    {
+        Connection::Outgoing out;
+        {
+            std::unique_lock<std::mutex> lock(conn->sendMut);
+            conn->sendable.wait(lock, [&]() { return conn->closing || !conn->outbox.empty(); });
+            if (conn->outbox.empty())
+                return;
+            out = std::move(conn->outbox.front());
+            conn->outbox.pop_front();
+        }
+
+        const char* p = out.bytes.data();
+        size_t remaining = out.bytes.size();
+        while (remaining > 0 && !gone)
+        {
+            ssize_t n = ::write(conn->fd, p, remaining);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                gone = true;
+            else
+            {
+                p += n;
+                remaining -= (size_t) n;
+            }
+        }
+
+        if (out.result)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                conn->unsent--;
+            }
+            idle.notify_all();
+        }
+    }
+}
+
+void Server::reap(bool all)
+{
+    std::list<shared_ptr<Connection>> done;
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        for (auto it = connections.begin(); it != connections.end(); )
+        {
+            if (all || (*it)->finished)
+            {
+                done.push_back(*it);
+                it = connections.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+    for (auto& conn : done)
+        conn->reader.join();
+}
+
+#else
+
+void Server::accept() {}
+void Server::read(shared_ptr<Connection>) {}
+void Server::write(shared_ptr<Connection>) {}
+void Server::runWorker() {}
+void Server::reap(bool) {}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef KIACONSOLE_SERVER_H
+#define KIACONSOLE_SERVER_H
+
+#include "pch.h"
+
+#include "Options.h"
+#include "SearchLibrary.h"
+#include "Stats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! @brief Long-lived identification daemon on a Unix domain socket (--serve).
+
+    Every ENLIGHTEN instance otherwise starts its own KIAConsole, paying
+    library load, SearchSDK_Init and library scanning each time.  A server
+    initializes the library once, then accepts any number of local clients,
+    each speaking the --streaming text protocol over its connection (and
+    receiving the same log lines back).
+
+    Each connection has its own search session (so its own handle, warm
+    across its requests), a reader thread which parses requests into a
+    queue, and a writer thread which sends its replies, so a client that
+    stops reading stalls only its own connection.  The reader stops reading
+    while opts.maxInFlight of its requests are queued, running or unsent.
+    A shared pool of opts.jobs workers
+    takes requests from the connections round-robin, one request per
+    connection at a time, so a client streaming continuously can't starve
+    the others.  Numbered requests are answered between "RESULT_START, id"
+    and "RESULT_END, id", as in --streaming.
+
+    Runs until SIGINT or SIGTERM.  POSIX only.
+*/
+class Server
+{
+    public:
+        Server(const SearchLibrary& library, const Options& opts);
+        ~Server();
+
+        //! listen on opts.serve and serve clients until signaled
+        //! @returns false if the socket could not be opened
+        bool run();
+
+    private:
+        struct Connection;
+
+        const SearchLibrary& library;
+        const Options& opts;
+        int listenFD = -1;
+
+        std::mutex mut;                     //!< guards everything below
+        std::condition_variable work;       //!< a connection became ready, or stopping
+        std::condition_variable idle;       //!< a request completed
+        std::list<std::shared_ptr<Connection>> connections;
+        std::deque<std::shared_ptr<Connection>> ready;  //!< with requests queued and none running
+        std::vector<std::thread> workers;
+        bool stopping = false;
+        int nextId = 1;
+        Stats stats;                        //!< of connections closed so far
+
+        void accept();
+        void read(std::shared_ptr<Connection> conn);
+        void write(std::shared_ptr<Connection> conn);
+        void runWorker();
+        void reap(bool all);                //!< join threads of closed connections (or all)
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "pch.h"
+
+#include "SharedRing.h"
+
+#include "Util.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters must be lock-free to be shared between processes");
+
+//! sanity limits, so a corrupt header can't describe an absurd mapping
+static const uint32_t MAX_SLOTS = 1 << 16;
+static const uint32_t MAX_PIXELS = 1 << 20;
+
+static size_t roundUp(size_t n)
+{
+    return (n + 63) & ~(size_t) 63;
+}
+
+SharedRing::~SharedRing()
+{
+    close();
+}
+
+size_t SharedRing::totalBytes(uint32_t slotCount, uint32_t maxPixels, uint32_t resultBytes)
+{
+    return roundUp(sizeof(SharedRingHeader))
+        + slotCount * roundUp(sizeof(SharedRequestSlot) + 2 * sizeof(double) * maxPixels)
+        + slotCount * roundUp(resultBytes);
+}
+
+void SharedRing::layout()
+{
+    requestStride = roundUp(sizeof(SharedRequestSlot) + 2 * sizeof(double) * pixels);
+    resultStride = roundUp(resultSize);
+    requests = reinterpret_cast<char*>(header) + roundUp(sizeof(SharedRingHeader));
+    results = requests + slots * requestStride;
+}
+
+bool SharedRing::create(const wstring& name, uint32_t slotCount, uint32_t maxPixels, uint32_t resultBytes)
+{
+    if (slotCount < 1 || slotCount > MAX_SLOTS || maxPixels < 2 || maxPixels > MAX_PIXELS || resultBytes < sizeof(BinaryResultHeader))
+    {
+        Util::log(L"ERROR: invalid shared ring geometry (%u slots, %u pixels, %u result bytes)", slotCount, maxPixels, resultBytes);
+        return false;
+    }
+
+    if (!map(name, totalBytes(slotCount, maxPixels, resultBytes), true))
+        return false;
+    owner = true;
+
+    // counters are constructed in place; magic goes last, once the rest is valid
+    new (header) SharedRingHeader();
+    header->version = VERSION;
+    header->slotCount = slotCount;
+    header->maxPixels = maxPixels;
+    header->resultBytes = resultBytes;
+    header->requestHead = header->requestTail = 0;
+    header->resultHead = header->resultTail = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+
+    slots = slotCount;
+    pixels = maxPixels;
+    resultSize = resultBytes;
+    layout();
+    return true;
+}
+
+bool SharedRing::open(const wstring& name)
+{
+    if (!map(name, 0, false))
+        return false;
+
+    if (size < sizeof(SharedRingHeader) || header->magic != MAGIC || header->version != VERSION)
+    {
+        Util::log(L"ERROR: %ls is not a version %u shared ring", name.c_str(), VERSION);
+        close();
+        return false;
+    }
+
+    // read the geometry once, as the client could change it under us
+    slots = header->slotCount;
+    pixels = header->maxPixels;
+    resultSize = header->resultBytes;
+    if (slots < 1 || slots > MAX_SLOTS || pixels > MAX_PIXELS || resultSize < sizeof(BinaryResultHeader) ||
+        size < totalBytes(slots, pixels, resultSize))
+    {
+        Util::log(L"ERROR: invalid shared ring geometry (%u slots, %u pixels, %u result bytes)", slots, pixels, resultSize);
+        close();
+        return false;
+    }
+
+    layout();
+    return true;
+}
+
+#ifdef _WIN32
+
+bool SharedRing::map(const wstring& name, size_t bytes, bool create)
+{
+    HANDLE h = create
+        ? CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((uint64_t) bytes >> 32), (DWORD) bytes, name.c_str())
+        : OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (h && create && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(h);
+        h = NULL;
+    }
+    if (!h)
+    {
+        Util::log(L"ERROR: unable to %ls shared memory %ls (error %u)", create ? L"create" : L"open", name.c_str(), GetLastError());
+        return false;
+    }
+
+    void* p = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    MEMORY_BASIC_INFORMATION info;
+    if (!p || !VirtualQuery(p, &info, sizeof(info)))
+    {
+        Util::log(L"ERROR: unable to map shared memory %ls (error %u)", name.c_str(), GetLastError());
+        if (p)
+            UnmapViewOfFile(p);
+        CloseHandle(h);
+        return false;
+    }
+
+    mapping = h;
+    header = static_cast<SharedRingHeader*>(p);
+    size = create ? bytes : info.RegionSize;
+    return true;
+}
+
+void SharedRing::close()
+{
+    // the page file backing goes away with the last handle
+    if (header)
+        UnmapViewOfFile(header);
+    if (mapping)
+        CloseHandle(mapping);
+    header = nullptr;
+    mapping = nullptr;
+    owner = false;
+}
+
+#else
+
+bool SharedRing::map(const wstring& wname, size_t bytes, bool create)
+{
+    // POSIX shared memory names are a single leading slash and a file name
+    name = Util::toString(wname);
+    if (name.empty() || name[0] != '/')
+        name = "/" + name;
+
+    int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0)
+    {
+        Util::log(L"ERROR: unable to %ls shared memory %ls: %ls", create ? L"create" : L"open",
+            wname.c_str(), Util::toWstring(strerror(errno)).c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (create && ftruncate(fd, (off_t) bytes) != 0)
+    {
+        Util::log(L"ERROR: unable to size shared memory %ls: %ls", wname.c_str(), Util::toWstring(strerror(errno)).c_str());
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    if (!create)
+        bytes = fstat(fd, &st) == 0 ? (size_t) st.st_size : 0;
+
+    void* p = bytes ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        Util::log(L"ERROR: unable to map shared memory %ls: %ls", wname.c_str(), Util::toWstring(strerror(errno)).c_str());
+        if (create)
+            shm_unlink(name.c_str());
+        return false;
+    }
+
+    header = static_cast<SharedRingHeader*>(p);
+    size = bytes;
+    return true;
+}
+
+void SharedRing::close()
+{
+    if (header)
+        munmap(header, size);
+    if (owner)
+        shm_unlink(name.c_str());
+    header = nullptr;
+    owner = false;
+}
+
+#endif
+
+SharedRequestSlot* SharedRing::beginRequest()
+{
+    uint64_t head = header->requestHead.load(std::memory_order_relaxed);
+    if (head - header->resultTail.load(std::memory_order_acquire) >= slots)
+        return nullptr;
+    return reinterpret_cast<SharedRequestSlot*>(requests + (head % slots) * requestStride);
+}
+
+void SharedRing::publishRequest()
+{
+    header->requestHead.fetch_add(1, std::memory_order_release);
+}
+
+const BinaryResultHeader* SharedRing::nextResult()
+{
+    uint64_t tail = header->resultTail.load(std::memory_order_relaxed);
+    if (tail == header->resultHead.load(std::memory_order_acquire))
+        return nullptr;
+    return reinterpret_cast<const BinaryResultHeader*>(results + (tail % slots) * resultStride);
+}
+
+void SharedRing::releaseResult()
+{
+    header->resultTail.fetch_add(1, std::memory_order_release);
+}
+
+SharedRequestSlot* SharedRing::nextRequest()
+{
+    uint64_t tail = header->requestTail.load(std::memory_order_relaxed);
+    if (tail == header->requestHead.load(std::memory_order_acquire))
+        return nullptr;
+    return reinterpret_cast<SharedRequestSlot*>(requests + (tail % slots) * requestStride);
+}
+
+void SharedRing::releaseRequest()
+{
+    header->requestTail.fetch_add(1, std::memory_order_release);
+}
+
+bool SharedRing::publishResult(const string& frame)
+{
+    uint64_t head = header->resultHead.load(std::memory_order_relaxed);
+    if (frame.size() > resultSize || head - header->resultTail.load(std::memory_order_acquire) >= slots)
+        return false;
+
+    memcpy(results + (head % slots) * resultStride, frame.data(), frame.size());
+    header->resultHead.store(head + 1, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,140 @@
+#ifndef KIACONSOLE_SHARED_RING_H
+#define KIACONSOLE_SHARED_RING_H
+
+#include "pch.h"
+
+#include "BinaryProtocol.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*! @brief Shared-memory request and result rings for --shm.
+
+    Even binary framing copies every spectrum through the pipe, and again
+    into a Measurement.  With --shm, the client (e.g. ENLIGHTEN) creates a
+    named mapping holding two single-producer / single-consumer rings:
+
+    - slotCount request slots, each a SharedRequestSlot followed by
+      maxPixels doubles of x and maxPixels doubles of y, which KIAConsole
+      searches in place; and
+    - slotCount result slots of resultBytes each, holding one
+      BinaryProtocol result frame (matches which don't fit are dropped,
+      and the frame flagged RESULT_TRUNCATED).
+
+    Only a one-byte notification crosses the pipe: the client writes
+    NOTIFY_REQUEST to KIAConsole's stdin after publishing requests (or
+    NOTIFY_QUIT), and KIAConsole writes NOTIFY_RESULT to stdout after
+    publishing each result.  Results return in request order.
+
+    Each ring's head and tail are free-running counters (slot = counter %
+    slotCount), each written by one side only.  The client may have at most
+    slotCount requests whose results it hasn't yet released; the result ring
+    then can never overflow.
+
+    The mapping is a POSIX shared memory object (shm_open) or, on Windows, a
+    named file mapping backed by the page file.
+*/
+
+struct SharedRingHeader
+{
+    uint32_t magic;                             //!< SharedRing::MAGIC ("KIAM"), written last by create()
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t maxPixels;
+    uint32_t resultBytes;                       //!< capacity of each result slot
+    uint32_t reserved;
+
+    // each counter on its own cache line, as each is written by one side
+    alignas(64) std::atomic<uint64_t> requestHead;  //!< requests published by the client
+    alignas(64) std::atomic<uint64_t> requestTail;  //!< requests KIAConsole is done reading
+    alignas(64) std::atomic<uint64_t> resultHead;   //!< results published by KIAConsole
+    alignas(64) std::atomic<uint64_t> resultTail;   //!< results released by the client
+};
+
+struct SharedRequestSlot
+{
+    uint32_t requestId;                         //!< echoed in the result
+    uint32_t pixels;
+    int32_t  maxResults;                        //!< 1 to BinaryProtocol::MAX_RESULTS
+    uint32_t timeoutMS;                         //!< search deadline (0 = KIAConsole's --timeout-ms)
+    double   minConfidence;
+    uint64_t reserved;
+};
+
+class SharedRing
+{
+    public:
+        static const uint32_t MAGIC   = 0x4d41494b;     //!< "KIAM"
+        static const uint32_t VERSION = 1;
+
+        static const char NOTIFY_REQUEST = 'R';         //!< client: requests published
+        static const char NOTIFY_QUIT    = 'Q';         //!< client: shut down
+        static const char NOTIFY_RESULT  = 'R';         //!< KIAConsole: a result published
+
+        SharedRing() {}
+        ~SharedRing();
+
+        //! create and initialize a new mapping (client side); it is removed again on close
+        bool create(const std::wstring& name, uint32_t slotCount, uint32_t maxPixels, uint32_t resultBytes = 16 * 1024);
+
+        //! attach to a mapping the client created (KIAConsole side)
+        bool open(const std::wstring& name);
+
+        void close();
+
+        uint32_t slotCount() const { return slots; }
+        uint32_t maxPixels() const { return pixels; }
+        uint32_t resultBytes() const { return resultSize; }
+
+        double* x(SharedRequestSlot* slot) const { return reinterpret_cast<double*>(slot + 1); }
+        double* y(SharedRequestSlot* slot) const { return x(slot) + pixels; }
+
+        ////////////////////////////////////////////////////////////////////////
+        // client
+        ////////////////////////////////////////////////////////////////////////
+
+        //! @returns the slot to fill in next, or nullptr if slotCount results are outstanding
+        SharedRequestSlot* beginRequest();
+        void publishRequest();
+
+        //! @returns the oldest unreleased result frame, or nullptr if none is ready
+        const BinaryResultHeader* nextResult();
+        void releaseResult();
+
+        ////////////////////////////////////////////////////////////////////////
+        // KIAConsole
+        ////////////////////////////////////////////////////////////////////////
+
+        //! @returns the oldest unanswered request, or nullptr if none is pending
+        SharedRequestSlot* nextRequest();
+
+        //! done reading the slot from nextRequest() (the client may now reuse it)
+        void releaseRequest();
+
+        //! copy one result frame into the result ring
+        //! @returns false if the frame doesn't fit, or the client broke the slot limit
+        bool publishResult(const std::string& frame);
+
+    private:
+        SharedRingHeader* header = nullptr;
+        char* requests = nullptr;
+        char* results = nullptr;
+        uint32_t slots = 0;             //!< geometry, as validated (the client can rewrite the header's copy)
+        uint32_t pixels = 0;
+        uint32_t resultSize = 0;
+        size_t requestStride = 0;
+        size_t resultStride = 0;
+        size_t size = 0;
+        std::string name;               //!< as passed to shm_open (if created here, to unlink)
+        bool owner = false;
+#ifdef _WIN32
+        void* mapping = nullptr;
+#endif
+
+        bool map(const std::wstring& name, size_t bytes, bool create);
+        void layout();
+        static size_t totalBytes(uint32_t slotCount, uint32_t maxPixels, uint32_t resultBytes);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "pch.h"
+
+#include "Simd.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+bool Simd::haveAvx2()
+{
+#if !defined(KIACONSOLE_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    static const bool have = []()
+    {
+        // the CPU must have AVX2, and the OS must save the YMM registers
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return have;
+#else
+    static const bool have = __builtin_cpu_supports("avx2");
+    return have;
+#endif
+}
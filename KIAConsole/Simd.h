@@ -0,0 +1,32 @@
+#ifndef KIACONSOLE_SIMD_H
+#define KIACONSOLE_SIMD_H
+
+#include "pch.h"
+
+/*! @brief Runtime selection of AVX2 kernels.
+
+    The build targets baseline x86-64 (no -mavx2 or /arch:AVX2), so the same
+    binary runs on any PC.  AVX2 kernels are instead compiled function by
+    function (marked AVX2_TARGET), and called only if haveAvx2(), alongside
+    scalar versions for everything else.  Off x86, KIACONSOLE_AVX2 is not
+    defined, and only the scalar kernels are built.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KIACONSOLE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+class Simd
+{
+    public:
+        //! true if this CPU (and build) supports the AVX2 kernels (checked once)
+        static bool haveAvx2();
+};
+
+#endif
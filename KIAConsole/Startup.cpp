@@ -0,0 +1,124 @@
+#include "pch.h"
+
+#include "Startup.h"
+
+#include "Measurement.h"
+#include "SearchSession.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::wstring;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+static struct
+{
+    steady_clock::time_point start = steady_clock::now();
+    std::mutex mut;
+    std::vector<std::pair<wstring, double>> phases;     //!< name, ms since start
+
+    // library initialization
+    std::condition_variable done;
+    std::thread thread;
+    bool started = false;
+    bool finished = false;
+    bool ok = false;
+} s_startup;
+
+void Startup::begin()
+{
+    std::lock_guard<std::mutex> lock(s_startup.mut);
+    s_startup.start = steady_clock::now();
+    s_startup.phases.clear();
+}
+
+void Startup::mark(const wchar_t* phase)
+{
+    auto now = steady_clock::now();
+    std::lock_guard<std::mutex> lock(s_startup.mut);
+    for (const auto& p : s_startup.phases)
+        if (p.first == phase)
+            return;
+    s_startup.phases.emplace_back(phase, duration<double, std::milli>(now - s_startup.start).count());
+}
+
+void Startup::startLibrary(std::function<bool()> init)
+{
+    std::lock_guard<std::mutex> lock(s_startup.mut);
+    s_startup.started = true;
+    s_startup.finished = false;
+    s_startup.thread = std::thread([init]()
+    {
+        bool ok = init();
+
+        std::lock_guard<std::mutex> lock(s_startup.mut);
+        s_startup.ok = ok;
+        s_startup.finished = true;
+        s_startup.done.notify_all();
+    });
+}
+
+bool Startup::waitLibrary()
+{
+    std::unique_lock<std::mutex> lock(s_startup.mut);
+    if (!s_startup.started)
+        return true;
+    s_startup.done.wait(lock, []() { return s_startup.finished; });
+
+    // whoever waits first reclaims the thread
+    if (s_startup.thread.joinable())
+        s_startup.thread.join();
+    return s_startup.ok;
+}
+
+void Startup::warmUp(const SearchLibrary& library, const Options& opts)
+{
+    // a few Lorentzian bands on a sloping background, over the usual
+    // Raman range
+    Measurement m(1024);
+    for (int i = 0; i < m.pixels; i++)
+    {
+        double x = 200 + 3000.0 * i / (m.pixels - 1);
+        double y = 1000 + 0.1 * x;
+        static const double bands[][2] = { { 520, 8000 }, { 1001, 20000 }, { 1602, 6000 }, { 2904, 12000 } };
+        for (const auto& band : bands)
+        {
+            double d = (x - band[0]) / 6.0;
+            y += band[1] / (1 + d * d);
+        }
+        m.x[i] = x;
+        m.y[i] = y;
+    }
+
+    Util::log(L"Running warm-up search");
+    auto start = steady_clock::now();
+    SearchSession session(library, 0, opts.timeoutMS);
+    session.configure(opts, false);
+    if (!session.search(m))
+        Util::log(L"ERROR: warm-up search could not open search handle");
+    else
+        Util::log(L"Warm-up search returned %d results in %0.2lf sec",
+            session.matchCount(), duration<double>(steady_clock::now() - start).count());
+    session.close();
+    mark(L"warm-up search");
+}
+
+void Startup::report()
+{
+    std::lock_guard<std::mutex> lock(s_startup.mut);
+    auto phases = s_startup.phases;
+    std::stable_sort(phases.begin(), phases.end(),
+        [](const std::pair<wstring, double>& a, const std::pair<wstring, double>& b) { return a.second < b.second; });
+
+    Util::log(L"Startup timeline (ms since launch):");
+    for (const auto& p : phases)
+        Util::log(L"  %8.1lf  %ls", p.second, p.first.c_str());
+}
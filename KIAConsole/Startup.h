@@ -0,0 +1,50 @@
+#ifndef KIACONSOLE_STARTUP_H
+#define KIACONSOLE_STARTUP_H
+
+#include "pch.h"
+
+#include "Options.h"
+#include "SearchLibrary.h"
+
+#include <functional>
+
+/*! @brief Overlaps library startup with input discovery, and times both.
+
+    ENLIGHTEN launches KIAConsole on demand, so time to first result matters.
+    Loading SearchSDK.dll and SearchSDK_Init (which starts KnowItAll's own
+    database scanning thread) can take a while, so main() runs them on a
+    background thread (startLibrary) while directory mode finds its files and
+    parses the first of them; search workers wait for the library
+    (waitLibrary) before their first search.
+
+    Optionally (--warm-up), the background thread then runs one search of a
+    built-in synthetic spectrum, so the first real search doesn't pay for
+    opening the first handle or scanning the databases.
+
+    Each phase is marked as it finishes, and the timeline (milliseconds since
+    launch) is logged at exit.
+*/
+class Startup
+{
+    public:
+        //! start the clock (first thing in main)
+        static void begin();
+
+        //! record when a phase finished (only its first occurrence counts); thread-safe
+        static void mark(const wchar_t* phase);
+
+        //! run init (load, SearchSDK_Init, etc) on a background thread
+        static void startLibrary(std::function<bool()> init);
+
+        //! block until the library is ready (true at once if startLibrary wasn't called)
+        //! @returns false if it failed to load or initialize
+        static bool waitLibrary();
+
+        //! search a synthetic spectrum, to open the databases ahead of real requests
+        static void warmUp(const SearchLibrary& library, const Options& opts);
+
+        //! log each phase marked, in the order they finished
+        static void report();
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "pch.h"
+
+#include "Stats.h"
+
+#include "Util.h"
+
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const wchar_t* STAGE_NAMES[Stats::STAGE_COUNT] =
+{
+    L"discovery",
+    L"parse",
+    L"quality",
+    L"despike",
+    L"smooth",
+    L"baseline",
+    L"normalize",
+    L"prescreen",
+    L"open",
+    L"search",
+    L"format",
+    L"close"
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+////////////////////////////////////////////////////////////////////////////////
+
+//! index of the highest set bit (ns > 0)
+static int highBit(uint64_t ns)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, ns);
+    return (int) index;
+#else
+    return 63 - __builtin_clzll(ns);
+#endif
+}
+
+//! values below 4 ns get a bucket each; above that, each power of two is
+//! split into SUB_BUCKETS linear steps
+int LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if (ns < SUB_BUCKETS)
+        return (int) ns;
+
+    int msb = highBit(ns);
+    int sub = (int) (ns >> (msb - 2)) & (SUB_BUCKETS - 1);
+    int bucket = SUB_BUCKETS * (msb - 1) + sub;
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+uint64_t LatencyHistogram::upperBound(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return (uint64_t) bucket + 1;
+
+    int msb = bucket / SUB_BUCKETS + 1;
+    int sub = bucket % SUB_BUCKETS;
+    return (uint64_t) (SUB_BUCKETS + sub + 1) << (msb - 2);
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    buckets[bucketOf(ns)]++;
+    count++;
+    totalNS += ns;
+    if (ns > maxNS)
+        maxNS = ns;
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+    for (int i = 0; i < BUCKET_COUNT; i++)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    totalNS += other.totalNS;
+    if (other.maxNS > maxNS)
+        maxNS = other.maxNS;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (!count)
+        return 0;
+
+    long target = (long) (p * count + 0.999999);
+    if (target < 1)
+        target = 1;
+
+    long seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+        {
+            uint64_t bound = upperBound(i);
+            return bound < maxNS ? bound : maxNS;
+        }
+    }
+    return maxNS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stats
+////////////////////////////////////////////////////////////////////////////////
+
+void Stats::add(const Stats& other)
+{
+    for (int i = 0; i < STAGE_COUNT; i++)
+        stages[i].add(other.stages[i]);
+    measurements += other.measurements;
+    recycles += other.recycles;
+    timeouts += other.timeouts;
+    cacheHits += other.cacheHits;
+    coalesceChecks += other.coalesceChecks;
+    coalesced += other.coalesced;
+    coalesceVerified += other.coalesceVerified;
+    coalesceAgreed += other.coalesceAgreed;
+    for (int i = 0; i < SIMILARITY_BUCKETS; i++)
+        similarity[i] += other.similarity[i];
+    localChecks += other.localChecks;
+    localHits += other.localHits;
+    localVerified += other.localVerified;
+    localAgreed += other.localAgreed;
+    qualityChecks += other.qualityChecks;
+    for (int i = 0; i < QualityGate::REASON_COUNT; i++)
+        rejected[i] += other.rejected[i];
+}
+
+void Stats::recordSimilarity(double r, bool reused)
+{
+    coalesceChecks++;
+    if (reused)
+        coalesced++;
+    if (r < -1)
+        return;
+
+    static const double BOUNDS[SIMILARITY_BUCKETS - 1] = { 0.9, 0.99, 0.999, 0.9999, 0.99999 };
+    int bucket = 0;
+    while (bucket < SIMILARITY_BUCKETS - 1 && r >= BOUNDS[bucket])
+        bucket++;
+    similarity[bucket]++;
+}
+
+void Stats::report(double elapsedSec) const
+{
+    const double MS = 1e-6;
+
+    Util::log(L"Stage latency (ms):     count        p50        p95        p99        max   total sec");
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        const LatencyHistogram& h = stages[i];
+        if (!h.count)
+            continue;
+
+        Util::log(L"  %-10ls %12ld %10.3lf %10.3lf %10.3lf %10.3lf %11.3lf",
+            STAGE_NAMES[i], h.count,
+            MS * h.percentile(0.50), MS * h.percentile(0.95), MS * h.percentile(0.99), MS * h.maxNS,
+            1e-9 * h.totalNS);
+    }
+
+    Util::log(L"Search handles: %ld opened, %ld closed, %ld recycled, %ld searches timed out",
+        stages[STAGE_OPEN].count, stages[STAGE_CLOSE].count, recycles, timeouts);
+
+    if (qualityChecks)
+    {
+        // e.g. "rejected 3 of 120 spectra (low_range 2, saturated 1)"
+        long total = 0;
+        std::wstring reasons;
+        for (int i = QualityGate::PASS + 1; i < QualityGate::REASON_COUNT; i++)
+        {
+            if (!rejected[i])
+                continue;
+            total += rejected[i];
+            reasons += (reasons.empty() ? L" (" : L", ") + std::wstring(QualityGate::name((QualityGate::Reason) i))
+                + L" " + std::to_wstring(rejected[i]);
+        }
+        if (!reasons.empty())
+            reasons += L")";
+
+        Util::log(L"Quality gate: rejected %ld of %ld spectra%ls", total, qualityChecks, reasons.c_str());
+    }
+
+    if (coalesceChecks)
+    {
+        long compared = 0;
+        for (int i = 0; i < SIMILARITY_BUCKETS; i++)
+            compared += similarity[i];
+
+        Util::log(L"Coalescing: reused %ld of %ld results (%.1lf%%); similarity to nearest recent spectrum "
+                  L"(%ld compared): <0.9 %ld, 0.9 %ld, 0.99 %ld, 0.999 %ld, 0.9999 %ld, 0.99999 %ld",
+            coalesced, coalesceChecks, 100.0 * coalesced / coalesceChecks, compared,
+            similarity[0], similarity[1], similarity[2], similarity[3], similarity[4], similarity[5]);
+        if (coalesceVerified)
+            Util::log(L"Coalescing verification: top match agreed for %ld of %ld reused results",
+                coalesceAgreed, coalesceVerified);
+    }
+
+    if (localChecks)
+    {
+        // each hit saved a search, less what pre-screening everything cost
+        const LatencyHistogram& search = stages[STAGE_SEARCH];
+        double savedSec = search.count ? 1e-9 * search.totalNS / search.count * localHits : 0;
+        savedSec -= 1e-9 * stages[STAGE_PRESCREEN].totalNS;
+
+        Util::log(L"Local pre-screen: answered %ld of %ld spectra (%.1lf%%), saving an estimated %.2lf sec of searching",
+            localHits, localChecks, 100.0 * localHits / localChecks, savedSec);
+        if (localVerified)
+            Util::log(L"Local pre-screen verification: top match agreed for %ld of %ld local results",
+                localAgreed, localVerified);
+    }
+
+    if (cacheHits)
+        Util::log(L"Searches answered from result cache: %ld", cacheHits);
+
+    if (elapsedSec > 0)
+        Util::log(L"Throughput: %ld measurements in %.2lf sec (%.2lf/sec)",
+            measurements, elapsedSec, measurements / elapsedSec);
+}
@@ -0,0 +1,108 @@
+#ifndef KIACONSOLE_STATS_H
+#define KIACONSOLE_STATS_H
+
+#include "pch.h"
+
+#include "QualityGate.h"
+
+#include <chrono>
+#include <cstdint>
+
+/*! @brief Fixed-bucket latency histogram.
+
+    Buckets are log-linear: each power of two of nanoseconds is split into
+    four, so any recorded value is reported within 25%.  Recording is a few
+    integer operations and never allocates; histograms from several threads
+    are combined with add().
+*/
+class LatencyHistogram
+{
+    public:
+        static const int SUB_BUCKETS = 4;                       //!< per power of two
+        static const int BUCKET_COUNT = 40 * SUB_BUCKETS;       //!< up to 2^41 ns (~37 min)
+
+        long count = 0;
+        uint64_t totalNS = 0;
+        uint64_t maxNS = 0;
+
+        void record(uint64_t ns);
+        void add(const LatencyHistogram& other);
+
+        //! @param p  fraction in (0, 1]
+        //! @returns upper bound of the bucket holding the p'th value (ns)
+        uint64_t percentile(double p) const;
+
+    private:
+        long buckets[BUCKET_COUNT] = {};
+
+        static int bucketOf(uint64_t ns);
+        static uint64_t upperBound(int bucket);
+};
+
+/*! @brief Per-stage latency and search handle statistics for a run.
+
+    Each SearchSession (so each worker) keeps its own Stats, merged at the
+    end of a run, so nothing on the hot path is shared between threads.
+    Times are taken from steady_clock, which unlike the wall clock cannot jump.
+*/
+class Stats
+{
+    public:
+        enum Stage
+        {
+            STAGE_DISCOVERY,    //!< finding input files (once per directory run)
+            STAGE_PARSE,        //!< reading and parsing one measurement
+            STAGE_QUALITY,      //!< QualityGate::check
+            STAGE_DESPIKE,      //!< Preprocessor stages
+            STAGE_SMOOTH,
+            STAGE_BASELINE,
+            STAGE_NORMALIZE,
+            STAGE_PRESCREEN,    //!< LocalMatcher::match
+            STAGE_OPEN,         //!< SearchSDK_OpenSearch
+            STAGE_SEARCH,       //!< SearchSDK_RunSearch(Un)evenlySpaced
+            STAGE_FORMAT,       //!< logging / writing one set of results
+            STAGE_CLOSE,        //!< SearchSDK_CloseSearch
+            STAGE_COUNT
+        };
+
+        LatencyHistogram stages[STAGE_COUNT];
+        long measurements = 0;  //!< measurements searched and reported
+        long recycles = 0;      //!< handles closed early because a search failed
+        long timeouts = 0;      //!< searches canceled at their deadline
+        long cacheHits = 0;     //!< searches answered by the ResultCache
+
+        //! Coalescer outcomes, with similarity of each spectrum to its nearest
+        //! recent one, bucketed by nines: < 0.9, 0.9, 0.99, ... 0.99999
+        static const int SIMILARITY_BUCKETS = 6;
+        long coalesceChecks = 0;
+        long coalesced = 0;
+        long coalesceVerified = 0;  //!< reused results also searched (--coalesce-verify)
+        long coalesceAgreed = 0;    //!< ...with the same top match
+        long similarity[SIMILARITY_BUCKETS] = {};
+
+        //! LocalMatcher outcomes (--references)
+        long localChecks = 0;       //!< spectra pre-screened
+        long localHits = 0;         //!< ...answered without a search
+        long localVerified = 0;     //!< local results also searched (--local-verify)
+        long localAgreed = 0;       //!< ...with the same top match
+
+        //! QualityGate outcomes (--quality-gate), rejections by reason
+        long qualityChecks = 0;
+        long rejected[QualityGate::REASON_COUNT] = {};
+
+        //! @param similarity  correlation to nearest recent spectrum (-2 if none)
+        void recordSimilarity(double similarity, bool reused);
+
+        void record(Stage stage, std::chrono::steady_clock::duration elapsed)
+        {
+            stages[stage].record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+
+        void add(const Stats& other);
+
+        //! log percentiles for every stage that ran, and measurement throughput
+        //! @param elapsedSec  run time over which to compute throughput
+        void report(double elapsedSec) const;
+};
+
+#endif
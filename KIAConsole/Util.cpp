@@ -2,11 +2,19 @@
 
 #include "Util.h"
 
+#include "AsyncLog.h"
+
+#include <fstream>
+#include <memory>
 #include <sstream>
 #include <cwchar>
+#include <cstdlib>
+#include <cstring>
 
+#ifdef _WIN32
 #include <AtlBase.h>
 #include <atlconv.h>
+#endif
 #include <time.h>
 #include <stdarg.h>
 
@@ -30,10 +38,32 @@ vector<string> Util::split(const string& s, const string& delim)
     return v;
 }
 
+// Outside Windows, paths and arguments are taken to be UTF-8 whatever the
+// locale (nothing calls setlocale, so the C library would only handle ASCII).
+
 wstring Util::toWstring(const char* s)
 {
+#ifdef _WIN32
     CA2W tmp(s);
     return wstring(tmp);
+#else
+    wstring ws;
+    if (!appendWide(ws, s, strlen(s)))
+        log(L"WARNING: \"%ls\" is not valid UTF-8 (invalid bytes shown as U+FFFD)", ws.c_str());
+    return ws;
+#endif
+}
+
+string Util::toString(const wstring& ws)
+{
+#ifdef _WIN32
+    CW2A tmp(ws.c_str());
+    return string(tmp);
+#else
+    string s;
+    appendUtf8(s, ws.c_str());
+    return s;
+#endif
 }
 
 string Util::toLower(const string& s)
@@ -54,7 +84,107 @@ wstring Util::clean(const wchar_t* s)
     return dest;
 }
 
-//! print a single timestamped log line to console with linefeed
+//! append s to out as UTF-8 (wchar_t may be UTF-16 or UTF-32)
+void Util::appendUtf8(string& out, const wchar_t* s)
+{
+    while (s && *s)
+    {
+        unsigned long c = (unsigned long) *s++;
+
+        // combine UTF-16 surrogate pairs
+        if (c >= 0xd800 && c <= 0xdbff && *s >= 0xdc00 && *s <= 0xdfff)
+            c = 0x10000 + ((c - 0xd800) << 10) + ((unsigned long) *s++ - 0xdc00);
+
+        if (c < 0x80)
+            out += (char) c;
+        else if (c < 0x800)
+        {
+            out += (char) (0xc0 | (c >> 6));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+        else if (c < 0x10000)
+        {
+            out += (char) (0xe0 | (c >> 12));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+        else
+        {
+            out += (char) (0xf0 | (c >> 18));
+            out += (char) (0x80 | ((c >> 12) & 0x3f));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+    }
+}
+
+bool Util::appendWide(wstring& out, const char* utf8, size_t len)
+{
+    static const unsigned long MIN_VALUE[4] = { 0, 0x80, 0x800, 0x10000 };
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(utf8);
+    const unsigned char* end = p + len;
+    bool valid = true;
+    while (p < end)
+    {
+        unsigned long c = *p;
+        int extra = c >= 0xf8 ? -1 : c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : c >= 0x80 ? -1 : 0;
+        int i = 1;
+        if (extra > 0)
+        {
+            c &= 0x3f >> extra;
+            for (; i <= extra && p + i < end && (p[i] & 0xc0) == 0x80; i++)
+                c = (c << 6) | (p[i] & 0x3f);
+        }
+
+        // stray continuation bytes, truncated or overlong sequences, and
+        // surrogates become U+FFFD, one byte at a time
+        if (extra < 0 || i <= extra || c < MIN_VALUE[extra] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+        {
+            out += (wchar_t) 0xfffd;
+            valid = false;
+            p++;
+            continue;
+        }
+        p += i;
+
+        // split into UTF-16 surrogate pairs where wchar_t is 16 bits (Windows)
+        if (sizeof(wchar_t) == 2 && c >= 0x10000)
+        {
+            c -= 0x10000;
+            out += (wchar_t) (0xd800 + (c >> 10));
+            out += (wchar_t) (0xdc00 + (c & 0x3ff));
+        }
+        else
+            out += (wchar_t) c;
+    }
+    return valid;
+}
+
+//! @returns false (with contents empty) if the file could not be opened
+bool Util::readFile(const wstring& pathname, string& contents)
+{
+#ifdef _WIN32
+    std::ifstream infile(pathname, std::ios::binary);
+#else
+    std::ifstream infile(toString(pathname), std::ios::binary);
+#endif
+    contents.clear();
+    if (!infile)
+        return false;
+
+    infile.seekg(0, std::ios::end);
+    std::streamoff size = infile.tellg();
+    infile.seekg(0, std::ios::beg);
+    if (size > 0)
+    {
+        contents.resize((size_t) size);
+        infile.read(&contents[0], size);
+        contents.resize((size_t) infile.gcount());
+    }
+    return true;
+}
+
 string Util::sstring(const char* format, ...)
 {
     char buf[256];
@@ -66,34 +196,146 @@ string Util::sstring(const char* format, ...)
     return string(buf);
 }
 
+//! thread-safe ctime() without the trailing linefeed
+static void formatTime(time_t now, char* buf, size_t size)
+{
+#ifdef _WIN32
+    ctime_s(buf, size, &now);
+#else
+    ctime_r(&now, buf);
+#endif
+    buf[strcspn(buf, "\n")] = 0;
+}
+
 wstring Util::timestamp()
 {
     char buf[32] = { 0 };
-    time_t now = time(NULL);
-    string(ts) = ctime(&now);
-    ts[ts.length() - 1] = 0;
-    snprintf(buf, sizeof(buf), "%s ", ts.c_str());
+    formatTime(time(NULL), buf, sizeof(buf));
+    strcat(buf, " ");
     return toWstring(buf);
 }
 
+//! if set, log lines from this thread are appended here instead of printed
+static thread_local wstring* s_capture = nullptr;
+
+//! where log lines are printed (stderr when stdout carries binary data)
+static FILE* s_logFile = stdout;
+
+//! if set, log lines are queued to a background writer
+static std::unique_ptr<AsyncLog> s_async;
+
+void Util::setLogFile(FILE* f)
+{
+    s_logFile = f;
+}
+
+void Util::startAsyncLog()
+{
+    if (!s_async)
+        s_async.reset(new AsyncLog(s_logFile));
+}
+
+void Util::stopAsyncLog()
+{
+    s_async.reset();
+}
+
+void Util::flushLog()
+{
+    if (s_async)
+        s_async->flush();
+}
+
+//! hand one complete line to the background writer, or print it now
+static void emit(const char* line, size_t len)
+{
+    if (s_async)
+        s_async->write(line, len);
+    else
+    {
+        fwrite(line, 1, len, s_logFile);
+        fflush(s_logFile);
+    }
+}
+
+void Util::beginCapture(wstring* buffer)
+{
+    s_capture = buffer;
+}
+
+void Util::endCapture()
+{
+    s_capture = nullptr;
+}
+
+bool Util::isCapturing()
+{
+    return s_capture != nullptr;
+}
+
+void Util::print(const wstring& lines)
+{
+    string s = toString(lines);
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+        size_t eol = s.find('\n', pos);
+        eol = eol == string::npos ? s.size() : eol + 1;
+        emit(s.data() + pos, eol - pos);
+        pos = eol;
+    }
+}
 
 //! print a single timestamped log line to console with linefeed
 void Util::log(const wchar_t* format, ...)
 {
     // all OUTPUT starts with KIA:, making debugging easier (logfile will also 
     // contain streaming input from ENLIGHTEN)
+    //
+    // formatting the time is comparatively slow, so do it once per second
+    static thread_local time_t cachedTime = -1;
+    static thread_local char ts[32] = { 0 };
     time_t now = time(NULL);
-    string(ts) = ctime(&now);
-    ts[ts.length() - 1] = 0;
-    printf("KIA: %s ", ts.c_str());
+    if (now != cachedTime)
+    {
+        formatTime(now, ts, sizeof(ts));
+        cachedTime = now;
+    }
 
+    // glibc won't mix byte- and wide-oriented output on one stream, so render
+    // the message to a buffer and print it as a multibyte string
+    wchar_t buf[1024];
     va_list args;
     va_start(args, format);
-    vwprintf(format, args);
+    if (vswprintf(buf, sizeof(buf) / sizeof(buf[0]), format, args) < 0)
+        buf[sizeof(buf) / sizeof(buf[0]) - 1] = 0;
     va_end(args);
 
-    printf("\n");
+    if (s_capture)
+    {
+        *s_capture += L"KIA: ";
+        *s_capture += toWstring(ts);
+        *s_capture += L" ";
+        *s_capture += buf;
+        *s_capture += L"\n";
+        return;
+    }
 
-    fflush(stdout);
+    char line[4096];
+    int len = snprintf(line, sizeof(line), "KIA: %s %ls\n", ts, buf);
+    if (len < 0)
+    {
+        // not representable in the current locale; fall back to UTF-8
+        string s = string("KIA: ") + ts + " ";
+        appendUtf8(s, buf);
+        s += "\n";
+        emit(s.data(), s.size());
+    }
+    else if (len >= (int) sizeof(line))
+    {
+        line[sizeof(line) - 2] = '\n';
+        emit(line, sizeof(line) - 1);
+    }
+    else
+        emit(line, len);
 }
-
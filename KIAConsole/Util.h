@@ -5,6 +5,7 @@
 
 #include <algorithm> 
 #include <cctype>
+#include <cstdio>
 #include <locale>
 #include <vector>
 #include <string>
@@ -17,13 +18,32 @@ class Util
 {
     public:
         static std::vector<std::string> split(const std::string& s, const std::string& delim);
-        static std::wstring toWstring(const char* s);
+        static std::wstring toWstring(const char* s);         //!< from UTF-8 (ANSI on Windows), logging invalid input
+        static std::string toString(const std::wstring& s);    //!< to UTF-8 (ANSI on Windows)
         static std::string toLower(const std::string& s);
         static std::wstring clean(const wchar_t* s);
+        static void appendUtf8(std::string& out, const wchar_t* s);
+        //! inverse of appendUtf8
+        //! @returns false if utf8 wasn't valid (each invalid byte appended as U+FFFD)
+        static bool appendWide(std::wstring& out, const char* utf8, size_t len);
+        static bool readFile(const std::wstring& pathname, std::string& contents);  //!< whole file, in one read
         static void log(const wchar_t* format, ...);
         static std::string sstring(const char* format, ...);
         static std::wstring timestamp();
 
+        //! redirect this thread's log lines into buffer (e.g. to keep output
+        //! from parallel workers grouped by file)
+        static void beginCapture(std::wstring* buffer);
+        static void endCapture();
+        static bool isCapturing();                      //!< this thread's log lines are being captured
+        static void print(const std::wstring& lines);  //!< write captured lines to console
+        static void setLogFile(FILE* f);                //!< log somewhere other than stdout
+
+        //! queue log lines to a background writer thread (see AsyncLog)
+        static void startAsyncLog();
+        static void stopAsyncLog();                     //!< write anything queued, then go back to synchronous
+        static void flushLog();                         //!< block until queued lines are written
+
         static bool startswith(const std::string& s, const std::string& prefix)
         {
             return 0 == s.rfind(prefix, 0);
@@ -0,0 +1,122 @@
+#include "pch.h"
+
+#include "Watchdog.h"
+
+#include "Util.h"
+
+#include <algorithm>
+
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+
+Watchdog& Watchdog::instance()
+{
+    static Watchdog watchdog;
+    return watchdog;
+}
+
+Watchdog::~Watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+void Watchdog::begin(Watch& watch, const SearchLibrary& library, SEARCHSDK_HANDLE handle, int timeoutMS, int progressMS, bool live)
+{
+    watch.library = &library;
+    watch.handle = handle;
+    watch.start = steady_clock::now();
+    watch.deadline = timeoutMS > 0 ? watch.start + milliseconds(timeoutMS) : TimePoint::max();
+    watch.nextProgress = progressMS > 0 ? watch.start + milliseconds(progressMS) : TimePoint::max();
+    watch.progressMS = progressMS;
+    watch.live = live;
+    watch.canceled = false;
+    watch.busy = false;
+    watch.progress.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (!thread.joinable())
+            thread = std::thread(&Watchdog::run, this);
+        watches.push_back(&watch);
+    }
+    wake.notify_one();
+}
+
+bool Watchdog::end(Watch& watch)
+{
+    // no need to wake the thread: it will find nothing to do at its next wakeup
+    std::unique_lock<std::mutex> lock(mut);
+    idle.wait(lock, [&watch]() { return !watch.busy; });
+    watches.erase(std::remove(watches.begin(), watches.end(), &watch), watches.end());
+    return watch.canceled;
+}
+
+void Watchdog::run()
+{
+    std::unique_lock<std::mutex> lock(mut);
+    while (!stopping)
+    {
+        TimePoint now = steady_clock::now();
+        TimePoint next = TimePoint::max();
+
+        Watch* due = nullptr;
+        for (Watch* w : watches)
+        {
+            if (w->canceled)
+                continue;
+            if (now >= w->deadline || now >= w->nextProgress)
+            {
+                due = w;
+                break;
+            }
+            next = std::min(next, std::min(w->deadline, w->nextProgress));
+        }
+
+        if (due)
+        {
+            // call the SDK unlocked; end() waits until the watch is no longer busy,
+            // so the handle stays valid meanwhile
+            const bool cancel = now >= due->deadline;
+            due->busy = true;
+            lock.unlock();
+
+            Progress sample = { duration<double>(now - due->start).count(), 0 };
+            if (cancel)
+                due->library->cancelSearchFn(due->handle);
+            else
+            {
+                sample.percent = due->library->getProgressPercentageFn(due->handle);
+                if (due->live)
+                    Util::log(L"Search progress: %.0lf%% after %.2lf sec", sample.percent, sample.elapsedSec);
+            }
+
+            lock.lock();
+            if (cancel)
+                due->canceled = true;
+            else
+            {
+                if (!due->live && due->progress.size() < MAX_PROGRESS)
+                    due->progress.push_back(sample);
+                else if (!due->live)
+                    due->progress.back() = sample;
+                while (due->nextProgress <= now)
+                    due->nextProgress += milliseconds(due->progressMS);
+            }
+            due->busy = false;
+            idle.notify_all();
+            continue;
+        }
+
+        if (next == TimePoint::max())
+            wake.wait(lock);
+        else
+            wake.wait_until(lock, next);
+    }
+}
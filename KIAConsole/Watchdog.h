@@ -0,0 +1,92 @@
+#ifndef KIACONSOLE_WATCHDOG_H
+#define KIACONSOLE_WATCHDOG_H
+
+#include "pch.h"
+
+#include "SearchLibrary.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! @brief Enforces search deadlines, and reports progress of long searches.
+
+    RunSearchUnevenlySpaced blocks its caller, so a single pathological
+    spectrum could otherwise stall a streaming session indefinitely.  While a
+    search is running, its SearchSession registers a Watch here; one
+    background thread (shared by all sessions) sleeps until the next deadline
+    or progress report is due, then calls SearchSDK_CancelSearch or samples
+    SearchSDK_GetProgressPercentage as appropriate.
+
+    Progress samples of a live search (one whose thread isn't capturing its
+    log) are logged as they are taken, so a client sees a stalled search
+    while it is stalled.  Otherwise logging from the watchdog thread would
+    bypass the caller's capture (and so land outside its file's or request's
+    block of output), so the samples are recorded in the Watch instead (at
+    most MAX_PROGRESS, the last one kept current), for the searching thread
+    to report with the rest of its output; so is cancellation.  SDK calls are made without holding
+    the watchdog's lock, so a slow one doesn't hold up other searches
+    starting or ending.
+
+    The thread is only started when first needed, so runs without deadlines
+    or progress reporting pay nothing.
+*/
+class Watchdog
+{
+    public:
+        typedef std::chrono::steady_clock::time_point TimePoint;
+
+        //! one progress sample of a running search
+        struct Progress
+        {
+            double elapsedSec;
+            double percent;
+        };
+
+        static const size_t MAX_PROGRESS = 100;    //!< samples recorded per search
+
+        //! one running search
+        struct Watch
+        {
+            const SearchLibrary* library = nullptr;
+            SEARCHSDK_HANDLE handle = nullptr;
+            TimePoint start;
+            TimePoint deadline;         //!< TimePoint::max() if none
+            TimePoint nextProgress;     //!< TimePoint::max() if not reporting
+            int progressMS = 0;
+            bool live = false;          //!< log progress as it's sampled (else record it)
+            bool canceled = false;      //!< set by the watchdog (guarded by its mutex)
+            bool busy = false;          //!< watchdog is calling the SDK on handle (guarded by its mutex)
+            std::vector<Progress> progress;     //!< samples taken (guarded by its mutex)
+        };
+
+        static Watchdog& instance();
+
+        //! start watching a search about to run
+        //! @param timeoutMS   cancel the search after this long (0 = never)
+        //! @param progressMS  sample progress this often (0 = never)
+        //! @param live        log samples at once, rather than recording them
+        void begin(Watch& watch, const SearchLibrary& library, SEARCHSDK_HANDLE handle, int timeoutMS, int progressMS, bool live);
+
+        //! stop watching a search that has returned (waiting for any SDK call
+        //! the watchdog is making on it)
+        //! @returns true if the watchdog canceled it
+        bool end(Watch& watch);
+
+        ~Watchdog();
+
+    private:
+        std::vector<Watch*> watches;
+        bool stopping = false;
+        std::mutex mut;
+        std::condition_variable wake;
+        std::condition_variable idle;   //!< a Watch is no longer busy
+        std::thread thread;
+
+        Watchdog() {}
+        void run();
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "pch.h"
+
+#include "Watcher.h"
+
+#include "Processing.h"
+#include "Startup.h"
+#include "Stats.h"
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::wstring;
+using std::vector;
+
+//! deep enough that the event loop rarely waits on the reader
+static const size_t PATH_QUEUE_DEPTH = 4096;
+
+#ifndef _WIN32
+
+static volatile std::sig_atomic_t s_signaled = 0;
+
+static void onSignal(int)
+{
+    s_signaled = 1;
+}
+
+//! what a watched directory reports: files finished or moved in, and new subdirectories
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+#endif
+
+Watcher::Watcher(const SearchLibrary& library, const Options& opts)
+    : library(library),
+      opts(opts),
+      paths(PATH_QUEUE_DEPTH)
+{
+}
+
+Watcher::~Watcher()
+{
+#ifndef _WIN32
+    if (inotifyFD >= 0)
+        ::close(inotifyFD);
+#endif
+}
+
+bool Watcher::run()
+{
+#ifdef _WIN32
+    Util::log(L"ERROR: --watch is not supported on Windows");
+    return false;
+#else
+    inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFD < 0)
+    {
+        Util::log(L"ERROR: unable to watch %ls: %ls", opts.directory.c_str(), Util::toWstring(strerror(errno)).c_str());
+        return false;
+    }
+
+    // watch before scanning, so nothing arriving meanwhile is missed
+    vector<wstring> files;
+    addTree(opts.directory, files);
+    if (directories.empty())
+        return false;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    // the pipeline runs for as long as we watch
+    Stats stats;
+    double elapsedSec = 0;
+    std::atomic<bool> failed(false);
+    std::thread pipeline([&]()
+    {
+        elapsedSec = processFiles(paths, library, opts, stats);
+        failed = elapsedSec < 0;
+    });
+
+    Util::log(L"Watching %ls (%u directories, %u files present)",
+        opts.directory.c_str(), (unsigned) directories.size(), (unsigned) files.size());
+    Util::flushLog();
+    Startup::mark(L"files found");
+    enqueue(files);
+
+    // poll, so a signal is noticed promptly however quiet the directory
+    alignas(inotify_event) char buf[64 * 1024];
+    while (!s_signaled && !failed)
+    {
+        pollfd pfd = { inotifyFD, POLLIN, 0 };
+        if (poll(&pfd, 1, 250) <= 0)
+            continue;
+
+        ssize_t n;
+        while ((n = ::read(inotifyFD, buf, sizeof(buf))) > 0)
+        {
+            for (char* p = buf; p < buf + n; )
+            {
+                const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+                handle(ev->wd, ev->mask, ev->len ? ev->name : "");
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+    }
+    if (s_signaled)
+        Util::log(L"Signal received...shutting down");
+
+    // finish whatever has arrived
+    paths.close();
+    pipeline.join();
+    if (failed)
+        return false;
+
+    stats.report(elapsedSec);
+    Util::log(L"Watch complete");
+    return true;
+#endif
+}
+
+#ifndef _WIN32
+
+//! decode a directory entry's UTF-8 name (a name that isn't couldn't be
+//! opened again from its wide form)
+//! @returns false (logged) if name is empty or invalid
+static bool entryName(const wstring& directory, const char* name, wstring& decoded)
+{
+    decoded.clear();
+    if (name && *name && Util::appendWide(decoded, name, strlen(name)))
+        return true;
+    if (name && *name)
+        Util::log(L"WARNING: skipping %ls/%ls (name is not valid UTF-8)", directory.c_str(), decoded.c_str());
+    return false;
+}
+
+void Watcher::addTree(const wstring& root, vector<wstring>& files)
+{
+    vector<wstring> pending(1, root);
+    while (!pending.empty())
+    {
+        wstring path = pending.back();
+        pending.pop_back();
+
+        const string narrow = Util::toString(path);
+        int wd = inotify_add_watch(inotifyFD, narrow.c_str(), WATCH_MASK);
+        if (wd < 0)
+        {
+            Util::log(L"ERROR: unable to watch %ls: %ls", path.c_str(), Util::toWstring(strerror(errno)).c_str());
+            continue;
+        }
+        directories[wd] = path;
+
+        DIR* dir = opendir(narrow.c_str());
+        if (!dir)
+            continue;
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+
+            wstring name;
+            if (!entryName(path, entry->d_name, name))
+                continue;
+
+            wstring child = path + L"/" + name;
+            bool isDir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                struct stat st;
+                isDir = stat((narrow + "/" + entry->d_name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            if (isDir)
+                pending.push_back(child);
+            else if (fnmatch("*.csv", entry->d_name, FNM_CASEFOLD) == 0)
+                files.push_back(child);
+        }
+        closedir(dir);
+    }
+}
+
+void Watcher::handle(int wd, uint32_t mask, const char* name)
+{
+    vector<wstring> files;
+    if (mask & IN_Q_OVERFLOW)
+    {
+        // events were lost; the index skips whatever was already done
+        Util::log(L"Watch events overflowed; rescanning %ls", opts.directory.c_str());
+        addTree(opts.directory, files);
+        enqueue(files);
+        return;
+    }
+
+    auto it = directories.find(wd);
+    if (it == directories.end())
+        return;
+    if (mask & IN_IGNORED)
+    {
+        // the directory was removed
+        directories.erase(it);
+        return;
+    }
+
+    // events on the watched directory itself carry no name
+    wstring decoded;
+    if (!entryName(it->second, name, decoded))
+        return;
+
+    wstring path = it->second + L"/" + decoded;
+    if (mask & IN_ISDIR)
+    {
+        // files may have landed in it before its watch was added
+        if (mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            addTree(path, files);
+            enqueue(files);
+        }
+    }
+    else if ((mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && fnmatch("*.csv", name, FNM_CASEFOLD) == 0)
+        paths.push(std::move(path));
+}
+
+#else
+
+void Watcher::addTree(const wstring&, vector<wstring>&) {}
+void Watcher::handle(int, uint32_t, const char*) {}
+
+#endif
+
+void Watcher::enqueue(vector<wstring>& files)
+{
+    std::sort(files.begin(), files.end());
+    for (wstring& pathname : files)
+        if (!paths.push(std::move(pathname)))
+            break;
+    files.clear();
+}
@@ -0,0 +1,55 @@
+#ifndef KIACONSOLE_WATCHER_H
+#define KIACONSOLE_WATCHER_H
+
+#include "pch.h"
+
+#include "BoundedQueue.h"
+#include "Options.h"
+#include "SearchLibrary.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*! @brief Searches CSV files as they arrive under opts.directory (--watch).
+
+    Instruments drop new spectra into a shared folder all day; rather than
+    rerunning --directory over everything, a watcher subscribes to inotify
+    events on every directory in the tree, and feeds each *.csv file to the
+    directory-mode pipeline (see processFiles) as soon as it is closed after
+    writing, or renamed into place.  The pipeline's search workers stay warm
+    throughout, so a new file is searched within milliseconds of arriving,
+    without rescanning the tree.
+
+    On startup, files already present are fed through first; the FileIndex
+    (opts.index) skips those processed before, so a restarted watcher (or a
+    crashed batch run) resumes where it left off.  New subdirectories are
+    watched (and scanned) as they appear.  If the kernel's event queue
+    overflows, the whole tree is rescanned, again relying on the index.
+
+    Runs until SIGINT or SIGTERM.  Linux only.
+*/
+class Watcher
+{
+    public:
+        Watcher(const SearchLibrary& library, const Options& opts);
+        ~Watcher();
+
+        //! watch opts.directory and search new files until signaled
+        //! @returns false if the directory could not be watched, or the library failed to start
+        bool run();
+
+    private:
+        const SearchLibrary& library;
+        const Options& opts;
+        int inotifyFD = -1;
+        std::unordered_map<int, std::wstring> directories;  //!< by watch descriptor
+        BoundedQueue<std::wstring> paths;                   //!< to the file pipeline
+
+        //! watch root and every directory beneath it, collecting the CSV files found
+        void addTree(const std::wstring& root, std::vector<std::wstring>& files);
+        void handle(int wd, uint32_t mask, const char* name);
+        void enqueue(std::vector<std::wstring>& files);     //!< sorted, so a batch goes in name order
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*! @file
+    @brief A deterministic stand-in for KnowItAll's SearchSDK.dll.
+
+    Exports the same eight SearchSDK_* entry points described in SearchSDK.h,
+    so KIAConsole can load it with "--library" and be profiled or load-tested
+    on machines without a KnowItAll installation or license.
+
+    Searches return canned compound names with confidences derived from a hash
+    of the input spectrum, so the same spectrum always yields the same matches.
+    (With MOCK_SEARCHSDK_MATCH_PEAK, they derive instead from the position of
+    its most prominent peak, to within 10 cm-1, so replicates of a sample, or
+    a spectrum resampled onto another grid, usually match alike.)  Timing and
+    failure behavior are configured through the environment:
+
+    - MOCK_SEARCHSDK_INIT_MS      delay inside SearchSDK_Init (default 0)
+    - MOCK_SEARCHSDK_OPEN_MS      delay inside SearchSDK_OpenSearch (default 0)
+    - MOCK_SEARCHSDK_LATENCY_MS   mean delay of each RunSearch call (default 0)
+    - MOCK_SEARCHSDK_JITTER_MS    uniform +/- jitter applied to the above (default 0)
+    - MOCK_SEARCHSDK_PIXEL_US     further delay per point searched (default 0)
+    - MOCK_SEARCHSDK_FAILURE_RATE fraction of searches which return false (0.0 - 1.0)
+    - MOCK_SEARCHSDK_STALL_RATE   fraction of searches which stall (0.0 - 1.0)
+    - MOCK_SEARCHSDK_STALL_MS     how long a stalled search takes (default 60000)
+    - MOCK_SEARCHSDK_SEED         seed for jitter and failures (default 1)
+    - MOCK_SEARCHSDK_MATCH_PEAK   if set, match by peak position (see above)
+    - MOCK_SEARCHSDK_VERBOSE      if set, report call counts to stderr on Exit
+
+    Searches sleep in short slices, so SearchSDK_CancelSearch and
+    SearchSDK_GetProgressPercentage behave as they would against a real search.
+*/
+
+#include "SearchSDK.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#ifdef _WIN32
+#define MOCK_EXPORT extern "C" __declspec(dllexport)
+#else
+#define MOCK_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+
+namespace
+{
+    //! canned results (the compounds in data/good, plus some distractors)
+    const wchar_t* const COMPOUNDS[] =
+    {
+        L"4-Acetamidophenol", L"Acetone", L"Acetonitrile", L"Ammonium chloride",
+        L"Ammonium nitrate", L"1,4-Bis(2-methylstyryl)benzene", L"Benzene",
+        L"Caffeine", L"Coconut oil", L"Cyclohexane", L"Ethanol", L"D-Fructose",
+        L"D-Glucose", L"2-Propanol", L"Linseed oil", L"2-Butanone", L"Methanol",
+        L"Mineral oil", L"Naphthalene", L"Sodium perchlorate", L"Sucrose",
+        L"Sulfur", L"Toluene", L"Urea", L"Polystyrene", L"Calcite",
+        L"Cellulose", L"Dimethyl sulfoxide", L"Chloroform", L"Hexane", L"Water"
+    };
+    const int COMPOUND_COUNT = (int)(sizeof(COMPOUNDS) / sizeof(COMPOUNDS[0]));
+
+    struct Config
+    {
+        double initMS      = 0;
+        double openMS      = 0;
+        double latencyMS   = 0;
+        double jitterMS    = 0;
+        double pixelUS     = 0;
+        double failureRate = 0;
+        double stallRate   = 0;
+        double stallMS     = 60000;
+        uint64_t seed      = 1;
+        bool matchPeak     = false;
+        bool verbose       = false;
+
+        Config()
+        {
+            initMS      = getDouble("MOCK_SEARCHSDK_INIT_MS",      initMS);
+            openMS      = getDouble("MOCK_SEARCHSDK_OPEN_MS",      openMS);
+            latencyMS   = getDouble("MOCK_SEARCHSDK_LATENCY_MS",   latencyMS);
+            jitterMS    = getDouble("MOCK_SEARCHSDK_JITTER_MS",    jitterMS);
+            pixelUS     = getDouble("MOCK_SEARCHSDK_PIXEL_US",     pixelUS);
+            failureRate = getDouble("MOCK_SEARCHSDK_FAILURE_RATE", failureRate);
+            stallRate   = getDouble("MOCK_SEARCHSDK_STALL_RATE",   stallRate);
+            stallMS     = getDouble("MOCK_SEARCHSDK_STALL_MS",     stallMS);
+            seed        = (uint64_t) getDouble("MOCK_SEARCHSDK_SEED", (double) seed);
+            matchPeak   = getenv("MOCK_SEARCHSDK_MATCH_PEAK") != nullptr;
+            verbose     = getenv("MOCK_SEARCHSDK_VERBOSE") != nullptr;
+        }
+
+        static double getDouble(const char* name, double defaultValue)
+        {
+            const char* s = getenv(name);
+            return s && *s ? atof(s) : defaultValue;
+        }
+    };
+
+    const Config& config()
+    {
+        static Config c;
+        return c;
+    }
+
+    std::atomic<long> s_openCount(0);
+    std::atomic<long> s_closeCount(0);
+    std::atomic<long> s_searchCount(0);
+    std::atomic<long> s_failureCount(0);
+    std::atomic<long> s_cancelCount(0);
+
+    //! state behind each SEARCHSDK_HANDLE
+    struct Search
+    {
+        uint64_t calls = 0;
+        std::atomic<bool> cancel { false };
+        std::atomic<double> progress { 0 };
+    };
+
+    //! 64-bit FNV-1a, used to fingerprint spectra
+    uint64_t hash(uint64_t h, const void* data, size_t len)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; i++)
+        {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    //! splitmix64 finalizer, mapping (seed, spectrum, call) to a well-mixed value
+    uint64_t mix(uint64_t z)
+    {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    //! uniform [0, 1) from a mixed value
+    double unit(uint64_t z)
+    {
+        return (z >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    //! wavenumber of the most prominent peak: the point standing furthest above
+    //! the mean of the points about 20 cm-1 either side (x, if given, else an
+    //! even grid from firstX to lastX)
+    double strongestPeak(const double* xArray, const double* yArray, int arrayCnt, double firstX, double lastX)
+    {
+        if (arrayCnt < 2)
+            return 0;
+        auto x = [&](int i) { return xArray ? xArray[i] : firstX + i * (lastX - firstX) / (arrayCnt - 1); };
+
+        double spacing = std::fabs(x(arrayCnt - 1) - x(0)) / (arrayCnt - 1);
+        int w = spacing > 0 ? (int)(20 / spacing + 0.5) : 1;
+        w = w < 1 ? 1 : w;
+
+        int best = 0;
+        double bestHeight = -1e300;
+        for (int i = w; i < arrayCnt - w; i++)
+        {
+            double height = yArray[i] - 0.5 * (yArray[i - w] + yArray[i + w]);
+            if (height > bestHeight)
+            {
+                bestHeight = height;
+                best = i;
+            }
+        }
+        return x(best);
+    }
+
+    void sleepMS(double ms)
+    {
+        if (ms > 0)
+            std::this_thread::sleep_for(duration<double, std::milli>(ms));
+    }
+
+    //! sleep for the configured search latency, honoring cancellation
+    //! @returns false if the search was canceled
+    bool simulateSearch(Search* search, double ms)
+    {
+        auto start = steady_clock::now();
+        while (true)
+        {
+            if (search->cancel)
+                return false;
+
+            double elapsedMS = duration<double, std::milli>(steady_clock::now() - start).count();
+            if (elapsedMS >= ms)
+                break;
+
+            search->progress = 100.0 * elapsedMS / ms;
+            sleepMS(ms - elapsedMS < 1 ? ms - elapsedMS : 1);
+        }
+        return true;
+    }
+
+    bool runSearch(SEARCHSDK_HANDLE hSearch, const double* xArray, const double* yArray, int arrayCnt,
+                   double firstX, double lastX, SearchSDK_Match* pResults, int* pnResults)
+    {
+        s_searchCount++;
+
+        Search* search = static_cast<Search*>(hSearch);
+        if (!search || !yArray || arrayCnt < 1 || !pResults || !pnResults)
+            return false;
+
+        const Config& c = config();
+        const int capacity = *pnResults;
+        *pnResults = 0;
+
+        // a cancel may arrive before the search starts, so the flag is only
+        // cleared once one has ended (it starts clear, with the handle)
+        search->progress = 0;
+
+        uint64_t h = hash(0xcbf29ce484222325ULL, yArray, arrayCnt * sizeof(double));
+        if (xArray)
+            h = hash(h, xArray, arrayCnt * sizeof(double));
+
+        // per-call randomness is deterministic for a given seed, spectrum and
+        // position in this handle's call sequence
+        uint64_t r = mix(c.seed ^ mix(h ^ mix(++search->calls)));
+
+        double latency = c.latencyMS + c.jitterMS * (2.0 * unit(mix(r + 1)) - 1.0) + c.pixelUS * arrayCnt / 1000;
+        if (unit(mix(r + 3)) < c.stallRate)
+            latency = c.stallMS;
+        bool finished = simulateSearch(search, latency);
+        search->cancel = false;
+        if (!finished)
+        {
+            s_cancelCount++;
+            return false;
+        }
+        search->progress = 100;
+
+        if (unit(mix(r + 2)) < c.failureRate)
+        {
+            s_failureCount++;
+            return false;
+        }
+
+        // matches depend only on the spectrum (or its strongest peak)
+        if (c.matchPeak)
+            h = mix((uint64_t)(int64_t) std::floor(strongestPeak(xArray, yArray, arrayCnt, firstX, lastX) / 10));
+        int count = capacity < COMPOUND_COUNT ? capacity : COMPOUND_COUNT;
+        int first = (int)(h % COMPOUND_COUNT);
+        double top = 0.70 + 0.29 * unit(mix(h));
+        for (int i = 0; i < count; i++)
+        {
+            SearchSDK_Match& match = pResults[i];
+            match.m_matchName = const_cast<wchar_t*>(COMPOUNDS[(first + 7 * i) % COMPOUND_COUNT]);
+            match.m_matchPercentage = top * (1.0 - 0.04 * i);
+            match.m_bLocked = (mix(h + i) % 10) == 0;
+        }
+        *pnResults = count;
+        return true;
+    }
+}
+
+MOCK_EXPORT void SearchSDK_Init()
+{
+    sleepMS(config().initMS);
+}
+
+MOCK_EXPORT void SearchSDK_Exit()
+{
+    if (config().verbose)
+        fprintf(stderr, "MockSearchSDK: %ld opened, %ld closed, %ld searches, %ld failed, %ld canceled\n",
+            s_openCount.load(), s_closeCount.load(), s_searchCount.load(), s_failureCount.load(), s_cancelCount.load());
+}
+
+MOCK_EXPORT SEARCHSDK_HANDLE SearchSDK_OpenSearch()
+{
+    sleepMS(config().openMS);
+    s_openCount++;
+    return new Search();
+}
+
+MOCK_EXPORT bool SearchSDK_CloseSearch(SEARCHSDK_HANDLE hSearch)
+{
+    if (!hSearch)
+        return false;
+    s_closeCount++;
+    delete static_cast<Search*>(hSearch);
+    return true;
+}
+
+MOCK_EXPORT bool SearchSDK_RunSearchEvenlySpaced(SEARCHSDK_HANDLE hSearch,
+                                                 unsigned int technique,
+                                                 const double* yArray,
+                                                 int arrayCnt,
+                                                 double firstX,
+                                                 double lastX,
+                                                 unsigned short xUnit,
+                                                 unsigned short yUnit,
+                                                 SearchSDK_Match* pResults,
+                                                 int* pnResults)
+{
+    return runSearch(hSearch, nullptr, yArray, arrayCnt, firstX, lastX, pResults, pnResults);
+}
+
+MOCK_EXPORT bool SearchSDK_RunSearchUnevenlySpaced(SEARCHSDK_HANDLE hSearch,
+                                                   unsigned int technique,
+                                                   const double* xArray,
+                                                   const double* yArray,
+                                                   int arrayCnt,
+                                                   unsigned short xUnit,
+                                                   unsigned short yUnit,
+                                                   SearchSDK_Match* pResults,
+                                                   int* pnResults)
+{
+    return runSearch(hSearch, xArray, yArray, arrayCnt, 0, 0, pResults, pnResults);
+}
+
+MOCK_EXPORT bool SearchSDK_CancelSearch(SEARCHSDK_HANDLE hSearch)
+{
+    if (!hSearch)
+        return false;
+    static_cast<Search*>(hSearch)->cancel = true;
+    return true;
+}
+
+MOCK_EXPORT double SearchSDK_GetProgressPercentage(SEARCHSDK_HANDLE hSearch)
+{
+    if (!hSearch)
+        return 0;
+    return static_cast<Search*>(hSearch)->progress;
+}